@@ -134,4 +134,22 @@ struct AngularSpeedEstimator
   }
 };
 
+/**
+ * @brief Seconds per turn and between spokes for an angular speed estimate,
+ * both 0 while the speed is unknown.
+ *
+ * @param angular_speed   Estimated speed in radians per second.
+ * @param angle_increment Angle between spokes in radians.
+ */
+inline void scanTiming(double angular_speed, double angle_increment, double &scan_time, double &time_increment)
+{
+  scan_time = 0.0;
+  time_increment = 0.0;
+  if (angular_speed != 0.0)
+  {
+    scan_time = 2 * M_PI / std::fabs(angular_speed);
+    time_increment = std::fabs(angle_increment) / std::fabs(angular_speed);
+  }
+}
+
 #endif // ANGULAR_SPEED_ESTIMATOR_H
@@ -0,0 +1,132 @@
+#ifndef HALO_RADAR_BLOB_EXTRACTOR_H
+#define HALO_RADAR_BLOB_EXTRACTOR_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "processing_stage.h"
+#include "revolution.h"
+
+namespace halo_radar
+{
+
+#pragma pack(push, 1)
+
+// A connected group of cells above threshold in one revolution.
+struct Contact
+{
+    uint64_t revolution;
+    float angle;        // degrees, intensity weighted centroid
+    float range;        // meters, intensity weighted centroid
+    float x;            // meters, range*sin(angle)
+    float y;            // meters, range*cos(angle)
+    uint16_t firstRow;  // rows firstRow to firstRow+rows-1, modulo spokes
+    uint16_t rows;
+    uint16_t firstBin;
+    uint16_t lastBin;
+    uint32_t cells;
+    uint8_t peak;
+};
+
+#pragma pack(pop)
+
+struct BlobConfig
+{
+    uint8_t threshold = 4;      // cells at or above this are foreground
+    uint32_t minimumCells = 3;  // smaller groups are dropped as speckle
+    unsigned stripes = 4;       // azimuth stripes labelled in parallel
+    std::vector<int> cpus;      // cores the stripe workers may run on, empty for no pinning
+};
+
+// Connected component labelling (8-connected) of a polar frame.
+//
+// The rows are split into azimuth stripes labelled concurrently with a
+// union-find over cell indices, each stripe summarising its components as
+// partial blobs. The partials are then joined across the stripe boundaries,
+// including the one between the last row and row 0, so a target sitting on
+// north comes out as one contact.
+//
+// Stripes past the first are labelled by workers started once with the
+// extractor, pinned to BlobConfig::cpus and under SCHED_OTHER whatever the
+// creating thread runs as; the calling thread labels the first stripe and
+// waits for the rest.
+class BlobExtractor
+{
+public:
+    BlobExtractor(BlobConfig const &config = BlobConfig());
+    ~BlobExtractor();
+    BlobExtractor(BlobExtractor const &) = delete;
+    BlobExtractor &operator=(BlobExtractor const &) = delete;
+
+    // Replaces contacts with those of revolution.
+    void extract(Revolution const &revolution, std::vector<Contact> &contacts);
+
+    BlobConfig const &config() const { return m_config; }
+
+private:
+    struct Partial
+    {
+        uint32_t cells = 0;
+        uint64_t weight = 0;
+        uint64_t rowSum = 0;    // intensity weighted
+        uint64_t binSum = 0;
+        uint16_t minRow = 0xffff;
+        uint16_t maxRow = 0;
+        uint16_t minBin = 0xffff;
+        uint16_t maxBin = 0;
+        uint8_t peak = 0;
+    };
+
+    void worker(size_t stripe);
+    void labelStripe(Revolution const &revolution, size_t stripe);
+    uint32_t findPartial(uint32_t p);
+    void joinRows(Revolution const &revolution, size_t upper, size_t lower, bool wrap);
+
+    BlobConfig m_config;
+    std::vector<size_t> m_stripeStart;      // first row of each stripe, plus spokes
+    std::vector<uint32_t> m_parent;         // union-find over cell indices
+    std::vector<uint32_t> m_label;          // cell to partial index within its stripe
+    std::vector<std::vector<Partial>> m_stripePartials;
+    std::vector<uint32_t> m_partialOffset;
+    std::vector<uint32_t> m_partialParent;  // union-find over all partials
+    std::vector<uint32_t> m_partialSegment; // root before joining across north
+    std::vector<uint8_t> m_seamSides;       // per segment root, SEAM_LOW and SEAM_HIGH
+    std::vector<Partial> m_blobs;           // partials summed into their root
+
+    std::vector<std::thread> m_workers;     // stripe i+1 each
+    std::mutex m_poolMutex;
+    std::condition_variable m_start;
+    std::condition_variable m_done;
+    const Revolution *m_job = nullptr;
+    size_t m_stripes = 0;                   // of the current job
+    uint64_t m_generation = 0;              // jobs started
+    size_t m_pending = 0;                   // workers still labelling
+    bool m_exitFlag = false;
+};
+
+// Data path stage assembling revolutions and handing out the contacts of
+// each finished one.
+class BlobStage: public ProcessingStage
+{
+public:
+    using Callback = std::function<void(Revolution const &revolution, std::vector<Contact> const &contacts)>;
+
+    BlobStage(BlobConfig const &config, Callback callback, uint16_t spokes = 2048, uint16_t bins = 1024);
+
+    std::string name() const override { return "blob"; }
+    void process(std::vector<Scanline> &scanlines) override;
+
+private:
+    BlobExtractor m_extractor;
+    Callback m_callback;
+    RevolutionAssembler m_assembler;
+    std::vector<Contact> m_contacts;
+};
+
+} // namespace halo_radar
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef HALO_RADAR_CFAR_H
+#define HALO_RADAR_CFAR_H
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "processing_stage.h"
+
+namespace halo_radar
+{
+
+enum CfarType
+{
+    CFAR_CELL_AVERAGING,
+    CFAR_ORDERED_STATISTIC
+};
+
+struct CfarConfig
+{
+    CfarType type = CFAR_CELL_AVERAGING;
+    uint16_t guardCells = 2;        // each side of the cell under test
+    uint16_t trainingCells = 16;    // each side, beyond the guard cells
+    float scale = 2.0;              // threshold over the noise estimate
+    float rank = 0.75;              // ordered statistic, as a fraction of the training cells
+    uint8_t minimumIntensity = 2;   // cells below this are never detections
+};
+
+struct CfarDetection
+{
+    uint16_t azimuth;   // 0-4095, as RawScanline::angle
+    uint16_t bin;
+    uint8_t intensity;
+};
+
+// Constant false alarm rate detection along a spoke.
+//
+// Cell averaging compares each cell against the mean of the training cells
+// on both sides, taken from prefix sums so every cell costs the same
+// regardless of window size; the interior of the spoke is compared four
+// cells at a time with SSE2. Near the ends the training window is clipped
+// to the cells that exist. Ordered statistic uses the rank-th smallest
+// training cell instead of the mean, kept in a sliding 16 bin histogram
+// since intensities are 4-bit.
+class CfarDetector
+{
+public:
+    CfarDetector(CfarConfig const &config = CfarConfig());
+
+    // Sets bitmap[i] to 1 where bin i is a detection, 0 elsewhere, and
+    // returns the number of detections.
+    size_t detect(const uint8_t *intensities, size_t bins, uint8_t *bitmap);
+
+    CfarConfig const &config() const { return m_config; }
+
+private:
+    void cellAveraging(const uint8_t *intensities, size_t bins, uint8_t *bitmap);
+    void orderedStatistic(const uint8_t *intensities, size_t bins, uint8_t *bitmap);
+
+    CfarConfig m_config;
+    std::vector<int32_t> m_prefix;
+};
+
+// Data path stage running CFAR on every spoke as it is decoded, handing the
+// detections of each sector to a callback.
+class CfarStage: public ProcessingStage
+{
+public:
+    using Callback = std::function<void(std::vector<CfarDetection> const &detections)>;
+
+    CfarStage(CfarConfig const &config, Callback callback);
+
+    std::string name() const override { return "cfar"; }
+    void process(std::vector<Scanline> &scanlines) override;
+
+private:
+    CfarDetector m_detector;
+    Callback m_callback;
+    std::vector<uint8_t> m_bitmap;
+    std::vector<CfarDetection> m_detections;
+};
+
+} // namespace halo_radar
+
+#endif
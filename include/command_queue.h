@@ -0,0 +1,128 @@
+#ifndef HALO_RADAR_COMMAND_QUEUE_H
+#define HALO_RADAR_COMMAND_QUEUE_H
+
+#include <sys/socket.h>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "metrics.h"
+#include "radar_protocol.h"
+
+namespace halo_radar
+{
+
+enum CommandOutcome
+{
+    COMMAND_ACKNOWLEDGED,   // a report showed the new value
+    COMMAND_SUPERSEDED,     // a later write to the same control replaced it
+    COMMAND_TIMED_OUT,      // sent, but no report confirmed it in time
+    COMMAND_SEND_FAILED,
+    COMMAND_REJECTED        // unknown control or value, nothing sent
+};
+
+struct CommandResult
+{
+    CommandOutcome outcome = COMMAND_REJECTED;
+    std::chrono::nanoseconds roundTrip{0};  // send to confirming report, when acknowledged
+};
+
+struct CommandStatistics
+{
+    uint64_t submitted = 0;
+    uint64_t coalesced = 0;     // writes replaced before they were sent
+    uint64_t datagrams = 0;
+    uint64_t batches = 0;       // sendmmsg rounds
+    uint64_t acknowledged = 0;
+    uint64_t timedOut = 0;
+    double meanRoundTripSeconds = 0.0;
+    double maxRoundTripSeconds = 0.0;
+};
+
+// Sends control commands to one radar in batches and tracks their
+// acknowledgement.
+//
+// Writes are held for a short window from the first one, so a burst such
+// as a slider drag collapses into the last value per control, and
+// everything due goes out with one sendmmsg. A sent command then waits for
+// the c402/c404/c408 report showing its value, see reportConfirms; its
+// future completes with the round trip, or with COMMAND_TIMED_OUT. The
+// radar's acknowledgement is implicit, so a later write to the same control
+// supersedes an unconfirmed one.
+class CommandQueue
+{
+public:
+    // Sends count datagrams, each message missing only its destination.
+    // Returns how many went out.
+    using BatchSender = std::function<int(mmsghdr *messages, unsigned count)>;
+
+    CommandQueue(BatchSender sender, std::chrono::milliseconds window, std::chrono::milliseconds timeout,
+                 MetricLabels const &labels = MetricLabels());
+    // Sends what is still pending; unconfirmed commands complete as timed out.
+    ~CommandQueue();
+
+    // Encodes straight away, so a malformed number throws to the caller as
+    // std::stof does.
+    std::future<CommandResult> submit(std::string const &key, std::string const &value);
+
+    // Matches a decoded report against the commands in flight.
+    void confirm(const ReportValue *values, int count);
+
+    CommandStatistics statistics() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Pending
+    {
+        const CommandDescriptor *descriptor;
+        std::string value;
+        CommandPackets packets;
+        std::promise<CommandResult> promise;
+        Clock::time_point due;
+    };
+    struct InFlight
+    {
+        const CommandDescriptor *descriptor;
+        std::string value;
+        std::promise<CommandResult> promise;
+        Clock::time_point sent;
+        Clock::time_point deadline;
+    };
+
+    void flushThread();
+    // Sends everything pending; called with the lock held, drops it while sending.
+    void flush(std::unique_lock<std::mutex> &lock);
+    void expire(Clock::time_point now);
+
+    BatchSender m_sender;
+    std::chrono::milliseconds m_window;
+    std::chrono::milliseconds m_timeout;
+
+    std::vector<Pending> m_pending;
+    std::vector<InFlight> m_inFlight;
+    double m_roundTripSum = 0.0;
+    double m_roundTripMax = 0.0;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_exitFlag = false;
+    std::thread m_thread;
+
+    std::shared_ptr<Counter> m_submitted;
+    std::shared_ptr<Counter> m_coalesced;
+    std::shared_ptr<Counter> m_datagrams;
+    std::shared_ptr<Counter> m_batches;
+    std::shared_ptr<Counter> m_acknowledged;
+    std::shared_ptr<Counter> m_timedOut;
+    std::shared_ptr<Histogram> m_roundTripSeconds;
+};
+
+} // namespace halo_radar
+
+#endif
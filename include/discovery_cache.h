@@ -0,0 +1,45 @@
+#ifndef HALO_RADAR_DISCOVERY_CACHE_H
+#define HALO_RADAR_DISCOVERY_CACHE_H
+
+#include "radar.h"
+
+namespace halo_radar
+{
+
+// Last discovered address sets, kept on disk so a restart can begin
+// streaming before a scan completes. Entries are keyed by channel label,
+// like the channels themselves, so a radar rediscovered on another
+// interface replaces its old entries.
+//
+// One line per address set, serialno and label double quoted:
+//   "serialno" interface "label" data_ip:port report_ip:port send_ip:port
+class DiscoveryCache
+{
+public:
+    DiscoveryCache(std::string const &path);
+
+    bool load();
+    // Written to a temporary file and renamed, so readers never see a
+    // partial cache.
+    bool save() const;
+
+    std::vector<AddressSet> addressSets() const;
+
+    // Replaces the cached sets with the labels of those in sets.
+    // Returns true if anything changed.
+    bool update(std::vector<AddressSet> const &sets);
+
+    std::string const &path() const { return m_path; }
+
+private:
+    std::string m_path;
+    std::vector<AddressSet> m_sets;
+    mutable std::mutex m_mutex;
+};
+
+// True if both sets point at the same groups and ports on the same interface.
+bool sameAddresses(AddressSet const &a, AddressSet const &b);
+
+} // namespace halo_radar
+
+#endif
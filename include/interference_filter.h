@@ -0,0 +1,68 @@
+#ifndef HALO_RADAR_INTERFERENCE_FILTER_H
+#define HALO_RADAR_INTERFERENCE_FILTER_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "processing_stage.h"
+#include "radar.h"
+
+namespace halo_radar
+{
+
+struct InterferenceStatistics
+{
+    uint64_t spokes = 0;
+    uint64_t cells = 0;
+    uint64_t replacedCells = 0;
+
+    double replacedFraction() const { return cells ? double(replacedCells)/cells : 0.0; }
+};
+
+// Suppresses interference from other radars, which shows up as spikes on a
+// single spoke, with a 3-tap azimuthal median.
+//
+// A cell is replaced by the median of itself and the same bin on the
+// spokes either side when it is more than margin above both, which is then
+// the larger neighbour. Cells that are not spikes pass unchanged, so target
+// edges and weak returns are left alone. Sixteen bins are compared at a time
+// with SSE2.
+//
+// The filter needs the next spoke, so output runs one spoke behind: each
+// call gives back the previous spoke, filtered, in place of the new one.
+// The very first spoke is held back, so the scanline vector shrinks by one
+// on the first call. Spokes with a different range or size than their
+// neighbours, or more than one spoke step away from either of them because
+// spokes were lost in between, pass through unfiltered.
+class InterferenceFilter: public ProcessingStage
+{
+public:
+    InterferenceFilter(uint8_t margin = 2, uint16_t spokes = 2048);
+
+    std::string name() const override { return "interference_rejection"; }
+    void process(std::vector<Scanline> &scanlines) override;
+
+    // Totals since the previous call.
+    InterferenceStatistics take();
+
+private:
+    // Filters m_current with its neighbours into out, returns replaced cells.
+    size_t filter(uint8_t *out);
+    // Whether two spokes are at most one step apart.
+    bool adjacent(float a, float b) const;
+
+    uint8_t m_margin;
+    float m_maxGap;     // degrees
+    bool m_primed = false;
+    Scanline m_previous;
+    Scanline m_current;
+    Scanline m_next;
+    std::atomic<uint64_t> m_spokes{0};
+    std::atomic<uint64_t> m_cells{0};
+    std::atomic<uint64_t> m_replacedCells{0};
+};
+
+} // namespace halo_radar
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef HALO_RADAR_IPV4_REASSEMBLER_H
+#define HALO_RADAR_IPV4_REASSEMBLER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace halo_radar
+{
+
+// UDP payloads from raw IPv4 packets, for the receive backends that see
+// frames rather than datagrams (PacketRing, XdpSocket).
+//
+// Halo sectors are larger than the usual MTU, so most arrive as IP
+// fragments. The radar sends one datagram at a time, so a few reassembly
+// slots cover reordering between two of them; the least recently touched
+// slot is reused.
+class Ipv4Reassembler
+{
+public:
+    Ipv4Reassembler();
+
+    // Only datagrams to this UDP port (network order) are handed out, 0 for
+    // any. The backends' filters only see the port on first fragments, so
+    // reassembled datagrams are checked here.
+    void setPort(uint16_t port) { m_port = port; }
+
+    // Takes the IPv4 packet at ip, of which captured bytes are available.
+    // Returns true with the UDP payload once a datagram is complete: in
+    // place for an unfragmented one, else in a slot buffer valid until the
+    // next call.
+    bool add(const uint8_t *ip, uint32_t captured, const uint8_t *&payload, int &size);
+
+    // Ethernet frame variant, skipping the link header.
+    bool addFrame(const uint8_t *frame, uint32_t length, const uint8_t *&payload, int &size);
+
+private:
+    bool udpPayload(const uint8_t *datagram, uint32_t length, const uint8_t *&payload, int &size);
+
+    struct Fragments
+    {
+        bool used = false;
+        uint32_t source = 0;
+        uint16_t id = 0;
+        uint32_t received = 0;  // bytes so far
+        uint32_t total = 0;     // datagram length once the last fragment is in
+        uint64_t touched = 0;
+        std::vector<uint8_t> data;
+    };
+    static const size_t slots = 4;
+
+    std::vector<Fragments> m_fragments;
+    uint64_t m_clock = 0;
+    uint16_t m_port = 0;
+};
+
+} // namespace halo_radar
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef HALO_RADAR_METRICS_H
+#define HALO_RADAR_METRICS_H
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace halo_radar
+{
+
+// Process wide metrics, exported in the Prometheus text format.
+//
+// Counters and histograms are split into cache line sized shards. Each
+// thread updates its own shard with a relaxed atomic add, so the data
+// threads never share a line or take a lock to count; only rendering sums
+// the shards. Metrics are created through the registry, which keeps weak
+// references: a series disappears from the output once its owner drops it.
+
+const size_t metric_shards = 16;
+
+// Shard of the calling thread.
+size_t metricShard();
+
+using MetricLabels = std::map<std::string, std::string>;
+
+class Counter
+{
+public:
+    void add(uint64_t n = 1)
+    {
+        m_shards[metricShard()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+    uint64_t value() const;
+
+private:
+    struct alignas(64) Shard
+    {
+        std::atomic<uint64_t> value{0};
+    };
+    Shard m_shards[metric_shards];
+};
+
+class Gauge
+{
+public:
+    void set(double v) { m_value.store(v, std::memory_order_relaxed); }
+    double value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<double> m_value{0.0};
+};
+
+class Histogram
+{
+public:
+    // bounds are the upper bucket limits, ascending; +Inf is implied.
+    Histogram(std::vector<double> const &bounds);
+
+    void observe(double v);
+
+    struct Snapshot
+    {
+        std::vector<uint64_t> cumulative; // per bound, then +Inf
+        double sum = 0.0;
+    };
+    Snapshot snapshot() const;
+    std::vector<double> const &bounds() const { return m_bounds; }
+
+private:
+    struct alignas(64) Shard
+    {
+        std::unique_ptr<std::atomic<uint64_t>[]> counts;
+        std::atomic<double> sum{0.0};
+    };
+    std::vector<double> m_bounds;
+    Shard m_shards[metric_shards];
+};
+
+// Buckets for durations of a few microseconds to a few hundred milliseconds.
+std::vector<double> latencyBuckets();
+
+class MetricsRegistry
+{
+public:
+    static MetricsRegistry &global();
+
+    std::shared_ptr<Counter> counter(std::string const &name, std::string const &help, MetricLabels const &labels = MetricLabels());
+    std::shared_ptr<Gauge> gauge(std::string const &name, std::string const &help, MetricLabels const &labels = MetricLabels());
+    std::shared_ptr<Histogram> histogram(std::string const &name, std::string const &help, MetricLabels const &labels = MetricLabels(),
+                                         std::vector<double> const &bounds = latencyBuckets());
+
+    // All live series in the Prometheus text exposition format.
+    std::string render();
+
+private:
+    enum Type
+    {
+        COUNTER,
+        GAUGE,
+        HISTOGRAM
+    };
+    struct Series
+    {
+        std::string labels;     // rendered, {a="b",...} or empty
+        std::weak_ptr<Counter> counter;
+        std::weak_ptr<Gauge> gauge;
+        std::weak_ptr<Histogram> histogram;
+    };
+    struct Family
+    {
+        std::string help;
+        Type type;
+        std::vector<Series> series;
+    };
+
+    Family &family(std::string const &name, std::string const &help, Type type);
+
+    std::mutex m_mutex;
+    std::map<std::string, Family> m_families;
+};
+
+// Serves GET /metrics from a registry over HTTP on its own thread.
+class MetricsServer
+{
+public:
+    MetricsServer(MetricsRegistry &registry = MetricsRegistry::global());
+    ~MetricsServer();
+
+    // Listens on address:port, address in network order. Returns false on
+    // failure, with errno set.
+    bool start(uint32_t address, uint16_t port);
+    void stop();
+
+private:
+    void serverThread();
+    void handle(int client);
+
+    MetricsRegistry &m_registry;
+    int m_socket = -1;
+    std::thread m_thread;
+    std::atomic<bool> m_exitFlag{false};
+};
+
+} // namespace halo_radar
+
+#endif
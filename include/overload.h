@@ -0,0 +1,61 @@
+#ifndef HALO_RADAR_OVERLOAD_H
+#define HALO_RADAR_OVERLOAD_H
+
+#include <chrono>
+
+namespace halo_radar
+{
+
+// How much fidelity the data path gives up to keep up with the radar. Each
+// level includes the ones before it. Losses are uniform, every revolution
+// keeps its full extent at a coarser resolution, rather than the receive
+// buffer overflowing and whole sectors going missing at random.
+enum OverloadLevel
+{
+    OVERLOAD_NONE,          // full fidelity
+    OVERLOAD_SKIP_OPTIONAL, // optional stages are skipped, see ProcessingStage::optional
+    OVERLOAD_HALF_RANGE,    // pairs of range bins are combined, keeping the stronger echo
+    OVERLOAD_HALF_AZIMUTH   // every other spoke is dropped before decoding
+};
+
+const char *overloadLevelName(OverloadLevel level);
+
+struct OverloadConfig
+{
+    bool enabled = true;
+    double highWatermark = 0.5;     // receive backlog, 0 empty to 1 full, raising the level
+    double lowWatermark = 0.1;      // backlog below which the level may drop again
+    std::chrono::milliseconds raiseInterval{250};   // lets a raise take effect before the next one
+    std::chrono::milliseconds lowerHold{2000};      // time below lowWatermark per level dropped
+    OverloadLevel maxLevel = OVERLOAD_HALF_AZIMUTH;
+};
+
+// Picks the OverloadLevel from samples of the receive backlog, the share
+// of the socket buffer, packet ring or AF_XDP ring waiting to be read.
+//
+// A backlog at or above the high watermark raises the level one step at a
+// time, at most once per raiseInterval. Only a backlog staying below the
+// low watermark for lowerHold brings it down again, again one step at a
+// time, so the level does not flap with the bursty arrival of sectors.
+class OverloadController
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    OverloadController(OverloadConfig const &config = OverloadConfig());
+
+    // Returns true if the level changed.
+    bool update(double backlog, Clock::time_point now);
+    OverloadLevel level() const { return m_level; }
+
+private:
+    OverloadConfig m_config;
+    OverloadLevel m_level = OVERLOAD_NONE;
+    Clock::time_point m_changed;    // of the last level change
+    Clock::time_point m_lowSince;   // start of the current stretch below lowWatermark
+    bool m_low = false;
+};
+
+} // namespace halo_radar
+
+#endif
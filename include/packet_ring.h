@@ -0,0 +1,80 @@
+#ifndef HALO_RADAR_PACKET_RING_H
+#define HALO_RADAR_PACKET_RING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <linux/if_packet.h>
+
+#include "ipv4_reassembler.h"
+
+namespace halo_radar
+{
+
+struct PacketRingConfig
+{
+    uint32_t blockSize = 1 << 18;   // bytes, a multiple of the page size
+    uint32_t blockCount = 64;
+    uint32_t retireMilliseconds = 2; // a part filled block is handed over after this long
+};
+
+// Receives the UDP payloads of one multicast group and port straight from
+// an AF_PACKET TPACKET_V3 ring, skipping the socket layer.
+//
+// A classic BPF filter on the packet socket keeps everything but the group
+// and port out of the ring. The kernel fills whole blocks of frames and
+// hands each block over at once, so the receiver wakes up per block rather
+// than per datagram. Whole datagrams are read in place; a block goes back to
+// the kernel once all its frames have been consumed. The ring sees frames,
+// not datagrams, so sectors larger than the MTU arrive as IP fragments and
+// are reassembled with one copy, see Ipv4Reassembler.
+//
+// An unbound UDP socket is kept joined to the group so IGMP snooping
+// switches keep forwarding it; having no port it receives nothing itself.
+// Needs CAP_NET_RAW.
+class PacketRing
+{
+public:
+    PacketRing(PacketRingConfig const &config = PacketRingConfig());
+    ~PacketRing();
+
+    // Opens the ring on the interface owning the local address interface,
+    // for group:port (network order). Returns false on failure, with errno
+    // set.
+    bool open(uint32_t interface, uint32_t group, uint16_t port);
+    bool isOpen() const { return m_socket >= 0; }
+    void close();
+
+    // Next UDP payload, valid until the following call. Waits up to
+    // timeoutMilliseconds for the kernel to hand over a block; returns false
+    // if none arrived.
+    bool next(const uint8_t *&payload, int &size, int timeoutMilliseconds);
+
+    // Frames dropped for lack of room in the ring since the last call.
+    uint64_t takeDrops();
+
+    // Share of the ring's blocks filled and waiting behind the current one,
+    // 0 to 1.
+    double backlog() const;
+
+    size_t bufferBytes() const { return m_ringSize; }
+
+private:
+    // Returns the current block to the kernel.
+    void releaseBlock();
+    PacketRingConfig m_config;
+    int m_socket = -1;
+    int m_joinSocket = -1;
+    uint8_t *m_ring = nullptr;
+    size_t m_ringSize = 0;
+
+    uint32_t m_block = 0;                   // block being read, or next to wait for
+    tpacket_block_desc *m_current = nullptr; // null when waiting
+    uint32_t m_remaining = 0;               // frames left in the current block
+    tpacket3_hdr *m_frame = nullptr;
+
+    Ipv4Reassembler m_reassembler;
+};
+
+} // namespace halo_radar
+
+#endif
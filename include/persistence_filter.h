@@ -0,0 +1,69 @@
+#ifndef HALO_RADAR_PERSISTENCE_FILTER_H
+#define HALO_RADAR_PERSISTENCE_FILTER_H
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "processing_stage.h"
+
+namespace halo_radar
+{
+
+struct PersistenceConfig
+{
+    uint16_t spokes = 2048;
+    uint16_t bins = 1024;
+    uint8_t decayShift = 2;     // each scan keeps 1 - 2^-decayShift of the old value
+    bool replace = true;        // write the filtered spoke over the raw one
+};
+
+// Scan to scan persistence in the polar domain.
+//
+// Every cell holds an 8-bit persistence value, 16 times the intensity scale,
+// updated when a new spoke for its azimuth arrives:
+//     p = p - p/2^k + x*16/2^k
+// saturating at 255, so a steady echo settles at 16x and one that shows up
+// on a single scan only reaches 16x/2^k. The filtered intensity is p/16.
+// Sixteen cells are updated at a time with SSE2.
+class PersistenceFilter
+{
+public:
+    PersistenceFilter(PersistenceConfig const &config = PersistenceConfig());
+
+    // Updates the cells of the row for angle (degrees) with count raw
+    // intensities and writes count filtered ones to out, which may be
+    // intensities itself. Bins past the image width pass through unchanged.
+    void update(float angle, const uint8_t *intensities, size_t count, uint8_t *out);
+
+    void clear();
+
+private:
+    PersistenceConfig m_config;
+    std::vector<uint8_t> m_image;   // spokes*bins persistence values
+};
+
+// Data path stage running the persistence filter on each spoke. The
+// filtered spoke replaces the raw one if configured, and is handed to the
+// callback either way.
+class PersistenceStage: public ProcessingStage
+{
+public:
+    using Callback = std::function<void(Scanline const &raw, const uint8_t *filtered, size_t count)>;
+
+    PersistenceStage(PersistenceConfig const &config = PersistenceConfig(), Callback callback = Callback());
+
+    std::string name() const override { return "persistence"; }
+    void process(std::vector<Scanline> &scanlines) override;
+
+private:
+    PersistenceFilter m_filter;
+    bool m_replace;
+    Callback m_callback;
+    std::vector<uint8_t> m_filtered;
+    std::vector<uint8_t> m_expanded;    // range decimated spokes at raw bins
+};
+
+} // namespace halo_radar
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef HALO_RADAR_PROCESSING_STAGE_H
+#define HALO_RADAR_PROCESSING_STAGE_H
+
+#include <string>
+#include <vector>
+
+namespace halo_radar
+{
+
+struct Scanline;
+
+// A step of the radar data path. Stages run on the data thread for every
+// decoded sector, in the order they were added with Radar::addStage, before
+// processData sees the scanlines. They may modify the scanlines in place.
+class ProcessingStage
+{
+public:
+    virtual ~ProcessingStage() = default;
+
+    virtual std::string name() const = 0;
+    virtual void process(std::vector<Scanline> &scanlines) = 0;
+
+    // Optional stages only measure or refine, the data is usable without
+    // them; they are the first thing skipped under overload, see
+    // OverloadController.
+    virtual bool optional() const { return false; }
+};
+
+} // namespace halo_radar
+
+#endif
@@ -9,9 +9,18 @@
 #include <mutex>
 #include <map>
 #include <chrono>
+#include <atomic>
+#include <functional>
+#include <memory>
 
 #include "logger.h"
 #include "radar_structures.h"
+#include "thread_utils.h"
+#include "processing_stage.h"
+#include "metrics.h"
+#include "command_queue.h"
+#include "subscription.h"
+#include "overload.h"
 
 namespace halo_radar
 {
@@ -30,40 +39,185 @@ struct AddressSet
     IPAddress send;
     IPAddress report;
     uint32_t interface;
+    std::string serialno;
     
     std::string str() const;
 };
 
-std::vector <AddressSet> scan(quill::Logger *logger);
-std::vector <AddressSet> scan(quill::Logger *logger, const std::vector<uint32_t> &addresses);
+// HaloA and HaloB address sets announced in a b201 report.
+std::vector <AddressSet> addressSetsFromReport(RadarReport_b201 const &report, uint32_t interface);
+
+// Called for each address set as soon as it is discovered. Returning false
+// ends the scan early.
+using ScanCallback = std::function<bool(AddressSet const &)>;
+
+// Probes all the given interfaces at once from a single poll loop and also
+// accepts unsolicited b201 reports, until timeout expires, every interface
+// has answered or the callback asks to stop.
+void scan(quill::Logger *logger, const std::vector<uint32_t> &addresses, std::chrono::milliseconds timeout, ScanCallback const &callback);
+
+// Blocking scans for up to 3 s. With firstRadarOnly they return as soon as
+// both address sets of the first radar found are in.
+std::vector <AddressSet> scan(quill::Logger *logger, bool firstRadarOnly = false);
+std::vector <AddressSet> scan(quill::Logger *logger, const std::vector<uint32_t> &addresses, bool firstRadarOnly = false);
+
+// Doppler classification of a bin, see unpackDopplerSpoke.
+enum DopplerClass : uint8_t
+{
+    DOPPLER_NONE = 0,
+    DOPPLER_APPROACHING = 1,
+    DOPPLER_RECEDING = 2
+};
 
 struct Scanline
 {
     float angle; // degrees clockwise relative to fwd
     float range; // meters
     std::vector<uint8_t> intensities;
+    std::vector<uint8_t> doppler; // DopplerClass per bin, empty unless doppler_mode is on
+    uint8_t rangeDecimation = 1;  // raw bins combined into each one, 2 when shedding load, see OverloadLevel
+};
+
+// How the data thread receives sectors.
+enum ReceiveBackend
+{
+    RECEIVE_SOCKET,         // UDP socket
+    RECEIVE_PACKET_RING,    // AF_PACKET TPACKET_V3 ring, see PacketRing; needs CAP_NET_RAW
+    RECEIVE_XDP             // AF_XDP socket, see XdpSocket; needs CAP_NET_ADMIN and CAP_BPF
+};
+
+// Per radar channel options, applied when the threads are started.
+struct RadarConfig
+{
+    std::vector<int> dataCpus;   // cores the data (receive and decode) thread may run on, empty for no pinning
+    std::vector<int> reportCpus; // cores the report thread may run on, empty for no pinning
+    int dataPriority = 0;        // SCHED_FIFO priority of the data thread, 0 keeps SCHED_OTHER
+    int reportPriority = 0;      // SCHED_FIFO priority of the report thread, 0 keeps SCHED_OTHER
+    int receiveBufferBytes = 0;  // data socket SO_RCVBUF, 0 keeps the system default
+    int busyPollMicroseconds = 0; // data socket SO_BUSY_POLL, 0 leaves busy polling off
+    ReceiveBackend backend = RECEIVE_SOCKET; // falls back to the next simpler one that opens
+    int xdpQueue = 0;            // NIC queue the data group is steered to
+    bool xdpNativeMode = false;  // driver mode and zero copy rather than generic (SKB) mode
+    int commandWindowMilliseconds = 20;    // control writes within this are coalesced, see CommandQueue
+    int commandTimeoutMilliseconds = 3000; // unconfirmed commands complete as timed out after this
+    OverloadConfig overload;     // load shedding when the data thread falls behind
+    bool decodeWholeSpokes = true; // for processData; if false and no stage or spoke, sector or revolution
+                                   // subscriber needs them, only the bins of region subscriptions are decoded
+    quill::Logger *logger = nullptr; // for failures with details, RadarManager sets its own if unset
+};
+
+// Data socket options a channel actually got, the kernel may cap or refuse
+// what was asked for.
+struct SocketReport
+{
+    std::string name;
+    int requestedReceiveBuffer = 0;
+    int receiveBuffer = 0;       // SO_RCVBUF as read back, twice the usable size
+    bool receiveBufferForced = false; // set with SO_RCVBUFFORCE, past rmem_max
+    int requestedBusyPoll = 0;
+    int busyPoll = 0;
+    bool dropCounting = false;   // SO_RXQ_OVFL enabled
+    bool applied = true;         // everything requested was granted
+    ReceiveBackend backend = RECEIVE_SOCKET; // for the others receiveBuffer is the ring or UMEM size
+
+    std::string str() const;
+};
+
+// Running totals of the data thread, used for throughput reporting.
+struct RadarStatistics
+{
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+    uint64_t spokes = 0;
+    uint64_t kernelDrops = 0;    // datagrams the data socket overflowed, from SO_RXQ_OVFL
+    uint64_t droppedSpokes = 0;  // valid spokes lost to an empty scanline pool
+    OverloadLevel overloadLevel = OVERLOAD_NONE;
+    double receiveBacklog = 0.0; // last sample, 0 to 1
 };
 
 class Radar
 {
 public:
-    Radar(AddressSet const &addresses);
+    Radar(AddressSet const &addresses, RadarConfig const &config = RadarConfig());
     ~Radar();
     
-    void sendCommand(std::string const &key, std::string const &value);
+    // Queues a control write, see CommandQueue. The future completes once a
+    // report confirms it, or it times out or is superseded.
+    std::future<CommandResult> sendCommand(std::string const &key, std::string const &value);
     bool checkHeartbeat();
 
+    AddressSet addresses() const;
+    RadarStatistics statistics() const;
+
+    // Moves a running radar to new addresses, e.g. when discovery finds that
+    // cached ones are stale. The data and report threads rejoin on their next
+    // receive timeout. The label is kept.
+    void updateAddresses(AddressSet const &addresses);
+
+    // Appends a stage to the data path, see ProcessingStage.
+    void addStage(std::shared_ptr<ProcessingStage> stage);
+    void removeStage(std::shared_ptr<ProcessingStage> const &stage);
+
+    // Consumers on their own threads, fed after the stages and processData,
+    // see SubscriptionHub.
+    std::shared_ptr<Subscription> subscribeSpokes(SubscriptionConfig const &config, SubscriptionHub::SpokeCallback callback);
+    std::shared_ptr<Subscription> subscribeSectors(SubscriptionConfig const &config, SubscriptionHub::SectorCallback callback);
+    std::shared_ptr<Subscription> subscribeRevolutions(SubscriptionConfig const &config, SubscriptionHub::RevolutionCallback callback);
+    // Only the bins of an azimuth sector and range band, see
+    // RadarConfig::decodeWholeSpokes.
+    std::shared_ptr<Subscription> subscribeRegion(RegionOfInterest const &region, SubscriptionConfig const &config, SubscriptionHub::RegionCallback callback);
+    void unsubscribe(std::shared_ptr<Subscription> const &subscription);
+
+    // Placement and scheduling the data and report threads actually got,
+    // with the page faults the data thread took since warming up.
+    std::vector<ThreadReport> threadReports() const;
+    // Options the current data socket got, see RadarConfig.
+    SocketReport socketReport() const;
+    CommandStatistics commandStatistics() const;
+
+    // Fidelity the data thread currently gives up to keep up, see
+    // OverloadController.
+    OverloadLevel overloadLevel() const { return m_overloadLevel.load(std::memory_order_relaxed); }
+
+    // Last doppler_state from the radar: 0 off, 1 normal, 2 approaching only.
+    uint8_t dopplerState() const { return m_dopplerState.load(std::memory_order_relaxed); }
+
 protected:
+    // Not called while only region subscriptions are decoded, see
+    // RadarConfig::decodeWholeSpokes.
     virtual void processData(std::vector<Scanline> const &scanlines)=0;
     virtual void stateUpdated()=0;
     void startThreads();
 
-    std::map <std::string, std::string> m_state;
+    std::map <std::string, std::string, std::less<>> m_state;  // transparent, looked up by table keys
 private:
     void dataThread();
+    void receiveSocket();
+    // Receives through a PacketRing or XdpSocket. Returns false if it could
+    // not be opened at all.
+    template<typename Receiver> bool receiveFrames(Receiver &receiver, ReceiveBackend backend);
+    // Decodes one data datagram and hands it through the stages to processData.
+    void processSector(const uint8_t *data, int size);
+    // Decodes only the bins region subscribers want, when nothing needs
+    // whole spokes. Returns the number of spokes decoded.
+    uint64_t decodeRegions(const RawSector *sector, int scanlineCount, uint8_t dopplerState, OverloadLevel overload);
     void reportThread();
+    void setupThread(std::string const &name, std::vector<int> const &cpus, int priority, ThreadReport &report);
     int createListenerSocket(uint32_t interface, uint32_t mcast_address, uint16_t port);
+    // Applies the receive buffer, busy poll and drop counting options.
+    void tuneDataSocket(int sock);
+    // Share of the data socket's receive buffer holding unread datagrams.
+    double socketBacklog(int sock) const;
+    // Feeds a backlog sample to the overload controller, every
+    // overload_sample_packets packets and when idle.
+    void updateOverload(double backlog);
+    // (Re)opens the data or report listener when the addresses changed
+    // since generation, closing the previous socket.
+    int reopenListenerSocket(int sock, bool data, uint32_t &generation);
+    void openSendSocket();
     void sendCommand(const uint8_t data[], int size);
+    // CommandQueue::BatchSender, one sendmmsg to the current send address.
+    int sendCommandBatch(mmsghdr *messages, unsigned count);
     template<typename T> void sendCommand(const T &data)
     {
         sendCommand(reinterpret_cast<const uint8_t*>(&data),sizeof(T));
@@ -71,16 +225,58 @@ private:
     void sendHeartbeat();
     
     AddressSet m_addresses;
+    mutable std::mutex m_addressMutex;
+    std::atomic<uint32_t> m_addressGeneration{0};
+    RadarConfig m_config;
     std::thread m_dataThread;
     
     int m_sendSocket;
     sockaddr_in m_sendAddress;
+    std::unique_ptr<CommandQueue> m_commandQueue;
     
     std::thread m_reportThread;
     bool m_exitFlag;
     std::mutex m_exitFlagMutex;
     
     std::chrono::system_clock::time_point m_lastHeartbeat;
+
+    // Exported through MetricsRegistry::global(), labelled by channel.
+    std::shared_ptr<Counter> m_packetCount;
+    std::shared_ptr<Counter> m_byteCount;
+    std::shared_ptr<Counter> m_spokeCount;
+    std::shared_ptr<Counter> m_droppedScanlines;  // valid spokes lost to an empty scanline pool
+    std::shared_ptr<Counter> m_kernelDrops;
+    std::shared_ptr<Gauge> m_receiveBuffer;
+    std::shared_ptr<Histogram> m_decodeSeconds;
+    std::shared_ptr<Histogram> m_processDataSeconds;
+    std::shared_ptr<Gauge> m_receiveBacklog;
+    std::shared_ptr<Gauge> m_overloadGauge;
+    std::shared_ptr<Counter> m_overloadTransitions;
+    std::atomic<uint8_t> m_dopplerState{0};   // from c408, selects the decode path
+    std::atomic<OverloadLevel> m_overloadLevel{OVERLOAD_NONE};
+
+    // data thread only: fault counts are reported relative to the end of
+    // warm-up, once the sockets, buffers and consumer have all been exercised
+    uint64_t m_dataPackets = 0;
+    static constexpr uint64_t overload_sample_packets = 16;
+    OverloadController m_overload;
+    long m_warmupMinorFaults = 0;
+    long m_warmupMajorFaults = 0;
+
+    // Scanlines are recycled between sectors so the data path does not
+    // allocate once running; m_scanlines holds the ones handed to processData.
+    std::vector<Scanline> m_scanlines;
+    std::vector<Scanline> m_spareScanlines;
+
+    std::vector<std::shared_ptr<ProcessingStage> > m_stages;
+    std::vector<std::shared_ptr<Histogram> > m_stageSeconds; // parallel to m_stages
+    std::mutex m_stagesMutex;
+    std::unique_ptr<SubscriptionHub> m_subscriptions;
+
+    ThreadReport m_dataThreadReport;
+    ThreadReport m_reportThreadReport;
+    SocketReport m_socketReport;
+    mutable std::mutex m_threadReportMutex;
 };
 
 class HeadingSender
@@ -104,6 +300,9 @@ private:
 
     uint16_t m_counter = 0;
 
+    std::shared_ptr<Counter> m_packetsSent;
+    std::shared_ptr<Counter> m_sendErrors;
+
     std::chrono::system_clock::time_point m_lastHeadingSent;
     std::chrono::milliseconds m_headingSendInterval = std::chrono::milliseconds(100);
     std::chrono::system_clock::time_point m_lastMysterySent;
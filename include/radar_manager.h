@@ -0,0 +1,103 @@
+#ifndef HALO_RADAR_RADAR_MANAGER_H
+#define HALO_RADAR_RADAR_MANAGER_H
+
+#include <functional>
+#include <memory>
+
+#include "radar.h"
+#include "discovery_cache.h"
+
+namespace halo_radar
+{
+
+struct ChannelThroughput
+{
+    std::string label;
+    double packetsPerSecond = 0.0;
+    double spokesPerSecond = 0.0;
+    double megabytesPerSecond = 0.0;
+    uint64_t kernelDrops = 0;    // over the interval, see RadarStatistics
+    uint64_t droppedSpokes = 0;
+    OverloadLevel overloadLevel = OVERLOAD_NONE;    // at the end of the interval
+    double receiveBacklog = 0.0;
+};
+
+// Owns every radar channel (HaloA, HaloB, ...) of a process, starts each one
+// with its own thread placement and routes commands to one or all of them.
+class RadarManager
+{
+public:
+    using RadarFactory = std::function<std::shared_ptr<Radar>(AddressSet const &, RadarConfig const &)>;
+
+    RadarManager(quill::Logger *logger, RadarFactory factory);
+    ~RadarManager();
+
+    // Thread placement for a channel label. Channels without one are kept on
+    // the NUMA node of their interface when numaAware is set, each channel
+    // on its own half of the node's cores: the first for the data thread,
+    // the rest for the report thread. Nodes too small for that, or a third
+    // channel on a node, share cores and say so in the log.
+    void setChannelConfig(std::string const &label, RadarConfig const &config);
+    // Starting point for channels without their own config.
+    void setDefaultConfig(RadarConfig const &config);
+    void setNumaAware(bool numaAware) { m_numaAware = numaAware; }
+
+    // Creates and starts the radar for an address set, unless a channel with
+    // the same label is already running.
+    std::shared_ptr<Radar> add(AddressSet const &addresses);
+
+    // Starts the cached channels on the given interfaces (all local ones when
+    // empty) straight away, then scans in the background until a radar
+    // answers. Channels whose addresses changed are moved over with
+    // Radar::updateAddresses and the cache is rewritten. onStarted is called
+    // for every channel that gets created.
+    void discover(std::vector<uint32_t> const &interfaces, std::chrono::milliseconds timeout,
+                  std::shared_ptr<DiscoveryCache> cache = nullptr,
+                  std::function<void(AddressSet const &)> onStarted = nullptr);
+    void stopDiscovery();
+
+    std::vector<std::shared_ptr<Radar>> radars() const;
+    std::shared_ptr<Radar> radar(std::string const &label) const;
+    bool empty() const;
+    void clear();
+
+    // Sends to the channel with the given label, or to every channel for "all".
+    // Returns false if no channel matched.
+    bool sendCommand(std::string const &label, std::string const &key, std::string const &value);
+
+    // Rates per channel since the previous call.
+    std::vector<ChannelThroughput> throughput();
+    void logThroughput();
+
+    // Logs what each channel's threads and data socket actually got, see
+    // Radar::threadReports and Radar::socketReport.
+    void logThreadReports();
+
+private:
+    RadarConfig channelConfig(AddressSet const &addresses);
+    void discoveryThread(std::vector<uint32_t> interfaces, std::chrono::milliseconds timeout,
+                         std::shared_ptr<DiscoveryCache> cache, std::function<void(AddressSet const &)> onStarted);
+
+    struct Sample
+    {
+        RadarStatistics statistics;
+        std::chrono::steady_clock::time_point time;
+    };
+
+    quill::Logger *m_logger;
+    RadarFactory m_factory;
+    bool m_numaAware = true;
+    RadarConfig m_defaultConfig;
+    std::map<std::string, RadarConfig> m_channelConfigs;
+    std::map<int, std::vector<std::string>> m_numaChannels; // labels placed on each node, in order
+    std::vector<std::shared_ptr<Radar>> m_radars;
+    std::map<std::string, Sample> m_lastSamples;
+    mutable std::mutex m_mutex;
+
+    std::thread m_discoveryThread;
+    std::atomic<bool> m_stopDiscovery{false};
+};
+
+} // namespace halo_radar
+
+#endif
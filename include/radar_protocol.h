@@ -0,0 +1,275 @@
+#ifndef HALO_RADAR_RADAR_PROTOCOL_H
+#define HALO_RADAR_RADAR_PROTOCOL_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string>
+
+#include "radar_structures.h"
+
+namespace halo_radar
+{
+
+// Descriptor tables for the controls the Halo reports and accepts.
+//
+// Each control is listed once per direction with its wire field, scaling
+// and enum names, and both the report decoder and the command encoder are
+// driven from these tables: reports are looked up by id, commands by a
+// compile time hash of the key, neither allocates. Adding a control means
+// adding a row here.
+
+constexpr uint32_t fnv1a(const char *s, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < length; i++)
+        hash = (hash ^ uint8_t(s[i]))*16777619u;
+    return hash;
+}
+
+constexpr size_t constLength(const char *s)
+{
+    size_t length = 0;
+    while(s[length])
+        length++;
+    return length;
+}
+
+struct EnumName
+{
+    uint8_t wire;
+    const char *name;
+};
+
+struct EnumNames
+{
+    const EnumName *names;
+    size_t count;
+    const char *unknown;    // reported for values not in the list
+};
+
+inline constexpr EnumName off_low_medium_high_names[] = {{0, "off"}, {1, "low"}, {2, "medium"}, {3, "high"}};
+inline constexpr EnumName status_names[] = {{1, "standby"}, {2, "transmit"}, {5, "spinning_up"}};
+inline constexpr EnumName mode_names[] = {{0, "custom"}, {1, "harbor"}, {2, "offshore"}, {4, "weather"}, {5, "bird"}};
+inline constexpr EnumName sea_state_names[] = {{0, "calm"}, {1, "moderate"}, {2, "rough"}};
+inline constexpr EnumName scan_speed_names[] = {{0, "off"}, {1, "medium"}, {3, "high"}};
+inline constexpr EnumName doppler_mode_names[] = {{0, "off"}, {1, "normal"}, {2, "approaching_only"}};
+
+inline constexpr EnumNames off_low_medium_high = {off_low_medium_high_names, std::size(off_low_medium_high_names), "unknown"};
+inline constexpr EnumNames status_enum = {status_names, std::size(status_names), "unknown"};
+inline constexpr EnumNames mode_enum = {mode_names, std::size(mode_names), "unknown"};
+inline constexpr EnumNames sea_state_enum = {sea_state_names, std::size(sea_state_names), "unknown"};
+inline constexpr EnumNames scan_speed_enum = {scan_speed_names, std::size(scan_speed_names), "default"};
+inline constexpr EnumNames doppler_mode_enum = {doppler_mode_names, std::size(doppler_mode_names), "unknown"};
+
+enum ValueKind
+{
+    VALUE_ENUM,         // name from names
+    VALUE_INTEGER,      // raw/divisor, integer division
+    VALUE_REAL,         // raw*multiplier/divisor
+    VALUE_AUTO_FLAG     // "auto" if nonzero, else "manual"
+};
+
+// One control in a report.
+struct ReportField
+{
+    const char *key;
+    uint8_t offset;
+    uint8_t width;      // 1, 2 or 4 bytes, little endian
+    bool isSigned;
+    ValueKind kind;
+    int32_t multiplier;
+    int32_t divisor;
+    const EnumNames *names;
+};
+
+struct ReportDescriptor
+{
+    uint16_t id;
+    uint8_t size;       // shorter reports are ignored
+    const ReportField *fields;
+    size_t fieldCount;
+};
+
+#define HALO_REPORT_FIELD(report, member) uint8_t(offsetof(report, member)), uint8_t(sizeof(report::member))
+
+inline constexpr ReportField c401_fields[] = {
+    {"status", 2, 1, false, VALUE_ENUM, 1, 1, &status_enum},
+};
+
+inline constexpr ReportField c402_fields[] = {
+    {"range", HALO_REPORT_FIELD(RadarReport_c402, range), false, VALUE_INTEGER, 1, 10, nullptr},
+    {"mode", HALO_REPORT_FIELD(RadarReport_c402, mode), false, VALUE_ENUM, 1, 1, &mode_enum},
+    {"gain", HALO_REPORT_FIELD(RadarReport_c402, gain), false, VALUE_REAL, 100, 255, nullptr},
+    {"gain_mode", HALO_REPORT_FIELD(RadarReport_c402, gain_auto), false, VALUE_AUTO_FLAG, 1, 1, nullptr},
+    {"sea_clutter", HALO_REPORT_FIELD(RadarReport_c402, sea_clutter), false, VALUE_REAL, 100, 255, nullptr},
+    {"sea_clutter_mode", HALO_REPORT_FIELD(RadarReport_c402, sea_clutter_auto), false, VALUE_AUTO_FLAG, 1, 1, nullptr},
+    {"rain_clutter", HALO_REPORT_FIELD(RadarReport_c402, rain_clutter), false, VALUE_REAL, 100, 255, nullptr},
+    {"interference_rejection", HALO_REPORT_FIELD(RadarReport_c402, interference_rejection), false, VALUE_ENUM, 1, 1, &off_low_medium_high},
+    {"target_expansion", HALO_REPORT_FIELD(RadarReport_c402, target_expansion), false, VALUE_ENUM, 1, 1, &off_low_medium_high},
+};
+
+inline constexpr ReportField c404_fields[] = {
+    {"bearing_alignment", HALO_REPORT_FIELD(RadarReport_c404, bearing_alignment), false, VALUE_REAL, 1, 10, nullptr},
+    {"antenna_height", HALO_REPORT_FIELD(RadarReport_c404, antenna_height), false, VALUE_REAL, 1, 1000, nullptr},
+    {"lights", HALO_REPORT_FIELD(RadarReport_c404, lights), false, VALUE_ENUM, 1, 1, &off_low_medium_high},
+};
+
+inline constexpr ReportField c408_fields[] = {
+    {"sea_state", HALO_REPORT_FIELD(RadarReport_c408, sea_state), false, VALUE_ENUM, 1, 1, &sea_state_enum},
+    {"scan_speed", HALO_REPORT_FIELD(RadarReport_c408, scan_speed), false, VALUE_ENUM, 1, 1, &scan_speed_enum},
+    {"sidelobe_suppression_mode", HALO_REPORT_FIELD(RadarReport_c408, sls_auto), false, VALUE_AUTO_FLAG, 1, 1, nullptr},
+    {"sidelobe_suppression", HALO_REPORT_FIELD(RadarReport_c408, side_lobe_suppression), false, VALUE_REAL, 100, 255, nullptr},
+    {"noise_rejection", HALO_REPORT_FIELD(RadarReport_c408, noise_rejection), false, VALUE_ENUM, 1, 1, &off_low_medium_high},
+    {"target_separation", HALO_REPORT_FIELD(RadarReport_c408, target_separation), false, VALUE_ENUM, 1, 1, &off_low_medium_high},
+    {"auto_sea_clutter_nudge", HALO_REPORT_FIELD(RadarReport_c408, auto_sea_clutter_nudge), true, VALUE_INTEGER, 1, 1, nullptr},
+    {"doppler_mode", HALO_REPORT_FIELD(RadarReport_c408, doppler_state), false, VALUE_ENUM, 1, 1, &doppler_mode_enum},
+    {"doppler_speed", HALO_REPORT_FIELD(RadarReport_c408, doppler_speed), false, VALUE_REAL, 1, 100, nullptr},
+};
+
+#undef HALO_REPORT_FIELD
+
+// Reports without fields are known but carry nothing we use.
+inline constexpr ReportDescriptor reports[] = {
+    {0xc401, 3, c401_fields, std::size(c401_fields)},
+    {0xc402, sizeof(RadarReport_c402), c402_fields, std::size(c402_fields)},
+    {0xc403, 2, nullptr, 0},
+    {0xc404, sizeof(RadarReport_c404), c404_fields, std::size(c404_fields)},
+    {0xc406, 2, nullptr, 0},
+    {0xc408, sizeof(RadarReport_c408), c408_fields, std::size(c408_fields)},
+    {0xc409, 2, nullptr, 0},
+    {0xc40a, 2, nullptr, 0},
+    {0xc611, 2, nullptr, 0},    // heartbeat
+};
+
+enum CommandKind
+{
+    COMMAND_STATUS,     // two packets, power then transmit
+    COMMAND_ENUM,       // u16 id, u8 value from names, 0 for unknown names
+    COMMAND_VALUE16,    // u16 id, u16 value*scale
+    COMMAND_VALUE32,    // u16 id, u32 value*scale
+    COMMAND_LEVEL,      // u16 id, u32 sub, u32 auto, u8 value*255/100
+    COMMAND_ONE_VALUE32,// u16 id, u32 1, u32 value*scale
+    COMMAND_NUDGE       // u16 id, u8 sub, i8 value, i8 value, u8 4
+};
+
+struct CommandDescriptor
+{
+    const char *key;
+    CommandKind kind;
+    uint16_t id;
+    uint8_t sub;
+    bool allowAuto;     // COMMAND_LEVEL takes "auto" as well as a value
+    int32_t scale;
+    const EnumNames *names;
+    // How a report confirms the command: key carries the value, modeKey
+    // (if any) "auto" or "manual", numbers match to within step.
+    const char *modeKey;
+    float step;
+};
+
+inline constexpr CommandDescriptor commands[] = {
+    {"status", COMMAND_STATUS, 0xc100, 0, false, 1, nullptr, nullptr, 0.0f},
+    {"range", COMMAND_VALUE32, 0xc103, 0, false, 10, nullptr, nullptr, 1.0f},
+    {"bearing_alignment", COMMAND_VALUE16, 0xc105, 0, false, 10, nullptr, nullptr, 0.1f},
+    {"gain", COMMAND_LEVEL, 0xc106, 0x00, true, 1, nullptr, "gain_mode", 100.0f/255},
+    {"sea_clutter", COMMAND_LEVEL, 0xc106, 0x02, true, 1, nullptr, "sea_clutter_mode", 100.0f/255},
+    {"rain_clutter", COMMAND_LEVEL, 0xc106, 0x04, false, 1, nullptr, nullptr, 100.0f/255},
+    {"sidelobe_suppression", COMMAND_LEVEL, 0xc106, 0x05, true, 1, nullptr, "sidelobe_suppression_mode", 100.0f/255},
+    {"interference_rejection", COMMAND_ENUM, 0xc108, 0, false, 1, &off_low_medium_high, nullptr, 0.0f},
+    {"sea_state", COMMAND_ENUM, 0xc10b, 0, false, 1, &sea_state_enum, nullptr, 0.0f},
+    {"scan_speed", COMMAND_ENUM, 0xc10f, 0, false, 1, &scan_speed_enum, nullptr, 0.0f},
+    {"mode", COMMAND_ENUM, 0xc110, 0, false, 1, &mode_enum, nullptr, 0.0f},
+    {"auto_sea_clutter_nudge", COMMAND_NUDGE, 0xc111, 0x01, false, 1, nullptr, nullptr, 1.0f},
+    {"target_expansion", COMMAND_ENUM, 0xc112, 0, false, 1, &off_low_medium_high, nullptr, 0.0f},
+    {"noise_rejection", COMMAND_ENUM, 0xc121, 0, false, 1, &off_low_medium_high, nullptr, 0.0f},
+    {"target_separation", COMMAND_ENUM, 0xc122, 0, false, 1, &off_low_medium_high, nullptr, 0.0f},
+    {"doppler_mode", COMMAND_ENUM, 0xc123, 0, false, 1, &doppler_mode_enum, nullptr, 0.0f},
+    {"doppler_speed", COMMAND_VALUE16, 0xc124, 0, false, 100, nullptr, nullptr, 0.01f},
+    {"antenna_height", COMMAND_ONE_VALUE32, 0xc130, 0, false, 1000, nullptr, nullptr, 0.001f},
+    {"lights", COMMAND_ENUM, 0xc131, 0, false, 1, &off_low_medium_high, nullptr, 0.0f},
+};
+
+// Open addressed index from fnv1a(key) to commands, built at compile time.
+inline constexpr size_t command_slots = 64;
+static_assert(std::size(commands) < command_slots/2, "command_slots too small for the command table");
+
+constexpr std::array<uint8_t, command_slots> commandIndex()
+{
+    std::array<uint8_t, command_slots> index{};
+    for(size_t i = 0; i < command_slots; i++)
+        index[i] = 0xff;
+    for(size_t i = 0; i < std::size(commands); i++)
+    {
+        size_t slot = fnv1a(commands[i].key, constLength(commands[i].key)) % command_slots;
+        while(index[slot] != 0xff)
+            slot = (slot + 1) % command_slots;
+        index[slot] = uint8_t(i);
+    }
+    return index;
+}
+
+inline constexpr std::array<uint8_t, command_slots> command_index = commandIndex();
+
+// Report lookup by id; c4xx reports through a table on the low nibble.
+constexpr std::array<uint8_t, 16> reportIndex()
+{
+    std::array<uint8_t, 16> index{};
+    for(size_t i = 0; i < index.size(); i++)
+        index[i] = 0xff;
+    for(size_t i = 0; i < std::size(reports); i++)
+        if((reports[i].id & 0xfff0) == 0xc400)
+            index[reports[i].id & 0x0f] = uint8_t(i);
+    return index;
+}
+
+inline constexpr std::array<uint8_t, 16> report_index = reportIndex();
+
+// A decoded control, key from the field table, value formatted as
+// std::to_string would.
+struct ReportValue
+{
+    const char *key;
+    char value[32];
+};
+
+// Up to two datagrams, sent in order.
+struct CommandPackets
+{
+    uint8_t data[2][16];
+    int size[2];
+    int count = 0;
+};
+
+const ReportDescriptor *findReport(uint16_t id);
+const CommandDescriptor *findCommand(std::string const &key);
+
+// Decodes a report into values, which must hold as many as the largest
+// field table. Returns the number of values, 0 for known reports without
+// fields or too short to decode, -1 for unknown reports.
+int decodeReport(const uint8_t *data, int size, ReportValue *values);
+
+constexpr size_t maxReportValues()
+{
+    size_t count = 0;
+    for(auto const &r: reports)
+        if(r.fieldCount > count)
+            count = r.fieldCount;
+    return count;
+}
+
+inline constexpr size_t max_report_values = maxReportValues();
+
+// True if the report values confirm that a command with value took
+// effect. Enums and modes match by name, numbers to within a wire step.
+bool reportConfirms(CommandDescriptor const &command, std::string const &value, const ReportValue *values, int count);
+
+// Encodes a command. Returns false, sending nothing, for an unknown key and
+// for a status other than transmit or standby. Numeric values are parsed
+// with std::stof and its exceptions passed on.
+bool encodeCommand(std::string const &key, std::string const &value, CommandPackets &packets);
+
+} // namespace halo_radar
+
+#endif
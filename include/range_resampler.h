@@ -0,0 +1,85 @@
+#ifndef HALO_RADAR_RANGE_RESAMPLER_H
+#define HALO_RADAR_RANGE_RESAMPLER_H
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+#include "processing_stage.h"
+
+namespace halo_radar
+{
+
+struct ResampleConfig
+{
+    float metersPerBin = 0.0;       // fixed grid if > 0, else bins over the spoke's own range
+    uint16_t bins = 1024;           // output bins
+    float rangeCorrection = 1.0;    // true range over the range the radar reports
+};
+
+// Maps spokes onto a common range grid, either a fixed number of meters per
+// bin for all range settings or a chosen number of bins over the spoke's
+// range.
+//
+// Where output bins are narrower than input bins the output is linearly
+// interpolated. Where they are wider it is the maximum of the input bins
+// they cover, so small targets are not averaged away. Bins past the end of
+// the spoke are 0. The doppler plane, if any, takes the nearest input bin.
+// The scanline range becomes the corrected extent of the output grid.
+//
+// The per bin taps only depend on the spoke range, the correction and the
+// input bin count, and are cached per combination, so a range change costs
+// one table build the first time and a lookup after that. prewarm builds
+// tables ahead for ranges known in advance.
+class RangeResampler: public ProcessingStage
+{
+public:
+    RangeResampler(ResampleConfig const &config = ResampleConfig());
+
+    std::string name() const override { return "range_resampler"; }
+    void process(std::vector<Scanline> &scanlines) override;
+
+    void setRangeCorrection(float correction) { m_rangeCorrection = correction; }
+
+    // Builds the tables for spokes of inputBins bins at each range (meters,
+    // as reported in Scanline::range).
+    void prewarm(std::vector<float> const &ranges, uint16_t inputBins = 1024);
+
+    size_t cachedTables() const;
+
+private:
+    struct Tap
+    {
+        uint16_t index;     // first input bin, 0xffff past the spoke
+        uint8_t span;       // input bins to take the maximum of, 1 to interpolate
+        uint8_t weight;     // of index+1 when interpolating, /256
+    };
+    struct Table
+    {
+        std::vector<Tap> taps;
+        float range;        // corrected output extent
+    };
+    using Key = std::tuple<float, float, uint16_t>; // range, correction, input bins
+
+    Table const *table(float range, float correction, uint16_t inputBins);
+    std::shared_ptr<const Table> build(float range, float correction, uint16_t inputBins) const;
+
+    ResampleConfig m_config;
+    std::atomic<float> m_rangeCorrection;
+
+    mutable std::mutex m_cacheMutex;
+    std::map<Key, std::shared_ptr<const Table>> m_cache;
+    Key m_lastKey{-1.0f, 0.0f, 0};
+    std::shared_ptr<const Table> m_last;    // data thread only
+
+    std::vector<uint8_t> m_intensities;
+    std::vector<uint8_t> m_doppler;
+};
+
+} // namespace halo_radar
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef HALO_RADAR_REVOLUTION_H
+#define HALO_RADAR_REVOLUTION_H
+
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <vector>
+
+namespace halo_radar
+{
+
+struct Scanline;
+
+// A full antenna turn in the polar domain. Row r holds the spoke at azimuth
+// r*360/spokes degrees, each row has bins 4-bit intensities.
+struct Revolution
+{
+    uint64_t number = 0;
+    std::chrono::system_clock::time_point stamp; // arrival of the first spoke
+    float range = 0.0;                           // meters, of the last spoke
+    uint16_t spokes = 0;
+    uint16_t bins = 0;
+    std::vector<uint8_t> intensities;            // spokes*bins
+    std::vector<uint8_t> present;                // 1 for rows a spoke was received for
+
+    void resize(uint16_t spokes, uint16_t bins);
+    void clear();
+
+    uint8_t *spoke(size_t row) { return intensities.data() + row*bins; }
+    const uint8_t *spoke(size_t row) const { return intensities.data() + row*bins; }
+};
+
+// Collects spokes into revolutions. The Halo sends 2048 spokes per turn on
+// a 4096 count azimuth scale, hence the default row count.
+class RevolutionAssembler
+{
+public:
+    RevolutionAssembler(uint16_t spokes = 2048, uint16_t bins = 1024);
+
+    // Adds a spoke. Returns true when the spoke started a new revolution,
+    // the finished one is then available from completed() until the next
+    // time add returns true.
+    bool add(Scanline const &scanline);
+
+    Revolution const &completed() const { return m_completed; }
+    Revolution const &current() const { return m_current; }
+
+    uint16_t spokes() const { return m_current.spokes; }
+    uint16_t bins() const { return m_current.bins; }
+
+    // Row of a spoke angle in degrees.
+    static size_t row(float angle, uint16_t spokes);
+
+private:
+    Revolution m_current;
+    Revolution m_completed;
+    size_t m_lastRow = 0;
+    bool m_empty = true;
+    uint64_t m_number = 0;
+};
+
+} // namespace halo_radar
+
+#endif
@@ -0,0 +1,172 @@
+#ifndef HALO_RADAR_REVOLUTION_ARCHIVE_H
+#define HALO_RADAR_REVOLUTION_ARCHIVE_H
+
+#include <cstdint>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "processing_stage.h"
+#include "revolution.h"
+#include "revolution_delta.h"
+
+namespace halo_radar
+{
+
+// Archive of assembled revolutions, one independently decodable chunk each.
+//
+//   ArchiveFileHeader
+//   chunk: ArchiveChunkHeader, then a revolution delta stream keyframe
+//          message (see revolution_delta.h) of `size` bytes
+//   ...
+//   index block: ArchiveIndexHeader, ArchiveIndexEntry per chunk since the
+//                previous block, ArchiveTrailer
+//   chunks, index block, ...
+//
+// Every indexInterval chunks and on close an index block for the chunks
+// since the previous one is appended and stays where it is, so index
+// writes grow with the file rather than with its square. The trailers
+// link the blocks back to front, so a finished file opens by following
+// them from the footer and any revolution is then one more read. A file
+// still being written may end in a chunk, which the trailer check
+// catches; readers then index the chunk headers, carrying on from where
+// they got to before.
+#pragma pack(push, 1)
+
+struct ArchiveFileHeader
+{
+    uint32_t magic;     // "HRAR"
+    uint32_t version;
+    uint64_t reserved;
+};
+
+struct ArchiveChunkHeader
+{
+    uint32_t magic;     // "HRCK"
+    uint32_t size;      // payload bytes
+    uint64_t number;
+    int64_t stamp;      // ns since epoch
+};
+
+struct ArchiveIndexHeader
+{
+    uint32_t magic;     // "HRIB"
+    uint32_t reserved;
+    uint64_t entries;
+};
+
+struct ArchiveIndexEntry
+{
+    uint64_t offset;    // of the ArchiveChunkHeader
+    uint32_t size;      // payload bytes
+    uint64_t number;
+    int64_t stamp;
+};
+
+struct ArchiveTrailer
+{
+    uint32_t magic;     // "HRIX"
+    uint32_t version;
+    uint64_t indexOffset;   // of this block's ArchiveIndexHeader
+    uint64_t entries;       // in this block
+    uint64_t previous;      // offset of the previous block's header, 0 for none
+    uint64_t check;         // indexOffset ^ entries ^ previous ^ magic, guards against stray bytes
+};
+
+#pragma pack(pop)
+
+class ArchiveWriter
+{
+public:
+    ArchiveWriter();
+    ~ArchiveWriter();
+
+    // Creates (or truncates) path. Returns false on failure, with errno set.
+    bool open(std::string const &path, unsigned indexInterval = 1);
+    bool isOpen() const { return m_fd >= 0; }
+
+    bool write(Revolution const &revolution);
+
+    // Writes the final index and closes the file.
+    void close();
+
+    size_t revolutions() const { return m_index.size(); }
+
+private:
+    bool writeIndex();
+
+    int m_fd = -1;
+    unsigned m_indexInterval = 1;
+    unsigned m_sinceIndex = 0;
+    uint64_t m_end = 0;             // end of the last chunk or index block
+    uint64_t m_lastBlock = 0;       // offset of the last index block, 0 for none
+    std::vector<ArchiveIndexEntry> m_index;
+    RevolutionDeltaEncoder m_encoder;
+    std::vector<uint8_t> m_buffer;
+};
+
+// Reads an archive through a read-only mapping, which may be used from
+// several threads at once.
+class ArchiveReader
+{
+public:
+    ArchiveReader();
+    ~ArchiveReader();
+
+    bool open(std::string const &path);
+    void close();
+
+    // Picks up revolutions written since open, for files still growing.
+    bool refresh();
+
+    size_t size() const { return m_index.size(); }
+    ArchiveIndexEntry const &entry(size_t i) const { return m_index[i]; }
+
+    // Index of the revolution with number, or size() if there is none.
+    size_t find(uint64_t number) const;
+
+    // Index of the first revolution at or after stamp.
+    size_t lowerBound(std::chrono::system_clock::time_point stamp) const;
+
+    // Decodes revolution i. Returns false for a corrupt chunk.
+    bool read(size_t i, Revolution &revolution) const;
+
+    // Decodes the revolutions stamped in [from, to) on up to threads
+    // threads. callback is called concurrently, with the index of each
+    // revolution. Returns the number decoded.
+    using Callback = std::function<void(size_t index, Revolution const &revolution)>;
+    size_t readRange(std::chrono::system_clock::time_point from, std::chrono::system_clock::time_point to,
+                     Callback const &callback, unsigned threads = 4) const;
+
+private:
+    bool map();
+    bool loadFooter();
+    void scanChunks();
+
+    int m_fd = -1;
+    const uint8_t *m_data = nullptr;
+    size_t m_size = 0;
+    uint64_t m_indexed = 0;         // everything before is in m_index
+    std::vector<ArchiveIndexEntry> m_index;
+};
+
+// Data path stage assembling revolutions and appending them to an archive.
+class ArchiveStage: public ProcessingStage
+{
+public:
+    ArchiveStage(std::string const &path, unsigned indexInterval = 1, uint16_t spokes = 2048, uint16_t bins = 1024);
+
+    std::string name() const override { return "archive"; }
+    void process(std::vector<Scanline> &scanlines) override;
+
+    bool isOpen() const { return m_writer.isOpen(); }
+
+private:
+    ArchiveWriter m_writer;
+    RevolutionAssembler m_assembler;
+};
+
+} // namespace halo_radar
+
+#endif
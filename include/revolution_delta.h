@@ -0,0 +1,115 @@
+#ifndef HALO_RADAR_REVOLUTION_DELTA_H
+#define HALO_RADAR_REVOLUTION_DELTA_H
+
+#include <atomic>
+#include <functional>
+
+#include "processing_stage.h"
+#include "revolution.h"
+
+namespace halo_radar
+{
+
+// Revolution delta stream, one message per revolution.
+//
+// Every message starts with a RevolutionDeltaHeader. A keyframe then holds,
+// for each row, a presence byte followed by the row in spoke codec form
+// (see spoke_codec.h) if present. A delta holds `records` changed runs
+// against the previous revolution, each a RevolutionDeltaRecord followed by
+// count nibble packed values. Rows missing from a revolution are left as
+// they were.
+#pragma pack(push, 1)
+
+struct RevolutionDeltaHeader
+{
+    uint16_t magic;     // 0x4452 "RD"
+    uint8_t type;       // RevolutionDeltaType
+    uint8_t reserved;
+    uint64_t number;
+    int64_t stamp;      // ns since epoch
+    float range;
+    uint16_t spokes;
+    uint16_t bins;
+    uint32_t records;   // changed runs in a delta, 0 for keyframes
+};
+
+struct RevolutionDeltaRecord
+{
+    uint16_t row;
+    uint16_t start;
+    uint16_t count;
+};
+
+#pragma pack(pop)
+
+enum RevolutionDeltaType : uint8_t
+{
+    REVOLUTION_KEYFRAME = 1,
+    REVOLUTION_DELTA = 2
+};
+
+class RevolutionDeltaEncoder
+{
+public:
+    // A keyframe is sent every keyframeInterval revolutions. Unchanged gaps
+    // shorter than mergeGap bins are folded into the surrounding run, which
+    // is cheaper than a new record.
+    RevolutionDeltaEncoder(unsigned keyframeInterval = 30, uint16_t mergeGap = 12);
+
+    // Appends the message for revolution to out. Returns true for a keyframe.
+    bool encode(Revolution const &revolution, std::vector<uint8_t> &out);
+
+    // Makes the next message a keyframe, e.g. when a client joins.
+    void requestKeyframe() { m_keyframeRequested = true; }
+
+private:
+    void encodeKeyframe(Revolution const &revolution, std::vector<uint8_t> &out);
+    uint32_t encodeDelta(Revolution const &revolution, std::vector<uint8_t> &out);
+
+    unsigned m_keyframeInterval;
+    uint16_t m_mergeGap;
+    unsigned m_sinceKeyframe = 0;
+    bool m_keyframeRequested = true;
+    Revolution m_reference; // what a decoder holds after the last message
+};
+
+class RevolutionDeltaDecoder
+{
+public:
+    // Applies one message. Returns false for corrupt input, or for a delta
+    // before the first keyframe or with a different geometry.
+    bool decode(const uint8_t *in, size_t size);
+
+    Revolution const &revolution() const { return m_revolution; }
+    bool hasKeyframe() const { return m_hasKeyframe; }
+
+private:
+    Revolution m_revolution;
+    bool m_hasKeyframe = false;
+};
+
+// Data path stage assembling revolutions and handing out their delta stream
+// messages.
+class RevolutionDeltaStage: public ProcessingStage
+{
+public:
+    using Callback = std::function<void(const uint8_t *message, size_t size, bool keyframe)>;
+
+    RevolutionDeltaStage(Callback callback, unsigned keyframeInterval = 30, uint16_t spokes = 2048, uint16_t bins = 1024);
+
+    std::string name() const override { return "revolution_delta"; }
+    void process(std::vector<Scanline> &scanlines) override;
+
+    void requestKeyframe();
+
+private:
+    Callback m_callback;
+    RevolutionAssembler m_assembler;
+    RevolutionDeltaEncoder m_encoder;
+    std::vector<uint8_t> m_message;
+    std::atomic<bool> m_keyframeRequested{false};
+};
+
+} // namespace halo_radar
+
+#endif
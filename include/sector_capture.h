@@ -0,0 +1,107 @@
+#ifndef HALO_RADAR_SECTOR_CAPTURE_H
+#define HALO_RADAR_SECTOR_CAPTURE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "processing_stage.h"
+
+namespace halo_radar
+{
+
+// Native capture of the sectors a channel hands out, the same content as
+// the RadarSector messages of the ROS driver.
+//
+// A SectorCaptureHeader, then one SectorRecord per sector followed by its
+// `size` payload bytes: `scanlines` spokes of `bins` intensities each in
+// spoke codec form (see spoke_codec.h). Angles follow the RadarSector
+// convention, radians counter clockwise from forward.
+#pragma pack(push, 1)
+
+struct SectorCaptureHeader
+{
+    uint32_t magic;         // "HRSC"
+    uint32_t version;
+};
+
+struct SectorRecord
+{
+    uint32_t magic;         // "SECT"
+    uint32_t size;          // payload bytes
+    int64_t stamp;          // ns since epoch
+    char channel[16];       // label, nul padded
+    float angleStart;
+    float angleIncrement;
+    float rangeMax;         // meters
+    float scanTime;         // seconds per turn, 0 if unknown
+    float timeIncrement;    // seconds between spokes, 0 if unknown
+    uint16_t scanlines;
+    uint16_t bins;
+};
+
+#pragma pack(pop)
+
+class SectorCaptureWriter
+{
+public:
+    ~SectorCaptureWriter();
+
+    // Creates (or truncates) path. Returns false on failure, with errno set.
+    bool open(std::string const &path);
+    bool isOpen() const { return m_file != nullptr; }
+    void close();
+
+    // record.magic and record.size are filled in here.
+    bool write(SectorRecord &record, const uint8_t *payload, size_t size);
+
+private:
+    FILE *m_file = nullptr;
+};
+
+class SectorCaptureReader
+{
+public:
+    ~SectorCaptureReader();
+
+    bool open(std::string const &path);
+    void close();
+
+    // Reads the next sector. Returns false at the end of the file or on a
+    // corrupt record.
+    bool next(SectorRecord &record, std::vector<uint8_t> &payload);
+    // After next returned false: whether the file ended cleanly behind the
+    // last whole record, rather than in a corrupt or truncated one.
+    bool atEnd() const { return m_atEnd; }
+
+private:
+    FILE *m_file = nullptr;
+    bool m_atEnd = false;
+};
+
+// Sets the channel label of a record.
+void setSectorChannel(SectorRecord &record, std::string const &label);
+
+// Data path stage writing every sector of a channel to a capture file, as
+// HaloRadar::processData would publish it. Scan and time increments are
+// left 0, for radar_reprocess to fill in.
+class SectorCaptureStage: public ProcessingStage
+{
+public:
+    SectorCaptureStage(std::string const &path, std::string const &label);
+
+    std::string name() const override { return "sector_capture"; }
+    void process(std::vector<Scanline> &scanlines) override;
+
+    bool isOpen() const { return m_writer.isOpen(); }
+
+private:
+    SectorCaptureWriter m_writer;
+    std::string m_label;
+    std::vector<uint8_t> m_payload;
+};
+
+} // namespace halo_radar
+
+#endif
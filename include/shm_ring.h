@@ -0,0 +1,197 @@
+#ifndef HALO_RADAR_SHM_RING_H
+#define HALO_RADAR_SHM_RING_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "processing_stage.h"
+#include "revolution.h"
+
+namespace halo_radar
+{
+
+// POSIX shared memory ring with one writer and any number of readers.
+//
+// The segment starts with a ShmRingHeader followed by slotCount slots of
+// slotSize bytes. Message n goes to slot n % slotCount. Each slot is guarded
+// by a sequence lock: the writer sets the slot sequence to 2n+1, writes the
+// payload, then stores 2n+2 and advances writeSequence. Readers never block
+// the writer; they check the slot sequence before and after using the
+// payload and detect being lapped.
+//
+// A writer never reuses a segment readers may have mapped: it marks the old
+// one retired, unlinks it and creates a new one under the name. Readers
+// notice the mark and map the new segment.
+struct ShmRingHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotCount;
+    uint32_t slotSize;
+    std::atomic<uint64_t> writeSequence; // messages published so far
+    std::atomic<uint32_t> retired;       // the writer went away or replaced the segment
+};
+
+struct ShmSlotHeader
+{
+    std::atomic<uint64_t> sequence;
+    uint32_t size;                       // payload bytes
+    uint32_t type;
+};
+
+enum ShmMessageType : uint32_t
+{
+    SHM_SPOKE = 1,
+    SHM_REVOLUTION = 2
+};
+
+#pragma pack(push, 1)
+
+struct ShmSpoke
+{
+    uint64_t number;        // spokes published so far on this ring
+    int64_t stamp;          // ns since epoch
+    float angle;            // degrees clockwise relative to fwd
+    float range;            // meters
+    uint16_t bins;
+    uint8_t intensities[1024];
+};
+
+// Followed by spokes*bins intensities, then spokes presence flags.
+struct ShmRevolution
+{
+    uint64_t number;
+    int64_t stamp;          // ns since epoch
+    float range;
+    uint16_t spokes;
+    uint16_t bins;
+};
+
+#pragma pack(pop)
+
+class ShmRingWriter
+{
+public:
+    ShmRingWriter();
+    ~ShmRingWriter();
+
+    // Creates the named segment, retiring any previous one. Returns false
+    // on failure, with errno set.
+    bool create(std::string const &name, uint32_t slotCount, uint32_t payloadSize);
+
+    // Reserves the next slot and returns its payload area, to be filled in
+    // place and published with commit.
+    uint8_t *begin();
+    void commit(uint32_t size, uint32_t type);
+
+    uint64_t published() const;
+    size_t payloadSize() const { return m_slotSize - sizeof(ShmSlotHeader); }
+
+private:
+    std::string m_name;
+    uint64_t m_inode = 0;       // of the segment, the name may have passed to a newer writer
+    uint8_t *m_memory = nullptr;
+    size_t m_size = 0;
+    uint32_t m_slotSize = 0;
+    ShmSlotHeader *m_slot = nullptr;
+    uint64_t m_sequence = 0;
+};
+
+// A message as seen by a reader, pointing straight into shared memory. The
+// data is only known to be intact if ShmRingReader::valid still holds after
+// it has been used.
+struct ShmView
+{
+    uint64_t sequence = 0;
+    uint32_t type = 0;
+    uint32_t size = 0;
+    const uint8_t *data = nullptr;
+};
+
+class ShmRingReader
+{
+public:
+    enum Result
+    {
+        OK,
+        EMPTY,   // nothing new yet
+        OVERRUN  // the writer lapped this reader, it skipped ahead
+    };
+
+    ShmRingReader();
+    ~ShmRingReader();
+
+    bool open(std::string const &name);
+    bool isOpen() const { return m_memory != nullptr; }
+
+    // Next unread message. Starts at the newest one after open. Once the
+    // segment is retired it opens the name again, at most every 100 ms,
+    // and carries on from the start of the new one; views into the old
+    // segment are then gone.
+    Result next(ShmView &view);
+    bool valid(ShmView const &view) const;
+
+    uint64_t dropped() const { return m_dropped; }
+
+private:
+    ShmSlotHeader *slot(uint64_t sequence) const;
+    // Maps the segment under m_name in place of the current one.
+    bool map();
+
+    std::string m_name;
+    std::chrono::steady_clock::time_point m_retry; // next attempt to open a retired segment again
+    uint8_t *m_memory = nullptr;
+    size_t m_size = 0;
+    const ShmRingHeader *m_header = nullptr;
+    uint64_t m_next = 0;
+    uint64_t m_dropped = 0;
+};
+
+// Data path stage publishing every decoded spoke to <name>_spokes and every
+// assembled revolution to <name>_revolutions.
+class ShmPublisher: public ProcessingStage
+{
+public:
+    ShmPublisher(std::string const &name, uint32_t spokeSlots = 4096, uint32_t revolutionSlots = 4,
+                 uint16_t spokes = 2048, uint16_t bins = 1024);
+
+    bool isOpen() const { return m_open; }
+
+    std::string name() const override { return "shm_publisher"; }
+    void process(std::vector<Scanline> &scanlines) override;
+
+private:
+    void publishRevolution(Revolution const &revolution);
+
+    ShmRingWriter m_spokes;
+    ShmRingWriter m_revolutions;
+    RevolutionAssembler m_assembler;
+    bool m_open = false;
+};
+
+// Reader side of ShmPublisher.
+class ShmSubscriber
+{
+public:
+    bool open(std::string const &name);
+
+    // Views into shared memory, see ShmView. Return false when nothing new
+    // is available.
+    bool nextSpoke(const ShmSpoke *&spoke, ShmView &view);
+    bool nextRevolution(const ShmRevolution *&revolution, const uint8_t *&intensities, const uint8_t *&present, ShmView &view);
+
+    bool valid(ShmView const &view) const;
+    uint64_t dropped() const { return m_spokes.dropped() + m_revolutions.dropped(); }
+
+private:
+    ShmRingReader m_spokes;
+    ShmRingReader m_revolutions;
+};
+
+} // namespace halo_radar
+
+#endif
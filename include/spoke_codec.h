@@ -0,0 +1,91 @@
+#ifndef HALO_RADAR_SPOKE_CODEC_H
+#define HALO_RADAR_SPOKE_CODEC_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "processing_stage.h"
+
+namespace halo_radar
+{
+
+// Unpacks bytes of nibble packed data such as RawScanline::data into
+// 2*bytes intensities, low nibble first.
+void unpackSpoke(const uint8_t *packed, size_t bytes, uint8_t *intensities);
+
+// Same for spokes sent with doppler_mode on, where the Halo marks echoes
+// of approaching targets with code 15 and, in normal mode, receding ones
+// with code 14. Those codes are split into doppler (DopplerClass per bin)
+// and the intensity is set to 13, the highest ordinary level in this mode,
+// so stages that only look at intensities still see a strong echo. With
+// receding false (approaching only mode) code 14 is an ordinary level.
+void unpackDopplerSpoke(const uint8_t *packed, size_t bytes, uint8_t *intensities, uint8_t *doppler, bool receding);
+
+// Unpacks at half the range resolution: bytes intensities, each the
+// stronger of the two bins a byte holds, so a small target keeps its echo.
+void unpackSpokeHalfRange(const uint8_t *packed, size_t bytes, uint8_t *intensities);
+
+// Halves count unpacked bins in place the same way, keeping the doppler
+// class of the stronger bin, or of either when they are equally strong.
+// doppler may be null.
+void halveSpoke(uint8_t *intensities, uint8_t *doppler, size_t count);
+
+// Run length coding of 4-bit spoke intensities.
+//
+// A spoke is a sequence of tokens:
+//   0LLLLLLL              literal, L+1 (1-128) values follow, packed two per
+//                         byte with the first value in the low nibble, as in
+//                         RawScanline::data
+//   1LLLVVVV              run of value V, L+2 (2-8) times
+//   1111VVVV NNNNNNNN     run of value V, N+9 (9-264) times
+// Halo spokes are mostly zeros and long equal runs, so most of a spoke
+// collapses into a handful of run tokens, while noisy stretches cost at most
+// one token byte per 128 values over nibble packing.
+
+// Appends the encoding of count intensities (values 0-15) to out.
+void encodeSpoke(const uint8_t *intensities, size_t count, std::vector<uint8_t> &out);
+
+// Same for nibble packed data such as RawScanline::data, 2*bytes values.
+void encodePackedSpoke(const uint8_t *packed, size_t bytes, std::vector<uint8_t> &out);
+
+// Decodes exactly count intensities. Returns the number of input bytes
+// used, or 0 if the input is truncated or does not match count.
+size_t decodeSpoke(const uint8_t *in, size_t size, uint8_t *intensities, size_t count);
+
+struct SpokeCodecStatistics
+{
+    uint64_t spokes = 0;
+    uint64_t packedBytes = 0;   // size as nibble packed on the wire
+    uint64_t encodedBytes = 0;
+    uint64_t encodeNanoseconds = 0;
+
+    double ratio() const { return encodedBytes ? double(packedBytes)/encodedBytes : 0.0; }
+    double megabytesPerSecond() const { return encodeNanoseconds ? packedBytes*1.0e3/encodeNanoseconds : 0.0; }
+};
+
+// Data path stage that encodes every spoke into a scratch buffer to measure
+// the compression ratio and speed on live data. It does not change the
+// scanlines.
+class SpokeCodecMeter: public ProcessingStage
+{
+public:
+    std::string name() const override { return "spoke_codec_meter"; }
+    void process(std::vector<Scanline> &scanlines) override;
+    bool optional() const override { return true; }
+
+    // Totals since the previous call.
+    SpokeCodecStatistics take();
+
+private:
+    std::vector<uint8_t> m_buffer;
+    std::atomic<uint64_t> m_spokes{0};
+    std::atomic<uint64_t> m_packedBytes{0};
+    std::atomic<uint64_t> m_encodedBytes{0};
+    std::atomic<uint64_t> m_encodeNanoseconds{0};
+};
+
+} // namespace halo_radar
+
+#endif
@@ -0,0 +1,332 @@
+#ifndef HALO_RADAR_SUBSCRIPTION_H
+#define HALO_RADAR_SUBSCRIPTION_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "metrics.h"
+#include "revolution.h"
+
+namespace halo_radar
+{
+
+struct Scanline;
+
+// The scanlines of one data datagram after the processing stages, as
+// processData sees them.
+struct Sector
+{
+    uint64_t number = 0;                         // per channel, counts sectors published
+    std::chrono::system_clock::time_point stamp; // when it was published
+    std::vector<Scanline> scanlines;
+};
+
+// Azimuth sector and range band a region subscriber wants, e.g. a guard
+// zone.
+struct RegionOfInterest
+{
+    float startAngle = 0.0f;    // degrees clockwise relative to fwd, like Scanline::angle
+    float endAngle = 360.0f;    // exclusive; below startAngle the region wraps through 0
+    float minRange = 0.0f;      // meters
+    float maxRange = std::numeric_limits<float>::max();
+
+    // Whether the region overlaps the azimuth span [from, to) degrees,
+    // from may be negative to wrap through 0.
+    bool overlaps(float from, float to) const;
+    // Bins [first, last) of a spoke of bins covering range meters that
+    // overlap the band, widened to whole bytes of nibble packed data.
+    // Returns false if none do. A spoke of unknown (0) range is covered
+    // whole, it can not be gated.
+    bool bins(float range, size_t bins, size_t &first, size_t &last) const;
+};
+
+// A run of bins of a RegionSpoke.
+struct RegionSpan
+{
+    uint16_t firstBin;
+    uint16_t count;
+    uint16_t offset;    // of the first bin in RegionSpoke::intensities
+};
+
+// The bins of one spoke that any region covers, as disjoint spans in
+// ascending order, so the gap between two bands is never decoded.
+struct RegionSpoke
+{
+    float angle;
+    float range;        // meters, of the whole spoke
+    uint16_t bins;      // of the whole spoke
+    std::vector<RegionSpan> spans;  // firstBin is even, each starts on a byte
+    std::vector<uint8_t> intensities;   // the spans one after another
+    std::vector<uint8_t> doppler;   // DopplerClass per bin, empty unless doppler_mode is on
+};
+
+struct RegionSector
+{
+    uint64_t number = 0;
+    std::chrono::system_clock::time_point stamp;
+    std::vector<RegionSpoke> spokes;
+};
+
+// One spoke as a region subscriber sees it: its own bins only, pointing
+// into the spoke shared with the other region subscribers. Valid during
+// the callback.
+struct RegionView
+{
+    float angle;
+    float range;                // meters, of the whole spoke; range/bins per bin
+    size_t bins;                // of the whole spoke
+    size_t firstBin;
+    size_t count;
+    const uint8_t *intensities;
+    const uint8_t *doppler;     // null unless doppler_mode is on
+};
+
+// Shared between all subscribers, read only. Buffers come from a pool and
+// go back to it once the last subscriber lets go.
+using SectorPtr = std::shared_ptr<const Sector>;
+using RevolutionPtr = std::shared_ptr<const Revolution>;
+using RegionSectorPtr = std::shared_ptr<const RegionSector>;
+
+// What happens when a subscriber's queue is full.
+enum BackpressurePolicy
+{
+    BACKPRESSURE_BLOCK,         // the data thread waits for room, nothing is lost
+    BACKPRESSURE_DROP_OLDEST,   // the oldest queued item makes room
+    BACKPRESSURE_KEEP_LATEST    // a single slot, each item replaces the one waiting
+};
+
+struct SubscriptionConfig
+{
+    std::string name = "subscriber"; // metrics label
+    size_t capacity = 16;            // queued items; sectors for spoke subscriptions
+    BackpressurePolicy policy = BACKPRESSURE_DROP_OLDEST;
+};
+
+// A consumer with its own bounded queue and thread, see SubscriptionHub.
+// Stopping, or destroying the last reference, joins the thread; items
+// still queued are discarded. A callback must not unsubscribe itself.
+class Subscription
+{
+public:
+    Subscription(SubscriptionConfig const &config, MetricLabels labels);
+    virtual ~Subscription();
+
+    std::string const &name() const { return m_config.name; }
+    BackpressurePolicy policy() const { return m_config.policy; }
+    uint64_t delivered() const { return m_delivered->value(); }
+    uint64_t dropped() const { return m_dropped->value(); }
+    size_t depth() const;
+
+    void stop();
+
+protected:
+    void start();
+    virtual void run() = 0;
+
+    SubscriptionConfig m_config;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_ready;
+    std::condition_variable m_space;
+    size_t m_count = 0;
+    bool m_stopFlag = false;
+    std::thread m_thread;
+    std::mutex m_joinMutex;     // stop may race between unsubscribe and the hub going away
+
+    std::shared_ptr<Counter> m_delivered;
+    std::shared_ptr<Counter> m_dropped;
+};
+
+// Subscription queueing items of type T, handed to deliver on its thread.
+template<typename T>
+class QueuedSubscription: public Subscription
+{
+public:
+    using Deliver = std::function<void(T const &)>;
+
+    QueuedSubscription(SubscriptionConfig const &config, MetricLabels const &labels, Deliver deliver)
+        :Subscription(config, labels),m_deliver(std::move(deliver))
+    {
+        if(m_config.policy == BACKPRESSURE_KEEP_LATEST || m_config.capacity == 0)
+            m_config.capacity = 1;
+        m_items.resize(m_config.capacity);
+        start();
+    }
+    ~QueuedSubscription() override { stop(); }
+
+    // Producer side. Returns false if the subscription was stopped.
+    bool push(T const &item)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if(m_stopFlag)
+            return false;
+        if(m_count == m_items.size())
+        {
+            if(m_config.policy == BACKPRESSURE_BLOCK)
+            {
+                m_space.wait(lock, [this]{ return m_count < m_items.size() || m_stopFlag; });
+                if(m_stopFlag)
+                    return false;
+            }
+            else
+            {
+                m_items[m_head] = T();
+                m_head = (m_head + 1) % m_items.size();
+                m_count--;
+                m_dropped->add();
+            }
+        }
+        m_items[(m_head + m_count) % m_items.size()] = item;
+        m_count++;
+        lock.unlock();
+        m_ready.notify_one();
+        return true;
+    }
+
+protected:
+    void run() override
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while(true)
+        {
+            m_ready.wait(lock, [this]{ return m_count > 0 || m_stopFlag; });
+            if(m_stopFlag)
+                break;
+            T item = std::move(m_items[m_head]);
+            m_items[m_head] = T();
+            m_head = (m_head + 1) % m_items.size();
+            m_count--;
+            lock.unlock();
+            m_space.notify_one();
+            m_deliver(item);
+            m_delivered->add();
+            item = T();     // back to the pool before waiting
+            lock.lock();
+        }
+        for(auto &i: m_items)
+            i = T();
+    }
+
+private:
+    Deliver m_deliver;
+    std::vector<T> m_items;     // ring of capacity items
+    size_t m_head = 0;
+};
+
+// Fans the data of one radar channel out to any number of subscribers.
+//
+// publish runs on the data thread after the processing stages and
+// processData. It copies the scanlines once into a pooled Sector, which
+// every spoke and sector subscriber then shares, and, while anyone wants
+// revolutions, assembles those the same way. Each subscriber consumes on
+// its own thread from its own queue, so a slow one only affects itself,
+// unless it chose BACKPRESSURE_BLOCK, which stalls the data thread and so
+// everyone else.
+//
+// Region subscribers share one RegionSector per datagram holding, for each
+// spoke, the bins of the union of all regions, looked up per azimuth row in
+// a table of merged range bands rebuilt on (un)subscribe. A row is covered
+// by every region overlapping any part of its azimuth span. When nothing else needs whole spokes
+// the data thread decodes just those bytes, see beginRegions; otherwise
+// publish cuts them from the decoded scanlines. Each subscriber then picks
+// its own bins out on its thread.
+class SubscriptionHub
+{
+public:
+    using SpokeCallback = std::function<void(Scanline const &spoke, SectorPtr const &sector)>;
+    using SectorCallback = std::function<void(SectorPtr const &sector)>;
+    using RevolutionCallback = std::function<void(RevolutionPtr const &revolution)>;
+    using RegionCallback = std::function<void(RegionView const &spoke)>;
+
+    SubscriptionHub(MetricLabels const &labels = MetricLabels());
+    ~SubscriptionHub();
+
+    // Spokes one at a time; the queue holds whole sectors.
+    std::shared_ptr<Subscription> subscribeSpokes(SubscriptionConfig const &config, SpokeCallback callback);
+    std::shared_ptr<Subscription> subscribeSectors(SubscriptionConfig const &config, SectorCallback callback);
+    std::shared_ptr<Subscription> subscribeRevolutions(SubscriptionConfig const &config, RevolutionCallback callback);
+    // Spokes one at a time, cut to the region; the queue holds whole sectors.
+    std::shared_ptr<Subscription> subscribeRegion(RegionOfInterest const &region, SubscriptionConfig const &config, RegionCallback callback);
+    void unsubscribe(std::shared_ptr<Subscription> const &subscription);
+
+    bool empty() const { return m_subscribers.load(std::memory_order_relaxed) == 0; }
+    // Whether any spoke, sector or revolution subscriber needs whole spokes.
+    bool wantsWholeSpokes() const { return m_subscribers.load(std::memory_order_relaxed) > m_regions.load(std::memory_order_relaxed); }
+    bool hasRegions() const { return m_regions.load(std::memory_order_relaxed) > 0; }
+
+    // Data thread only.
+    void publish(std::vector<Scanline> const &scanlines);
+
+    // Data thread only, decoding for region subscribers alone. Between
+    // beginRegions and publishRegions, addRegionSpoke returns the spoke to
+    // unpack each of its spans into, sized and with the geometry filled
+    // in, or null if no region covers any of it.
+    void beginRegions();
+    RegionSpoke *addRegionSpoke(float angle, float range, size_t bins);
+    void publishRegions();
+
+private:
+    // Range band of the regions covering an azimuth row; a row holds them
+    // merged, ascending and disjoint.
+    struct RegionBand
+    {
+        float minRange;
+        float maxRange;
+    };
+    using RegionTable = std::vector<std::vector<RegionBand> >;
+    struct RegionSubscriber
+    {
+        RegionOfInterest region;
+        std::shared_ptr<QueuedSubscription<RegionSectorPtr> > subscription;
+    };
+    static const uint16_t region_rows = 2048;   // as RevolutionAssembler
+
+    // Azimuth span [from, to) of the spokes RevolutionAssembler::row puts
+    // in row.
+    static void rowSpan(size_t row, float &from, float &to);
+
+    // A pooled buffer is free when the pool holds its only reference.
+    template<typename T> std::shared_ptr<T> acquire(std::vector<std::shared_ptr<T> > &pool, size_t &next);
+    // With m_mutex held.
+    void rebuildRegionTable();
+    // Data thread; pushing with m_mutex held.
+    void startRegionSector();
+    void pushRegionSector();
+
+    MetricLabels m_labels;
+    std::mutex m_mutex;
+    std::vector<std::shared_ptr<QueuedSubscription<SectorPtr> > > m_sectorSubscribers; // spokes too
+    std::vector<std::shared_ptr<QueuedSubscription<RevolutionPtr> > > m_revolutionSubscribers;
+    std::vector<RegionSubscriber> m_regionSubscribers;
+    std::shared_ptr<const RegionTable> m_regionTable;  // region_rows, union of m_regionSubscribers
+    std::atomic<size_t> m_subscribers{0};
+    std::atomic<size_t> m_regions{0};
+
+    // data thread only
+    std::vector<std::shared_ptr<Sector> > m_sectorPool;
+    std::vector<std::shared_ptr<Revolution> > m_revolutionPool;
+    size_t m_nextSector = 0;
+    size_t m_nextRevolution = 0;
+    uint64_t m_sectorNumber = 0;
+    std::vector<std::shared_ptr<RegionSector> > m_regionPool;
+    size_t m_nextRegion = 0;
+    std::shared_ptr<const RegionTable> m_table;  // m_regionTable as the sector started
+    std::vector<std::pair<size_t, size_t> > m_spans; // scratch, bins of the bands of a spoke
+    std::shared_ptr<RegionSector> m_region;     // being filled
+    size_t m_regionSpokes = 0;
+    uint64_t m_regionNumber = 0;
+    RevolutionAssembler m_assembler;
+};
+
+} // namespace halo_radar
+
+#endif
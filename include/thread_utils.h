@@ -0,0 +1,77 @@
+#ifndef HALO_RADAR_THREAD_UTILS_H
+#define HALO_RADAR_THREAD_UTILS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace halo_radar
+{
+
+// Restricts the calling thread to the given cores. Returns false if the
+// kernel rejected the mask, e.g. because none of the cores exist.
+bool setCurrentThreadAffinity(std::vector<int> const &cpus);
+
+// Cores the calling thread is currently allowed to run on.
+std::vector<int> currentThreadAffinity();
+
+// Switches the calling thread to SCHED_FIFO at the given priority (1-99).
+// Needs CAP_SYS_NICE or a suitable RLIMIT_RTPRIO.
+bool setCurrentThreadRealtime(int priority);
+
+// What the kernel reports for the calling thread, checked after setup so a
+// silently ignored request shows up in the startup report.
+struct ThreadReport
+{
+    std::string name;
+    std::vector<int> cpus;
+    int policy = 0;
+    int priority = 0;
+    bool affinityApplied = true;
+    bool realtimeApplied = true;
+    bool faultsCounted = false; // the thread samples its own page faults
+    bool warmedUp = false;      // and has taken a sample since warming up
+    long minorFaults = 0;  // page faults since the thread finished warming up
+    long majorFaults = 0;
+
+    std::string str() const;
+};
+
+ThreadReport currentThreadReport(std::string const &name);
+
+// Page faults taken by the calling thread so far.
+void currentThreadFaults(long &minor, long &major);
+
+struct MemoryLockReport
+{
+    bool locked = false;
+    size_t lockedBytes = 0;    // VmLck from /proc/self/status
+    size_t prefaultedHeap = 0;
+    size_t prefaultedStack = 0;
+
+    std::string str() const;
+};
+
+// Locks current and future pages with mlockall, stops malloc from returning
+// memory to the kernel and touches heapBytes of heap and stackBytes of the
+// calling thread's stack so later allocations are served without faults.
+MemoryLockReport lockProcessMemory(size_t heapBytes, size_t stackBytes);
+
+// NUMA node of the network device owning the given local address, read from
+// sysfs. Returns -1 when the host has no NUMA information for it.
+int interfaceNumaNode(uint32_t interface);
+
+// Index of the network device owning the given local address, 0 if none.
+int interfaceIndex(uint32_t interface);
+
+// Cores belonging to a NUMA node, empty if the node is unknown.
+std::vector<int> numaNodeCpus(int node);
+
+// Kernel style cpu lists, e.g. "0-3,8".
+std::vector<int> parseCpuList(std::string const &list);
+std::string cpuListToString(std::vector<int> const &cpus);
+
+} // namespace halo_radar
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef HALO_RADAR_TRACKER_H
+#define HALO_RADAR_TRACKER_H
+
+#include <cstdint>
+#include <chrono>
+#include <vector>
+
+#include "blob_extractor.h"
+
+namespace halo_radar
+{
+
+enum TrackStatus : uint8_t
+{
+    TRACK_TENTATIVE = 0,    // not yet seen on confirmHits revolutions
+    TRACK_CONFIRMED = 1,
+    TRACK_COASTING = 2,     // confirmed but missed on this revolution
+    TRACK_DELETED = 3       // last update for this id
+};
+
+#pragma pack(push, 1)
+
+struct TrackUpdate
+{
+    uint32_t id;
+    uint8_t status;     // TrackStatus
+    uint8_t misses;     // consecutive revolutions without a contact
+    uint16_t hits;      // revolutions with a contact, saturating
+    uint64_t revolution;
+    int64_t stamp;      // ns since epoch
+    float x;            // meters, as Contact::x and Contact::y
+    float y;
+    float vx;           // meters per second
+    float vy;
+    float positionSigma;// meters, mean of the two axes
+    uint32_t cells;     // of the associated contact, 0 when missed
+};
+
+#pragma pack(pop)
+
+struct TrackerConfig
+{
+    float gate = 60.0;                  // meters, largest contact to track distance
+    float measurementSigma = 5.0;       // meters, per axis
+    float acceleration = 1.0;           // m/s^2, process noise
+    float initialSpeedSigma = 15.0;     // m/s, per axis, for new tracks
+    uint16_t confirmHits = 3;
+    uint8_t maxMisses = 4;              // confirmed tracks, tentative ones go on the first miss
+};
+
+// Multi-target tracker fed with the contacts of each revolution.
+//
+// Tracks are predicted to the revolution time and matched to contacts found
+// through a uniform grid of gate sized cells, so each track only looks at
+// the contacts in the 3x3 cells around it. Candidate pairs are assigned
+// greedily, closest first by normalised innovation. Each track runs a
+// constant velocity Kalman filter per axis.
+class Tracker
+{
+public:
+    Tracker(TrackerConfig const &config = TrackerConfig());
+
+    // Replaces updates with the state of every track after revolution,
+    // including a TRACK_DELETED entry for tracks dropped on it.
+    void update(uint64_t revolution, std::chrono::system_clock::time_point stamp,
+                std::vector<Contact> const &contacts, std::vector<TrackUpdate> &updates);
+
+    size_t size() const { return m_tracks.size(); }
+    void clear() { m_tracks.clear(); }
+
+private:
+    struct Axis
+    {
+        float p, v;         // position, velocity
+        float pp, pv, vv;   // covariance
+        void predict(float dt, float q);
+        void correct(float z, float r);
+    };
+
+    struct Track
+    {
+        uint32_t id;
+        Axis x, y;
+        uint16_t hits;
+        uint8_t misses;
+        bool confirmed;
+        uint32_t cells;
+    };
+
+    struct Candidate
+    {
+        float distance;
+        uint32_t track;
+        uint32_t contact;
+    };
+
+    void buildGrid(std::vector<Contact> const &contacts);
+    TrackUpdate makeUpdate(Track const &track, uint8_t status, uint64_t revolution, int64_t stamp) const;
+
+    TrackerConfig m_config;
+    std::vector<Track> m_tracks;
+    uint32_t m_nextId = 1;
+    bool m_started = false;
+    std::chrono::system_clock::time_point m_stamp;
+
+    // contacts bucketed by hashed grid cell, counting sorted
+    std::vector<uint32_t> m_bucketStart;
+    std::vector<uint32_t> m_bucketContacts;
+    std::vector<int64_t> m_contactCell;
+    uint64_t m_bucketMask = 0;
+
+    std::vector<Candidate> m_candidates;
+    std::vector<int32_t> m_trackContact;
+    std::vector<uint8_t> m_contactUsed;
+};
+
+} // namespace halo_radar
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef HALO_RADAR_XDP_SOCKET_H
+#define HALO_RADAR_XDP_SOCKET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ipv4_reassembler.h"
+
+namespace halo_radar
+{
+
+struct XdpConfig
+{
+    uint32_t frameSize = 2048;      // UMEM chunk, holds one Ethernet frame
+    uint32_t frameCount = 4096;     // power of two
+    uint32_t queue = 0;             // NIC receive queue to bind; the group must be steered to it
+    bool nativeMode = false;        // driver XDP and zero copy, else generic (SKB) mode which works anywhere
+};
+
+// Receives the UDP payloads of one multicast group and port through an
+// AF_XDP socket, bypassing the kernel network stack.
+//
+// A small eBPF program, assembled here and attached to the interface,
+// redirects IPv4 UDP frames for the group (and, for whole datagrams and
+// first fragments, the port) to the socket; everything else passes to the
+// stack as usual. Frames land in a UMEM region mapped into this process and
+// are parsed in place: whole datagrams are handed out without a copy,
+// fragments are reassembled with one, see Ipv4Reassembler. IP reassembly,
+// routing and UDP delivery never run for them.
+//
+// Generic mode runs on any device including veth, native mode needs driver
+// support. One program per interface: a second channel on the same
+// interface fails to open and should use another backend. An unbound UDP
+// socket stays joined to the group for IGMP. Needs CAP_NET_ADMIN, CAP_BPF
+// and CAP_NET_RAW (or root), and a kernel with BPF links for XDP (5.9).
+class XdpSocket
+{
+public:
+    XdpSocket(XdpConfig const &config = XdpConfig());
+    ~XdpSocket();
+
+    // Opens the socket on the interface owning the local address interface,
+    // for group:port (network order). Returns false on failure, with errno
+    // set; ENOTSUP when built without AF_XDP headers.
+    bool open(uint32_t interface, uint32_t group, uint16_t port);
+    bool isOpen() const { return m_socket >= 0; }
+    void close();
+
+    // Next UDP payload, valid until the following call. Waits up to
+    // timeoutMilliseconds; returns false if nothing arrived.
+    bool next(const uint8_t *&payload, int &size, int timeoutMilliseconds);
+
+    // Frames dropped for lack of room in the rings since the last call.
+    uint64_t takeDrops();
+
+    // Share of the RX ring filled and waiting, 0 to 1.
+    double backlog() const;
+
+    size_t bufferBytes() const { return m_umemSize; }
+
+    // Verifier output for the program when the last open failed loading it,
+    // empty otherwise.
+    std::string const &verifierLog() const { return m_verifierLog; }
+
+private:
+    // Single producer, single consumer ring shared with the kernel.
+    struct Ring
+    {
+        uint32_t *producer = nullptr;
+        uint32_t *consumer = nullptr;
+        void *descriptors = nullptr;
+        uint32_t mask = 0;
+        void *map = nullptr;
+        size_t mapSize = 0;
+    };
+
+    // Hands a UMEM frame back to the kernel through the fill ring.
+    void recycle(uint64_t address);
+
+    XdpConfig m_config;
+    int m_socket = -1;
+    int m_joinSocket = -1;
+    int m_map = -1;             // XSKMAP, queue to socket
+    int m_program = -1;
+    int m_link = -1;            // BPF link, detaches the program when closed
+    uint8_t *m_umem = nullptr;
+    size_t m_umemSize = 0;
+    Ring m_rx;
+    Ring m_fill;
+    Ring m_completion;
+    uint32_t m_rxConsumer = 0;  // local copies, published after each batch
+    uint32_t m_fillProducer = 0;
+    bool m_holding = false;     // m_held is out as the last payload
+    uint64_t m_held = 0;
+    uint64_t m_lastDrops = 0;
+    std::string m_verifierLog;
+
+    Ipv4Reassembler m_reassembler;
+};
+
+} // namespace halo_radar
+
+#endif
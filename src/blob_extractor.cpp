@@ -0,0 +1,327 @@
+#include "blob_extractor.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "radar.h"
+#include "thread_utils.h"
+
+namespace halo_radar
+{
+
+namespace
+{
+
+// which side of north a segment of a blob reaches
+const uint8_t SEAM_LOW = 1;     // row 0
+const uint8_t SEAM_HIGH = 2;    // the last row
+
+} // namespace
+
+BlobExtractor::BlobExtractor(BlobConfig const &config):m_config(config)
+{
+    // a zero threshold would make every cell one blob
+    m_config.threshold = std::max<uint8_t>(m_config.threshold, 1);
+    m_config.stripes = std::max(m_config.stripes, 1u);
+    m_stripePartials.resize(m_config.stripes);
+    for(size_t s = 1; s < m_config.stripes; s++)
+        m_workers.emplace_back(&BlobExtractor::worker, this, s);
+}
+
+BlobExtractor::~BlobExtractor()
+{
+    {
+        const std::lock_guard<std::mutex> lock(m_poolMutex);
+        m_exitFlag = true;
+    }
+    m_start.notify_all();
+    for(auto &w: m_workers)
+        w.join();
+}
+
+void BlobExtractor::worker(size_t stripe)
+{
+    if(!m_config.cpus.empty() && !setCurrentThreadAffinity(m_config.cpus))
+        perror("blob extractor affinity");
+    // not the SCHED_FIFO of a data thread that may have created us
+    sched_param param;
+    memset(&param, 0, sizeof(param));
+    pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(m_poolMutex);
+    while(true)
+    {
+        m_start.wait(lock, [&]{ return m_exitFlag || m_generation != seen; });
+        if(m_exitFlag)
+            break;
+        seen = m_generation;
+        const Revolution *revolution = m_job;
+        const bool active = stripe < m_stripes;
+        lock.unlock();
+        if(active)
+            labelStripe(*revolution, stripe);
+        lock.lock();
+        if(--m_pending == 0)
+            m_done.notify_one();
+    }
+}
+
+void BlobExtractor::labelStripe(Revolution const &revolution, size_t stripe)
+{
+    const size_t first = m_stripeStart[stripe];
+    const size_t last = m_stripeStart[stripe+1];
+    const size_t bins = revolution.bins;
+    const uint8_t threshold = m_config.threshold;
+    uint32_t *parent = m_parent.data();
+
+    auto find = [parent](uint32_t i)
+    {
+        while(parent[i] != i)
+        {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    };
+    // the root is always the lowest index, so it is met first in the
+    // second pass below
+    auto unite = [&](uint32_t a, uint32_t b)
+    {
+        a = find(a);
+        b = find(b);
+        if(a < b)
+            parent[b] = a;
+        else if(b < a)
+            parent[a] = b;
+    };
+
+    for(size_t r = first; r < last; r++)
+    {
+        const uint8_t *row = revolution.spoke(r);
+        const uint8_t *previous = r > first ? revolution.spoke(r-1) : nullptr;
+        for(size_t b = 0; b < bins; b++)
+        {
+            if(row[b] < threshold)
+                continue;
+            uint32_t i = r*bins + b;
+            parent[i] = i;
+            if(b > 0 && row[b-1] >= threshold)
+                unite(i, i-1);
+            if(previous)
+            {
+                if(b > 0 && previous[b-1] >= threshold)
+                    unite(i, i-bins-1);
+                if(previous[b] >= threshold)
+                    unite(i, i-bins);
+                if(b + 1 < bins && previous[b+1] >= threshold)
+                    unite(i, i-bins+1);
+            }
+        }
+    }
+
+    auto &partials = m_stripePartials[stripe];
+    partials.clear();
+    for(size_t r = first; r < last; r++)
+    {
+        const uint8_t *row = revolution.spoke(r);
+        for(size_t b = 0; b < bins; b++)
+        {
+            uint8_t v = row[b];
+            if(v < threshold)
+                continue;
+            uint32_t i = r*bins + b;
+            uint32_t root = find(i);
+            uint32_t p;
+            if(root == i)
+            {
+                p = partials.size();
+                partials.emplace_back();
+            }
+            else
+                p = m_label[root];
+            m_label[i] = p;
+
+            Partial &part = partials[p];
+            part.cells++;
+            part.weight += v;
+            part.rowSum += uint64_t(r)*v;
+            part.binSum += uint64_t(b)*v;
+            part.minRow = std::min<uint16_t>(part.minRow, r);
+            part.maxRow = std::max<uint16_t>(part.maxRow, r);
+            part.minBin = std::min<uint16_t>(part.minBin, b);
+            part.maxBin = std::max<uint16_t>(part.maxBin, b);
+            part.peak = std::max(part.peak, v);
+        }
+    }
+}
+
+uint32_t BlobExtractor::findPartial(uint32_t p)
+{
+    while(m_partialParent[p] != p)
+    {
+        m_partialParent[p] = m_partialParent[m_partialParent[p]];
+        p = m_partialParent[p];
+    }
+    return p;
+}
+
+void BlobExtractor::joinRows(Revolution const &revolution, size_t upper, size_t lower, bool wrap)
+{
+    // upper is the last row of stripe upper, lower the first of stripe lower
+    const size_t bins = revolution.bins;
+    const uint8_t threshold = m_config.threshold;
+    const size_t upperRow = m_stripeStart[upper+1] - 1;
+    const size_t lowerRow = m_stripeStart[lower];
+    const uint8_t *a = revolution.spoke(upperRow);
+    const uint8_t *b = revolution.spoke(lowerRow);
+
+    for(size_t j = 0; j < bins; j++)
+    {
+        if(b[j] < threshold)
+            continue;
+        uint32_t pb = m_partialOffset[lower] + m_label[lowerRow*bins + j];
+        for(size_t k = j > 0 ? j-1 : 0; k <= j+1 && k < bins; k++)
+        {
+            if(a[k] < threshold)
+                continue;
+            uint32_t pa = m_partialOffset[upper] + m_label[upperRow*bins + k];
+            if(wrap)
+            {
+                m_seamSides[m_partialSegment[pa]] |= SEAM_HIGH;
+                m_seamSides[m_partialSegment[pb]] |= SEAM_LOW;
+            }
+            uint32_t ra = findPartial(pa);
+            uint32_t rb = findPartial(pb);
+            if(ra < rb)
+                m_partialParent[rb] = ra;
+            else if(rb < ra)
+                m_partialParent[ra] = rb;
+        }
+    }
+}
+
+void BlobExtractor::extract(Revolution const &revolution, std::vector<Contact> &contacts)
+{
+    contacts.clear();
+    const size_t spokes = revolution.spokes;
+    const size_t bins = revolution.bins;
+    if(spokes == 0 || bins == 0)
+        return;
+
+    size_t stripes = std::min<size_t>(m_config.stripes, spokes);
+    m_stripeStart.resize(stripes+1);
+    for(size_t s = 0; s <= stripes; s++)
+        m_stripeStart[s] = s*spokes/stripes;
+    m_parent.resize(spokes*bins);
+    m_label.resize(spokes*bins);
+
+    {
+        const std::lock_guard<std::mutex> lock(m_poolMutex);
+        m_job = &revolution;
+        m_stripes = stripes;
+        m_pending = m_workers.size();
+        m_generation++;
+    }
+    m_start.notify_all();
+    labelStripe(revolution, 0);
+    {
+        std::unique_lock<std::mutex> lock(m_poolMutex);
+        m_done.wait(lock, [this]{ return m_pending == 0; });
+        m_job = nullptr;
+    }
+
+    m_partialOffset.resize(stripes);
+    uint32_t count = 0;
+    for(size_t s = 0; s < stripes; s++)
+    {
+        m_partialOffset[s] = count;
+        count += m_stripePartials[s].size();
+    }
+    m_partialParent.resize(count);
+    for(uint32_t p = 0; p < count; p++)
+        m_partialParent[p] = p;
+
+    for(size_t s = 0; s + 1 < stripes; s++)
+        joinRows(revolution, s, s+1, false);
+    // the segments joined so far never cross north
+    m_partialSegment.resize(count);
+    for(uint32_t p = 0; p < count; p++)
+        m_partialSegment[p] = findPartial(p);
+    m_seamSides.assign(count, 0);
+    joinRows(revolution, stripes-1, 0, true);
+
+    // a blob joined across north is summed with the segments reaching it
+    // from row 0 moved up a turn, however far round they go, so the
+    // centroid and extents do not straddle the wrap; a segment reaching both
+    // sides goes all the way round and stays
+    m_blobs.assign(count, Partial());
+    for(size_t s = 0; s < stripes; s++)
+    {
+        for(size_t i = 0; i < m_stripePartials[s].size(); i++)
+        {
+            Partial const &part = m_stripePartials[s][i];
+            uint32_t root = findPartial(m_partialOffset[s] + i);
+            uint64_t shift = m_seamSides[m_partialSegment[m_partialOffset[s] + i]] == SEAM_LOW ? spokes : 0;
+            Partial &blob = m_blobs[root];
+            blob.cells += part.cells;
+            blob.weight += part.weight;
+            blob.rowSum += part.rowSum + shift*part.weight;
+            blob.binSum += part.binSum;
+            blob.minRow = std::min<uint16_t>(blob.minRow, part.minRow + shift);
+            blob.maxRow = std::max<uint16_t>(blob.maxRow, part.maxRow + shift);
+            blob.minBin = std::min(blob.minBin, part.minBin);
+            blob.maxBin = std::max(blob.maxBin, part.maxBin);
+            blob.peak = std::max(blob.peak, part.peak);
+        }
+    }
+
+    const double metersPerBin = revolution.range/bins;
+    for(uint32_t p = 0; p < count; p++)
+    {
+        Partial const &blob = m_blobs[p];
+        if(m_partialParent[p] != p || blob.cells < m_config.minimumCells)
+            continue;
+        double row = double(blob.rowSum)/blob.weight;
+        double angle = std::fmod(row*360.0/spokes, 360.0);
+        double range = (double(blob.binSum)/blob.weight + 0.5)*metersPerBin;
+        double radians = angle*M_PI/180.0;
+
+        Contact c;
+        c.revolution = revolution.number;
+        c.angle = angle;
+        c.range = range;
+        c.x = range*std::sin(radians);
+        c.y = range*std::cos(radians);
+        c.firstRow = blob.minRow % spokes;
+        c.rows = blob.maxRow - blob.minRow + 1;
+        c.firstBin = blob.minBin;
+        c.lastBin = blob.maxBin;
+        c.cells = blob.cells;
+        c.peak = blob.peak;
+        contacts.push_back(c);
+    }
+}
+
+BlobStage::BlobStage(BlobConfig const &config, Callback callback, uint16_t spokes, uint16_t bins)
+    :m_extractor(config),m_callback(callback),m_assembler(spokes, bins)
+{
+}
+
+void BlobStage::process(std::vector<Scanline> &scanlines)
+{
+    for(auto const &s: scanlines)
+    {
+        if(m_assembler.add(s))
+        {
+            m_extractor.extract(m_assembler.completed(), m_contacts);
+            if(m_callback)
+                m_callback(m_assembler.completed(), m_contacts);
+        }
+    }
+}
+
+} // namespace halo_radar
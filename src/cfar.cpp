@@ -0,0 +1,171 @@
+#include "cfar.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "radar.h"
+
+namespace halo_radar
+{
+
+CfarDetector::CfarDetector(CfarConfig const &config):m_config(config)
+{
+    if(m_config.trainingCells == 0)
+        m_config.trainingCells = 1;
+}
+
+size_t CfarDetector::detect(const uint8_t *intensities, size_t bins, uint8_t *bitmap)
+{
+    if(m_config.type == CFAR_ORDERED_STATISTIC)
+        orderedStatistic(intensities, bins, bitmap);
+    else
+        cellAveraging(intensities, bins, bitmap);
+    size_t count = 0;
+    for(size_t i = 0; i < bins; i++)
+        count += bitmap[i];
+    return count;
+}
+
+void CfarDetector::cellAveraging(const uint8_t *intensities, size_t bins, uint8_t *bitmap)
+{
+    const long g = m_config.guardCells;
+    const long t = m_config.trainingCells;
+    const long n = bins;
+
+    // m_prefix[k] is the sum of the first k cells
+    m_prefix.resize(bins+1);
+    m_prefix[0] = 0;
+    for(long i = 0; i < n; i++)
+        m_prefix[i+1] = m_prefix[i] + intensities[i];
+    const int32_t *p = m_prefix.data();
+
+    auto scalar = [&](long i)
+    {
+        long left_end = std::max(0L, i - g);
+        long left_start = std::max(0L, i - g - t);
+        long right_start = std::min(n, i + g + 1);
+        long right_end = std::min(n, i + g + t + 1);
+        long count = (left_end - left_start) + (right_end - right_start);
+        int32_t sum = (p[left_end] - p[left_start]) + (p[right_end] - p[right_start]);
+        bool detected = intensities[i] >= m_config.minimumIntensity && count > 0 &&
+            intensities[i]*float(count) > m_config.scale*sum;
+        bitmap[i] = detected;
+    };
+
+    // interior, where both training windows are complete
+    long first = g + t;
+    long last = n - g - t - 1;
+    long i = 0;
+    for(; i < std::min(first, n); i++)
+        scalar(i);
+
+#ifdef __SSE2__
+    const __m128 k = _mm_set1_ps(m_config.scale/(2.0f*t));
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i minimum = _mm_set1_epi32(m_config.minimumIntensity - 1);
+    for(; i + 3 <= last; i += 4)
+    {
+        __m128i left_hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i - g));
+        __m128i left_lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i - g - t));
+        __m128i right_hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + g + t + 1));
+        __m128i right_lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + g + 1));
+        __m128i sum = _mm_add_epi32(_mm_sub_epi32(left_hi, left_lo), _mm_sub_epi32(right_hi, right_lo));
+        __m128 threshold = _mm_mul_ps(_mm_cvtepi32_ps(sum), k);
+
+        int32_t cells4;
+        memcpy(&cells4, intensities + i, 4);
+        __m128i cells = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(cells4), zero), zero);
+
+        __m128 above = _mm_cmpgt_ps(_mm_cvtepi32_ps(cells), threshold);
+        __m128i strong = _mm_cmpgt_epi32(cells, minimum);
+        int mask = _mm_movemask_ps(_mm_and_ps(above, _mm_castsi128_ps(strong)));
+        bitmap[i] = mask & 1;
+        bitmap[i+1] = (mask >> 1) & 1;
+        bitmap[i+2] = (mask >> 2) & 1;
+        bitmap[i+3] = (mask >> 3) & 1;
+    }
+#endif
+    for(; i < n; i++)
+        scalar(i);
+}
+
+void CfarDetector::orderedStatistic(const uint8_t *intensities, size_t bins, uint8_t *bitmap)
+{
+    const long g = m_config.guardCells;
+    const long t = m_config.trainingCells;
+    const long n = bins;
+
+    // histogram of the training cells around cell i, moved along the spoke
+    int histogram[16] = {0};
+    long count = 0;
+    auto add = [&](long j, int d)
+    {
+        if(j >= 0 && j < n)
+        {
+            histogram[intensities[j] & 0x0f] += d;
+            count += d;
+        }
+    };
+    for(long j = -g - t; j < -g; j++)
+        add(j, 1);
+    for(long j = g + 1; j <= g + t; j++)
+        add(j, 1);
+
+    for(long i = 0; i < n; i++)
+    {
+        if(i > 0)
+        {
+            // left window [i-g-t, i-g-1], right window [i+g+1, i+g+t]
+            add(i - g - t - 1, -1);
+            add(i - g - 1, 1);
+            add(i + g, -1);
+            add(i + g + t, 1);
+        }
+        bool detected = false;
+        if(count > 0 && intensities[i] >= m_config.minimumIntensity)
+        {
+            long k = std::min(count - 1, long(m_config.rank*count));
+            long seen = 0;
+            int statistic = 15;
+            for(int v = 0; v < 16; v++)
+            {
+                seen += histogram[v];
+                if(seen > k)
+                {
+                    statistic = v;
+                    break;
+                }
+            }
+            detected = intensities[i] > m_config.scale*statistic;
+        }
+        bitmap[i] = detected;
+    }
+}
+
+CfarStage::CfarStage(CfarConfig const &config, Callback callback):m_detector(config),m_callback(callback)
+{
+}
+
+void CfarStage::process(std::vector<Scanline> &scanlines)
+{
+    m_detections.clear();
+    for(auto const &s: scanlines)
+    {
+        m_bitmap.resize(s.intensities.size());
+        if(m_detector.detect(s.intensities.data(), s.intensities.size(), m_bitmap.data()) == 0)
+            continue;
+        uint16_t azimuth = std::lround(s.angle*4096.0/360.0) & 0x0fff;
+        for(size_t i = 0; i < m_bitmap.size(); i++)
+            if(m_bitmap[i])
+                m_detections.push_back({azimuth, uint16_t(i), s.intensities[i]});
+    }
+    if(m_callback)
+        m_callback(m_detections);
+}
+
+} // namespace halo_radar
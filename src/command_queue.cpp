@@ -0,0 +1,217 @@
+#include "command_queue.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace halo_radar
+{
+
+CommandQueue::CommandQueue(BatchSender sender, std::chrono::milliseconds window, std::chrono::milliseconds timeout, MetricLabels const &labels)
+    :m_sender(std::move(sender)),m_window(window),m_timeout(timeout)
+{
+    MetricsRegistry &metrics = MetricsRegistry::global();
+    m_submitted = metrics.counter("halo_radar_commands_submitted_total", "Control writes submitted.", labels);
+    m_coalesced = metrics.counter("halo_radar_commands_coalesced_total", "Control writes replaced by a later one before sending.", labels);
+    m_datagrams = metrics.counter("halo_radar_command_datagrams_total", "Command datagrams sent.", labels);
+    m_batches = metrics.counter("halo_radar_command_batches_total", "sendmmsg rounds for commands.", labels);
+    m_acknowledged = metrics.counter("halo_radar_commands_acknowledged_total", "Commands confirmed by a report.", labels);
+    m_timedOut = metrics.counter("halo_radar_commands_timed_out_total", "Commands no report confirmed in time.", labels);
+    m_roundTripSeconds = metrics.histogram("halo_radar_command_round_trip_seconds", "Time from sending a command to the report confirming it.", labels,
+                                           {0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0});
+
+    m_pending.reserve(std::size(commands));
+    m_inFlight.reserve(std::size(commands));
+    m_thread = std::thread(&CommandQueue::flushThread, this);
+}
+
+CommandQueue::~CommandQueue()
+{
+    {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        m_exitFlag = true;
+    }
+    m_wake.notify_all();
+    m_thread.join();
+}
+
+std::future<CommandResult> CommandQueue::submit(std::string const &key, std::string const &value)
+{
+    Pending p;
+    std::future<CommandResult> ret = p.promise.get_future();
+    p.descriptor = findCommand(key);
+    if(!p.descriptor || !encodeCommand(key, value, p.packets))
+    {
+        p.promise.set_value(CommandResult());
+        return ret;
+    }
+    p.value = value;
+    m_submitted->add();
+
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    for(auto &q: m_pending)
+        if(q.descriptor == p.descriptor)
+        {
+            // keeps its place and due time, so a steady stream of writes
+            // still goes out once per window
+            CommandResult superseded;
+            superseded.outcome = COMMAND_SUPERSEDED;
+            q.promise.set_value(superseded);
+            q.value = std::move(p.value);
+            q.packets = p.packets;
+            q.promise = std::move(p.promise);
+            m_coalesced->add();
+            return ret;
+        }
+    p.due = Clock::now() + m_window;
+    m_pending.push_back(std::move(p));
+    if(m_pending.size() == 1)
+        m_wake.notify_one();
+    return ret;
+}
+
+void CommandQueue::flush(std::unique_lock<std::mutex> &lock)
+{
+    if(m_pending.empty())
+        return;
+    std::vector<Pending> batch;
+    batch.swap(m_pending);
+    m_pending.reserve(batch.capacity());
+
+    // at most two datagrams per control
+    constexpr size_t max_datagrams = 2*std::size(commands);
+    mmsghdr messages[max_datagrams];
+    iovec iov[max_datagrams];
+    unsigned count = 0;
+    for(auto &p: batch)
+        for(int i = 0; i < p.packets.count; i++)
+        {
+            iov[count].iov_base = p.packets.data[i];
+            iov[count].iov_len = p.packets.size[i];
+            messages[count] = mmsghdr();
+            messages[count].msg_hdr.msg_iov = &iov[count];
+            messages[count].msg_hdr.msg_iovlen = 1;
+            count++;
+        }
+
+    lock.unlock();
+    auto sent_time = Clock::now();
+    int sent = m_sender(messages, count);
+    lock.lock();
+
+    m_batches->add();
+    m_datagrams->add(std::max(sent, 0));
+    int datagram = 0;
+    for(auto &p: batch)
+    {
+        datagram += p.packets.count;
+        if(datagram > sent)
+        {
+            CommandResult failed;
+            failed.outcome = COMMAND_SEND_FAILED;
+            p.promise.set_value(failed);
+            continue;
+        }
+        for(auto f = m_inFlight.begin(); f != m_inFlight.end(); ++f)
+            if(f->descriptor == p.descriptor)
+            {
+                CommandResult superseded;
+                superseded.outcome = COMMAND_SUPERSEDED;
+                f->promise.set_value(superseded);
+                m_inFlight.erase(f);
+                break;
+            }
+        InFlight f;
+        f.descriptor = p.descriptor;
+        f.value = std::move(p.value);
+        f.promise = std::move(p.promise);
+        f.sent = sent_time;
+        f.deadline = sent_time + m_timeout;
+        m_inFlight.push_back(std::move(f));
+    }
+}
+
+void CommandQueue::expire(Clock::time_point now)
+{
+    for(auto f = m_inFlight.begin(); f != m_inFlight.end();)
+    {
+        if(f->deadline > now)
+        {
+            ++f;
+            continue;
+        }
+        CommandResult timed_out;
+        timed_out.outcome = COMMAND_TIMED_OUT;
+        f->promise.set_value(timed_out);
+        m_timedOut->add();
+        f = m_inFlight.erase(f);
+    }
+}
+
+void CommandQueue::flushThread()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(!m_exitFlag)
+    {
+        auto now = Clock::now();
+        if(!m_pending.empty() && m_pending.front().due <= now)
+            flush(lock);
+        expire(now);
+
+        auto wake = Clock::time_point::max();
+        if(!m_pending.empty())
+            wake = m_pending.front().due;
+        for(auto const &f: m_inFlight)
+            wake = std::min(wake, f.deadline);
+        if(wake == Clock::time_point::max())
+            m_wake.wait(lock);
+        else
+            m_wake.wait_until(lock, wake);
+    }
+    flush(lock);
+    expire(Clock::time_point::max());
+}
+
+void CommandQueue::confirm(const ReportValue *values, int count)
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    if(m_inFlight.empty())
+        return;
+    auto now = Clock::now();
+    for(auto f = m_inFlight.begin(); f != m_inFlight.end();)
+    {
+        if(!reportConfirms(*f->descriptor, f->value, values, count))
+        {
+            ++f;
+            continue;
+        }
+        CommandResult acknowledged;
+        acknowledged.outcome = COMMAND_ACKNOWLEDGED;
+        acknowledged.roundTrip = now - f->sent;
+        f->promise.set_value(acknowledged);
+
+        double seconds = std::chrono::duration<double>(acknowledged.roundTrip).count();
+        m_roundTripSeconds->observe(seconds);
+        m_roundTripSum += seconds;
+        m_roundTripMax = std::max(m_roundTripMax, seconds);
+        m_acknowledged->add();
+        f = m_inFlight.erase(f);
+    }
+}
+
+CommandStatistics CommandQueue::statistics() const
+{
+    CommandStatistics ret;
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    ret.submitted = m_submitted->value();
+    ret.coalesced = m_coalesced->value();
+    ret.datagrams = m_datagrams->value();
+    ret.batches = m_batches->value();
+    ret.acknowledged = m_acknowledged->value();
+    ret.timedOut = m_timedOut->value();
+    if(ret.acknowledged)
+        ret.meanRoundTripSeconds = m_roundTripSum/ret.acknowledged;
+    ret.maxRoundTripSeconds = m_roundTripMax;
+    return ret;
+}
+
+} // namespace halo_radar
@@ -0,0 +1,125 @@
+#include "discovery_cache.h"
+
+#include <arpa/inet.h>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <cstdio>
+
+namespace halo_radar
+{
+
+namespace
+{
+
+std::string endpointToString(IPAddress const &a)
+{
+    return ipAddressToString(a.address) + ":" + std::to_string(ntohs(a.port));
+}
+
+bool endpointFromString(std::string const &s, IPAddress &a)
+{
+    auto colon = s.find(':');
+    if(colon == std::string::npos)
+        return false;
+    try
+    {
+        a.address = ipAddressFromString(s.substr(0, colon));
+        a.port = htons(std::stoi(s.substr(colon+1)));
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+bool sameAddresses(AddressSet const &a, AddressSet const &b)
+{
+    return a.interface == b.interface &&
+        a.data.address == b.data.address && a.data.port == b.data.port &&
+        a.report.address == b.report.address && a.report.port == b.report.port &&
+        a.send.address == b.send.address && a.send.port == b.send.port;
+}
+
+DiscoveryCache::DiscoveryCache(std::string const &path):m_path(path)
+{
+}
+
+bool DiscoveryCache::load()
+{
+    std::ifstream in(m_path);
+    if(!in)
+        return false;
+    std::vector<AddressSet> sets;
+    std::string line;
+    while(std::getline(in, line))
+    {
+        if(line.empty() || line[0] == '#')
+            continue;
+        std::istringstream iss(line);
+        AddressSet a;
+        std::string interface, data, report, send;
+        // unquoted words still read, as older caches wrote them
+        if(!(iss >> std::quoted(a.serialno) >> interface >> std::quoted(a.label) >> data >> report >> send))
+            continue;
+        if(a.serialno == "-")
+            a.serialno.clear();
+        a.interface = ipAddressFromString(interface);
+        if(!endpointFromString(data, a.data) || !endpointFromString(report, a.report) || !endpointFromString(send, a.send))
+            continue;
+        sets.push_back(a);
+    }
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    m_sets = sets;
+    return !m_sets.empty();
+}
+
+bool DiscoveryCache::save() const
+{
+    std::string tmp = m_path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        if(!out)
+            return false;
+        out << "# serialno interface label data report send\n";
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        for(auto const &a: m_sets)
+            out << std::quoted(a.serialno.empty() ? "-" : a.serialno) << " " << ipAddressToString(a.interface) << " " << std::quoted(a.label) << " "
+                << endpointToString(a.data) << " " << endpointToString(a.report) << " " << endpointToString(a.send) << "\n";
+        if(!out.flush())
+            return false;
+    }
+    return std::rename(tmp.c_str(), m_path.c_str()) == 0;
+}
+
+std::vector<AddressSet> DiscoveryCache::addressSets() const
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    return m_sets;
+}
+
+bool DiscoveryCache::update(std::vector<AddressSet> const &sets)
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<AddressSet> updated;
+    for(auto const &old: m_sets)
+    {
+        bool replaced = std::any_of(sets.begin(), sets.end(), [&](AddressSet const &a)
+            { return a.label == old.label; });
+        if(!replaced)
+            updated.push_back(old);
+    }
+    updated.insert(updated.end(), sets.begin(), sets.end());
+
+    bool changed = updated.size() != m_sets.size();
+    for(size_t i = 0; !changed && i < updated.size(); i++)
+        changed = !sameAddresses(updated[i], m_sets[i]) || updated[i].label != m_sets[i].label || updated[i].serialno != m_sets[i].serialno;
+    m_sets = updated;
+    return changed;
+}
+
+} // namespace halo_radar
@@ -0,0 +1,128 @@
+#include "interference_filter.h"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace halo_radar
+{
+
+InterferenceFilter::InterferenceFilter(uint8_t margin, uint16_t spokes):
+    m_margin(margin),
+    // one step, with room for the jitter of the reported angles
+    m_maxGap(1.5f*360.0f/std::max<uint16_t>(spokes, 1))
+{
+    m_previous.intensities.reserve(1024);
+    m_current.intensities.reserve(1024);
+    m_next.intensities.reserve(1024);
+}
+
+bool InterferenceFilter::adjacent(float a, float b) const
+{
+    float gap = std::fabs(a - b);
+    return std::min(gap, 360.0f - gap) <= m_maxGap;
+}
+
+size_t InterferenceFilter::filter(uint8_t *out)
+{
+    const uint8_t *c = m_current.intensities.data();
+    const size_t n = m_current.intensities.size();
+    if(m_previous.intensities.size() != n || m_next.intensities.size() != n ||
+       m_previous.range != m_current.range || m_next.range != m_current.range ||
+       !adjacent(m_previous.angle, m_current.angle) || !adjacent(m_next.angle, m_current.angle))
+    {
+        std::copy(c, c + n, out);
+        return 0;
+    }
+    const uint8_t *p = m_previous.intensities.data();
+    const uint8_t *x = m_next.intensities.data();
+
+    size_t replaced = 0;
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i margin = _mm_set1_epi8(m_margin);
+    for(; i + 16 <= n; i += 16)
+    {
+        __m128i vp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        __m128i vc = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c + i));
+        __m128i vx = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+        // median of three when c is the largest
+        __m128i neighbour = _mm_max_epu8(vp, vx);
+        __m128i limit = _mm_adds_epu8(neighbour, margin);
+        __m128i keep = _mm_cmpeq_epi8(_mm_subs_epu8(vc, limit), zero);
+        __m128i result = _mm_or_si128(_mm_and_si128(keep, vc), _mm_andnot_si128(keep, neighbour));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), result);
+        replaced += __builtin_popcount(~_mm_movemask_epi8(keep) & 0xffff);
+    }
+#endif
+    for(; i < n; i++)
+    {
+        uint8_t neighbour = std::max(p[i], x[i]);
+        if(c[i] > neighbour + m_margin)
+        {
+            out[i] = neighbour;
+            replaced++;
+        }
+        else
+            out[i] = c[i];
+    }
+    return replaced;
+}
+
+void InterferenceFilter::process(std::vector<Scanline> &scanlines)
+{
+    size_t replaced = 0;
+    size_t cells = 0;
+    size_t emitted = 0;
+    for(size_t k = 0; k < scanlines.size(); k++)
+    {
+        Scanline &s = scanlines[k];
+        m_next.angle = s.angle;
+        m_next.range = s.range;
+        m_next.rangeDecimation = s.rangeDecimation;
+        m_next.intensities.assign(s.intensities.begin(), s.intensities.end());
+        m_next.doppler.assign(s.doppler.begin(), s.doppler.end());
+
+        if(!m_primed)
+        {
+            // nothing to give back yet, the first spoke is its own
+            // previous neighbour
+            m_previous = m_next;
+            std::swap(m_current, m_next);
+            m_primed = true;
+            continue;
+        }
+
+        Scanline &o = scanlines[emitted++];
+        o.angle = m_current.angle;
+        o.range = m_current.range;
+        o.rangeDecimation = m_current.rangeDecimation;
+        o.doppler.assign(m_current.doppler.begin(), m_current.doppler.end());
+        o.intensities.resize(m_current.intensities.size());
+        replaced += filter(o.intensities.data());
+        cells += m_current.intensities.size();
+
+        std::swap(m_previous, m_current);
+        std::swap(m_current, m_next);
+    }
+    scanlines.resize(emitted);
+
+    m_spokes.fetch_add(emitted, std::memory_order_relaxed);
+    m_cells.fetch_add(cells, std::memory_order_relaxed);
+    m_replacedCells.fetch_add(replaced, std::memory_order_relaxed);
+}
+
+InterferenceStatistics InterferenceFilter::take()
+{
+    InterferenceStatistics ret;
+    ret.spokes = m_spokes.exchange(0);
+    ret.cells = m_cells.exchange(0);
+    ret.replacedCells = m_replacedCells.exchange(0);
+    return ret;
+}
+
+} // namespace halo_radar
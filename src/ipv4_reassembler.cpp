@@ -0,0 +1,98 @@
+#include "ipv4_reassembler.h"
+
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <cstring>
+
+namespace halo_radar
+{
+
+Ipv4Reassembler::Ipv4Reassembler():m_fragments(slots)
+{
+    for(auto &f: m_fragments)
+        f.data.resize(65536);
+}
+
+bool Ipv4Reassembler::addFrame(const uint8_t *frame, uint32_t length, const uint8_t *&payload, int &size)
+{
+    if(length < sizeof(ether_header))
+        return false;
+    uint16_t type;
+    memcpy(&type, frame + offsetof(ether_header, ether_type), sizeof(type));
+    if(type != htons(ETHERTYPE_IP))
+        return false;
+    return add(frame + sizeof(ether_header), length - sizeof(ether_header), payload, size);
+}
+
+bool Ipv4Reassembler::add(const uint8_t *ip, uint32_t captured, const uint8_t *&payload, int &size)
+{
+    if(captured < sizeof(iphdr))
+        return false;
+    const iphdr *header = reinterpret_cast<const iphdr*>(ip);
+    uint32_t header_length = header->ihl*4;
+    uint32_t total = ntohs(header->tot_len);
+    if(header_length < sizeof(iphdr) || total < header_length || total > captured)
+        return false;
+    uint16_t fragment = ntohs(header->frag_off);
+    const uint8_t *data = ip + header_length;
+    uint32_t length = total - header_length;
+    if((fragment & (IP_MF | IP_OFFMASK)) == 0)
+        return udpPayload(data, length, payload, size);
+
+    uint32_t offset = (fragment & IP_OFFMASK)*8;
+    Fragments *slot = nullptr;
+    Fragments *oldest = &m_fragments[0];
+    for(auto &f: m_fragments)
+    {
+        if(f.used && f.source == header->saddr && f.id == header->id)
+        {
+            slot = &f;
+            break;
+        }
+        if(!f.used || (oldest->used && f.touched < oldest->touched))
+            oldest = &f;
+    }
+    if(!slot)
+    {
+        slot = oldest;
+        slot->used = true;
+        slot->source = header->saddr;
+        slot->id = header->id;
+        slot->received = 0;
+        slot->total = 0;
+    }
+    slot->touched = ++m_clock;
+    if(offset + length > slot->data.size())
+    {
+        slot->used = false;
+        return false;
+    }
+    memcpy(slot->data.data() + offset, data, length);
+    slot->received += length;
+    if(!(fragment & IP_MF))
+        slot->total = offset + length;
+    if(slot->total == 0 || slot->received < slot->total)
+        return false;
+    // complete, or overlapping fragments which are not worth untangling
+    slot->used = false;
+    return slot->received == slot->total && udpPayload(slot->data.data(), slot->total, payload, size);
+}
+
+bool Ipv4Reassembler::udpPayload(const uint8_t *datagram, uint32_t length, const uint8_t *&payload, int &size)
+{
+    if(length < sizeof(udphdr))
+        return false;
+    const udphdr *header = reinterpret_cast<const udphdr*>(datagram);
+    if(m_port && header->dest != m_port)
+        return false;
+    uint32_t udp_length = ntohs(header->len);
+    if(udp_length < sizeof(udphdr) || udp_length > length)
+        return false;
+    payload = datagram + sizeof(udphdr);
+    size = udp_length - sizeof(udphdr);
+    return true;
+}
+
+} // namespace halo_radar
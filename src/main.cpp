@@ -44,7 +44,7 @@ int main(int argc, char** argv)
     }
 
     // Start scanning for radars
-    std::vector<halo_radar::AddressSet> addressSets = halo_radar::scan(logger);
+    std::vector<halo_radar::AddressSet> addressSets = halo_radar::scan(logger, true);
 
     if (addressSets.empty()) {
         LOG_CRITICAL(logger, "No radars found! Exiting.");
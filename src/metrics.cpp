@@ -0,0 +1,350 @@
+#include "metrics.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <poll.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <sstream>
+
+namespace halo_radar
+{
+
+namespace
+{
+
+std::atomic<size_t> next_shard{0};
+
+std::string renderLabels(MetricLabels const &labels)
+{
+    if(labels.empty())
+        return std::string();
+    std::string ret = "{";
+    for(auto const &l: labels)
+    {
+        if(ret.size() > 1)
+            ret += ",";
+        ret += l.first + "=\"";
+        for(char c: l.second)
+        {
+            if(c == '\\' || c == '"')
+                ret += '\\';
+            if(c == '\n')
+                ret += "\\n";
+            else
+                ret += c;
+        }
+        ret += "\"";
+    }
+    return ret + "}";
+}
+
+// labels with le added, for histogram buckets
+std::string bucketLabels(std::string const &labels, std::string const &le)
+{
+    if(labels.empty())
+        return "{le=\"" + le + "\"}";
+    return labels.substr(0, labels.size() - 1) + ",le=\"" + le + "\"}";
+}
+
+std::string number(double v)
+{
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.9g", v);
+    return buffer;
+}
+
+void atomicAdd(std::atomic<double> &a, double v)
+{
+    double old = a.load(std::memory_order_relaxed);
+    while(!a.compare_exchange_weak(old, old + v, std::memory_order_relaxed))
+        ;
+}
+
+} // namespace
+
+size_t metricShard()
+{
+    thread_local size_t shard = next_shard.fetch_add(1, std::memory_order_relaxed) % metric_shards;
+    return shard;
+}
+
+uint64_t Counter::value() const
+{
+    uint64_t ret = 0;
+    for(auto const &s: m_shards)
+        ret += s.value.load(std::memory_order_relaxed);
+    return ret;
+}
+
+Histogram::Histogram(std::vector<double> const &bounds):m_bounds(bounds)
+{
+    std::sort(m_bounds.begin(), m_bounds.end());
+    for(auto &s: m_shards)
+    {
+        s.counts.reset(new std::atomic<uint64_t>[m_bounds.size() + 1]);
+        for(size_t i = 0; i <= m_bounds.size(); i++)
+            s.counts[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void Histogram::observe(double v)
+{
+    // bucket i counts values up to m_bounds[i], the last one the rest
+    size_t i = std::lower_bound(m_bounds.begin(), m_bounds.end(), v) - m_bounds.begin();
+    Shard &s = m_shards[metricShard()];
+    s.counts[i].fetch_add(1, std::memory_order_relaxed);
+    atomicAdd(s.sum, v);
+}
+
+Histogram::Snapshot Histogram::snapshot() const
+{
+    Snapshot ret;
+    ret.cumulative.assign(m_bounds.size() + 1, 0);
+    for(auto const &s: m_shards)
+    {
+        for(size_t i = 0; i <= m_bounds.size(); i++)
+            ret.cumulative[i] += s.counts[i].load(std::memory_order_relaxed);
+        ret.sum += s.sum.load(std::memory_order_relaxed);
+    }
+    for(size_t i = 1; i <= m_bounds.size(); i++)
+        ret.cumulative[i] += ret.cumulative[i-1];
+    return ret;
+}
+
+std::vector<double> latencyBuckets()
+{
+    return {5e-6, 1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4, 1e-3, 2.5e-3, 5e-3, 1e-2, 2.5e-2, 5e-2, 0.1, 0.25};
+}
+
+MetricsRegistry &MetricsRegistry::global()
+{
+    static MetricsRegistry registry;
+    return registry;
+}
+
+MetricsRegistry::Family &MetricsRegistry::family(std::string const &name, std::string const &help, Type type)
+{
+    auto it = m_families.find(name);
+    if(it == m_families.end())
+    {
+        Family f;
+        f.help = help;
+        f.type = type;
+        it = m_families.emplace(name, f).first;
+    }
+    return it->second;
+}
+
+std::shared_ptr<Counter> MetricsRegistry::counter(std::string const &name, std::string const &help, MetricLabels const &labels)
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    Family &f = family(name, help, COUNTER);
+    std::string l = renderLabels(labels);
+    for(auto &s: f.series)
+        if(s.labels == l)
+        {
+            auto existing = s.counter.lock();
+            if(existing)
+                return existing;
+            s.counter = existing = std::make_shared<Counter>();
+            return existing;
+        }
+    auto c = std::make_shared<Counter>();
+    Series s;
+    s.labels = l;
+    s.counter = c;
+    f.series.push_back(s);
+    return c;
+}
+
+std::shared_ptr<Gauge> MetricsRegistry::gauge(std::string const &name, std::string const &help, MetricLabels const &labels)
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    Family &f = family(name, help, GAUGE);
+    std::string l = renderLabels(labels);
+    for(auto &s: f.series)
+        if(s.labels == l)
+        {
+            auto existing = s.gauge.lock();
+            if(existing)
+                return existing;
+            s.gauge = existing = std::make_shared<Gauge>();
+            return existing;
+        }
+    auto g = std::make_shared<Gauge>();
+    Series s;
+    s.labels = l;
+    s.gauge = g;
+    f.series.push_back(s);
+    return g;
+}
+
+std::shared_ptr<Histogram> MetricsRegistry::histogram(std::string const &name, std::string const &help, MetricLabels const &labels,
+                                                      std::vector<double> const &bounds)
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    Family &f = family(name, help, HISTOGRAM);
+    std::string l = renderLabels(labels);
+    for(auto &s: f.series)
+        if(s.labels == l)
+        {
+            auto existing = s.histogram.lock();
+            if(existing)
+                return existing;
+            s.histogram = existing = std::make_shared<Histogram>(bounds);
+            return existing;
+        }
+    auto h = std::make_shared<Histogram>(bounds);
+    Series s;
+    s.labels = l;
+    s.histogram = h;
+    f.series.push_back(s);
+    return h;
+}
+
+std::string MetricsRegistry::render()
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    std::ostringstream out;
+    for(auto &entry: m_families)
+    {
+        std::string const &name = entry.first;
+        Family &f = entry.second;
+        f.series.erase(std::remove_if(f.series.begin(), f.series.end(), [](Series const &s)
+                                      { return s.counter.expired() && s.gauge.expired() && s.histogram.expired(); }),
+                       f.series.end());
+        if(f.series.empty())
+            continue;
+
+        const char *type = f.type == COUNTER ? "counter" : (f.type == GAUGE ? "gauge" : "histogram");
+        out << "# HELP " << name << " " << f.help << "\n";
+        out << "# TYPE " << name << " " << type << "\n";
+        for(auto const &s: f.series)
+        {
+            if(auto c = s.counter.lock())
+                out << name << s.labels << " " << c->value() << "\n";
+            else if(auto g = s.gauge.lock())
+                out << name << s.labels << " " << number(g->value()) << "\n";
+            else if(auto h = s.histogram.lock())
+            {
+                auto snapshot = h->snapshot();
+                for(size_t i = 0; i < h->bounds().size(); i++)
+                    out << name << "_bucket" << bucketLabels(s.labels, number(h->bounds()[i])) << " " << snapshot.cumulative[i] << "\n";
+                out << name << "_bucket" << bucketLabels(s.labels, "+Inf") << " " << snapshot.cumulative.back() << "\n";
+                out << name << "_sum" << s.labels << " " << number(snapshot.sum) << "\n";
+                out << name << "_count" << s.labels << " " << snapshot.cumulative.back() << "\n";
+            }
+        }
+    }
+    return out.str();
+}
+
+MetricsServer::MetricsServer(MetricsRegistry &registry):m_registry(registry)
+{
+}
+
+MetricsServer::~MetricsServer()
+{
+    stop();
+}
+
+bool MetricsServer::start(uint32_t address, uint16_t port)
+{
+    stop();
+    m_socket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(m_socket < 0)
+        return false;
+    int one = 1;
+    setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in bind_address;
+    memset(&bind_address, 0, sizeof(bind_address));
+    bind_address.sin_family = AF_INET;
+    bind_address.sin_addr.s_addr = address;
+    bind_address.sin_port = htons(port);
+    if(bind(m_socket, (sockaddr*)&bind_address, sizeof(bind_address)) < 0 || listen(m_socket, 8) < 0)
+    {
+        int e = errno;
+        close(m_socket);
+        m_socket = -1;
+        errno = e;
+        return false;
+    }
+    m_exitFlag = false;
+    m_thread = std::thread(&MetricsServer::serverThread, this);
+    return true;
+}
+
+void MetricsServer::stop()
+{
+    m_exitFlag = true;
+    if(m_thread.joinable())
+        m_thread.join();
+    if(m_socket >= 0)
+        close(m_socket);
+    m_socket = -1;
+}
+
+void MetricsServer::serverThread()
+{
+    while(!m_exitFlag)
+    {
+        pollfd p;
+        p.fd = m_socket;
+        p.events = POLLIN;
+        if(poll(&p, 1, 200) <= 0)
+            continue;
+        int client = accept4(m_socket, nullptr, nullptr, SOCK_CLOEXEC);
+        if(client < 0)
+            continue;
+        handle(client);
+        close(client);
+    }
+}
+
+void MetricsServer::handle(int client)
+{
+    // scrapers send a small GET, don't let a stuck one hold the thread
+    timeval timeout = {1, 0};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    char request[2048];
+    size_t used = 0;
+    while(used < sizeof(request) - 1)
+    {
+        ssize_t n = recv(client, request + used, sizeof(request) - 1 - used, 0);
+        if(n <= 0)
+            break;
+        used += n;
+        request[used] = 0;
+        if(strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+            break;
+    }
+    request[used] = 0;
+
+    std::string response;
+    if(strncmp(request, "GET /metrics", 12) == 0 || strncmp(request, "GET / ", 6) == 0)
+    {
+        std::string body = m_registry.render();
+        response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+            std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+    }
+    else
+        response = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+    size_t sent = 0;
+    while(sent < response.size())
+    {
+        ssize_t n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if(n <= 0)
+            break;
+        sent += n;
+    }
+}
+
+} // namespace halo_radar
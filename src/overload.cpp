@@ -0,0 +1,56 @@
+#include "overload.h"
+
+namespace halo_radar
+{
+
+const char *overloadLevelName(OverloadLevel level)
+{
+    switch(level)
+    {
+        case OVERLOAD_NONE:
+            return "none";
+        case OVERLOAD_SKIP_OPTIONAL:
+            return "skip_optional";
+        case OVERLOAD_HALF_RANGE:
+            return "half_range";
+        case OVERLOAD_HALF_AZIMUTH:
+            return "half_azimuth";
+    }
+    return "unknown";
+}
+
+OverloadController::OverloadController(OverloadConfig const &config):m_config(config)
+{
+}
+
+bool OverloadController::update(double backlog, Clock::time_point now)
+{
+    if(!m_config.enabled)
+        return false;
+    if(backlog >= m_config.highWatermark)
+    {
+        m_low = false;
+        if(m_level >= m_config.maxLevel || now - m_changed < m_config.raiseInterval)
+            return false;
+        m_level = OverloadLevel(m_level + 1);
+        m_changed = now;
+        return true;
+    }
+    if(backlog >= m_config.lowWatermark)
+    {
+        m_low = false;
+        return false;
+    }
+    if(!m_low)
+    {
+        m_low = true;
+        m_lowSince = now;
+    }
+    if(m_level == OVERLOAD_NONE || now - m_lowSince < m_config.lowerHold || now - m_changed < m_config.lowerHold)
+        return false;
+    m_level = OverloadLevel(m_level - 1);
+    m_changed = now;
+    return true;
+}
+
+} // namespace halo_radar
@@ -0,0 +1,220 @@
+#include "packet_ring.h"
+
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <linux/filter.h>
+#include <unistd.h>
+#include <poll.h>
+#include <cerrno>
+#include <cstring>
+
+#include "thread_utils.h"
+
+namespace halo_radar
+{
+
+PacketRing::PacketRing(PacketRingConfig const &config):m_config(config)
+{
+}
+
+PacketRing::~PacketRing()
+{
+    close();
+}
+
+bool PacketRing::open(uint32_t interface, uint32_t group, uint16_t port)
+{
+    close();
+    m_reassembler.setPort(port);
+    int index = interfaceIndex(interface);
+    if(index <= 0)
+    {
+        errno = ENODEV;
+        return false;
+    }
+
+    // protocol 0 receives nothing until bind, so no unfiltered frames get in
+    m_socket = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, 0);
+    if(m_socket < 0)
+        return false;
+
+    // IPv4 UDP to group, first fragments and whole datagrams also to port;
+    // later fragments have no UDP header and are kept on the group alone
+    sock_filter code[] = {
+        {BPF_LD | BPF_H | BPF_ABS, 0, 0, 12},
+        {BPF_JMP | BPF_JEQ | BPF_K, 0, 10, ETH_P_IP},
+        {BPF_LD | BPF_W | BPF_ABS, 0, 0, 30},
+        {BPF_JMP | BPF_JEQ | BPF_K, 0, 8, ntohl(group)},
+        {BPF_LD | BPF_B | BPF_ABS, 0, 0, 23},
+        {BPF_JMP | BPF_JEQ | BPF_K, 0, 6, IPPROTO_UDP},
+        {BPF_LD | BPF_H | BPF_ABS, 0, 0, 20},
+        {BPF_JMP | BPF_JSET | BPF_K, 3, 0, 0x1fff},
+        {BPF_LDX | BPF_B | BPF_MSH, 0, 0, 14},
+        {BPF_LD | BPF_H | BPF_IND, 0, 0, 16},
+        {BPF_JMP | BPF_JEQ | BPF_K, 0, 1, ntohs(port)},
+        {BPF_RET | BPF_K, 0, 0, 0x40000},
+        {BPF_RET | BPF_K, 0, 0, 0},
+    };
+    sock_fprog filter;
+    filter.len = sizeof(code)/sizeof(code[0]);
+    filter.filter = code;
+
+    int version = TPACKET_V3;
+    tpacket_req3 req;
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = m_config.blockSize;
+    req.tp_block_nr = m_config.blockCount;
+    req.tp_frame_size = TPACKET_ALIGNMENT << 7;
+    req.tp_frame_nr = size_t(req.tp_block_size)*req.tp_block_nr/req.tp_frame_size;
+    req.tp_retire_blk_tov = m_config.retireMilliseconds;
+    int one = 1;
+    if(setsockopt(m_socket, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)) < 0 ||
+       setsockopt(m_socket, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0 ||
+       setsockopt(m_socket, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+    {
+        int e = errno;
+        close();
+        errno = e;
+        return false;
+    }
+    // on loopback each datagram would otherwise show up twice; not every
+    // kernel has it, and only loopback needs it
+#ifdef PACKET_IGNORE_OUTGOING
+    setsockopt(m_socket, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+#endif
+
+    m_ringSize = size_t(req.tp_block_size)*req.tp_block_nr;
+    void *ring = mmap(nullptr, m_ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_socket, 0);
+    if(ring == MAP_FAILED)
+    {
+        int e = errno;
+        m_ringSize = 0;
+        close();
+        errno = e;
+        return false;
+    }
+    m_ring = reinterpret_cast<uint8_t*>(ring);
+
+    sockaddr_ll address;
+    memset(&address, 0, sizeof(address));
+    address.sll_family = AF_PACKET;
+    address.sll_protocol = htons(ETH_P_IP);
+    address.sll_ifindex = index;
+    if(bind(m_socket, (sockaddr*)&address, sizeof(address)) < 0)
+    {
+        int e = errno;
+        close();
+        errno = e;
+        return false;
+    }
+
+    // an unbound UDP socket joins the group for IGMP but receives nothing
+    m_joinSocket = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+    ip_mreq mreq;
+    mreq.imr_interface.s_addr = interface;
+    mreq.imr_multiaddr.s_addr = group;
+    if(m_joinSocket < 0 || setsockopt(m_joinSocket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+    {
+        int e = errno;
+        close();
+        errno = e;
+        return false;
+    }
+
+    m_block = 0;
+    m_current = nullptr;
+    m_remaining = 0;
+    return true;
+}
+
+void PacketRing::close()
+{
+    if(m_ring)
+        munmap(m_ring, m_ringSize);
+    m_ring = nullptr;
+    m_ringSize = 0;
+    if(m_socket >= 0)
+        ::close(m_socket);
+    m_socket = -1;
+    if(m_joinSocket >= 0)
+        ::close(m_joinSocket);
+    m_joinSocket = -1;
+    m_current = nullptr;
+}
+
+void PacketRing::releaseBlock()
+{
+    __atomic_store_n(&m_current->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    m_current = nullptr;
+    m_block = (m_block + 1) % m_config.blockCount;
+}
+
+bool PacketRing::next(const uint8_t *&payload, int &size, int timeoutMilliseconds)
+{
+    if(!m_ring)
+        return false;
+    while(true)
+    {
+        if(!m_current)
+        {
+            auto *block = reinterpret_cast<tpacket_block_desc*>(m_ring + size_t(m_block)*m_config.blockSize);
+            if(!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+            {
+                pollfd p;
+                p.fd = m_socket;
+                p.events = POLLIN | POLLERR;
+                p.revents = 0;
+                if(poll(&p, 1, timeoutMilliseconds) <= 0)
+                    return false;
+                if(!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+                    return false;
+            }
+            m_current = block;
+            m_remaining = block->hdr.bh1.num_pkts;
+            m_frame = reinterpret_cast<tpacket3_hdr*>(reinterpret_cast<uint8_t*>(block) + block->hdr.bh1.offset_to_first_pkt);
+        }
+        while(m_remaining > 0)
+        {
+            tpacket3_hdr *frame = m_frame;
+            m_remaining--;
+            m_frame = reinterpret_cast<tpacket3_hdr*>(reinterpret_cast<uint8_t*>(frame) + frame->tp_next_offset);
+            // tp_snaplen counts from the link header
+            if(frame->tp_net >= frame->tp_mac &&
+               m_reassembler.add(reinterpret_cast<const uint8_t*>(frame) + frame->tp_net, frame->tp_snaplen - (frame->tp_net - frame->tp_mac), payload, size))
+                return true;
+        }
+        releaseBlock();
+    }
+}
+
+double PacketRing::backlog() const
+{
+    if(!m_ring)
+        return 0.0;
+    // the kernel fills blocks in order, so the ready ones follow ours
+    uint32_t ready = 0;
+    uint32_t block = m_current ? (m_block + 1) % m_config.blockCount : m_block;
+    while(ready < m_config.blockCount)
+    {
+        auto *b = reinterpret_cast<tpacket_block_desc*>(m_ring + size_t(block)*m_config.blockSize);
+        if(!(__atomic_load_n(&b->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+            break;
+        ready++;
+        block = (block + 1) % m_config.blockCount;
+    }
+    return double(ready)/m_config.blockCount;
+}
+
+uint64_t PacketRing::takeDrops()
+{
+    tpacket_stats_v3 stats;
+    socklen_t len = sizeof(stats);
+    // reading the statistics resets them
+    if(m_socket < 0 || getsockopt(m_socket, SOL_PACKET, PACKET_STATISTICS, &stats, &len) < 0)
+        return 0;
+    return stats.tp_drops;
+}
+
+} // namespace halo_radar
@@ -0,0 +1,98 @@
+#include "persistence_filter.h"
+
+#include <cstring>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "radar.h"
+#include "revolution.h"
+
+namespace halo_radar
+{
+
+PersistenceFilter::PersistenceFilter(PersistenceConfig const &config):m_config(config)
+{
+    // past 4 the gain 16/2^k would round to nothing
+    m_config.decayShift = std::min<uint8_t>(std::max<uint8_t>(m_config.decayShift, 1), 4);
+    m_image.assign(size_t(m_config.spokes)*m_config.bins, 0);
+}
+
+void PersistenceFilter::clear()
+{
+    std::fill(m_image.begin(), m_image.end(), 0);
+}
+
+void PersistenceFilter::update(float angle, const uint8_t *intensities, size_t count, uint8_t *out)
+{
+    const int k = m_config.decayShift;
+    const int gain = 16 >> k;
+    uint8_t *p = m_image.data() + RevolutionAssembler::row(angle, m_config.spokes)*m_config.bins;
+    size_t n = std::min<size_t>(count, m_config.bins);
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i shift = _mm_cvtsi32_si128(k);
+    const __m128i g = _mm_set1_epi16(gain);
+    const __m128i fifteen = _mm_set1_epi8(15);
+    for(; i + 16 <= n; i += 16)
+    {
+        __m128i old = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(intensities + i));
+
+        __m128i lo = _mm_unpacklo_epi8(old, zero);
+        __m128i hi = _mm_unpackhi_epi8(old, zero);
+        lo = _mm_add_epi16(_mm_sub_epi16(lo, _mm_srl_epi16(lo, shift)), _mm_mullo_epi16(_mm_unpacklo_epi8(x, zero), g));
+        hi = _mm_add_epi16(_mm_sub_epi16(hi, _mm_srl_epi16(hi, shift)), _mm_mullo_epi16(_mm_unpackhi_epi8(x, zero), g));
+        __m128i updated = _mm_packus_epi16(lo, hi);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p + i), updated);
+
+        __m128i filtered = _mm_packus_epi16(_mm_srli_epi16(lo, 4), _mm_srli_epi16(hi, 4));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_min_epu8(filtered, fifteen));
+    }
+#endif
+    for(; i < n; i++)
+    {
+        int v = std::min(p[i] - (p[i] >> k) + intensities[i]*gain, 255);
+        p[i] = v;
+        out[i] = std::min(v >> 4, 15);
+    }
+    if(out != intensities && count > n)
+        memcpy(out + n, intensities + n, count - n);
+}
+
+PersistenceStage::PersistenceStage(PersistenceConfig const &config, Callback callback)
+    :m_filter(config),m_replace(config.replace),m_callback(callback)
+{
+}
+
+void PersistenceStage::process(std::vector<Scanline> &scanlines)
+{
+    for(auto &s: scanlines)
+    {
+        m_filtered.resize(s.intensities.size());
+        if(s.rangeDecimation > 1)
+        {
+            // the image stays at raw bins, filter there and take the
+            // stronger of each group back
+            const size_t d = s.rangeDecimation;
+            m_expanded.resize(s.intensities.size()*d);
+            for(size_t i = 0; i < m_expanded.size(); i++)
+                m_expanded[i] = s.intensities[i/d];
+            m_filter.update(s.angle, m_expanded.data(), m_expanded.size(), m_expanded.data());
+            for(size_t i = 0; i < m_filtered.size(); i++)
+                m_filtered[i] = *std::max_element(m_expanded.begin() + i*d, m_expanded.begin() + (i+1)*d);
+        }
+        else
+            m_filter.update(s.angle, s.intensities.data(), s.intensities.size(), m_filtered.data());
+        if(m_callback)
+            m_callback(s, m_filtered.data(), m_filtered.size());
+        if(m_replace)
+            std::copy(m_filtered.begin(), m_filtered.end(), s.intensities.begin());
+    }
+}
+
+} // namespace halo_radar
@@ -5,9 +5,19 @@
 #include <arpa/inet.h>
 #include <sstream>
 #include <cstring>
+#include <cstddef>
 #include <iostream>
 #include <unistd.h>
+#include <poll.h>
+#include <cerrno>
+#include <algorithm>
+#include <linux/sock_diag.h>
 #include "logger.h"
+#include "thread_utils.h"
+#include "spoke_codec.h"
+#include "packet_ring.h"
+#include "xdp_socket.h"
+#include "radar_protocol.h"
 
 namespace halo_radar
 {
@@ -44,67 +54,114 @@ uint32_t ipAddressFromString(const std::string &a)
     return inet_addr(a.c_str());
 }
 
-std::vector<AddressSet> scan(quill::Logger *logger)
+std::vector<AddressSet> addressSetsFromReport(RadarReport_b201 const &report, uint32_t interface)
 {
-    return scan(logger, getLocalAddresses());
+    std::string serialno(report.serialno, strnlen(report.serialno, sizeof(report.serialno)));
+    std::vector<AddressSet> ret;
+    AddressSet asa;
+    asa.label = "HaloA";
+    asa.data = report.addrDataA;
+    asa.send = report.addrSendA;
+    asa.report = report.addrReportA;
+    asa.interface = interface;
+    asa.serialno = serialno;
+    ret.push_back(asa);
+    AddressSet asb;
+    asb.label = "HaloB";
+    asb.data = report.addrDataB;
+    asb.send = report.addrSendB;
+    asb.report = report.addrReportB;
+    asb.interface = interface;
+    asb.serialno = serialno;
+    ret.push_back(asb);
+    return ret;
+}
+
+std::vector<AddressSet> scan(quill::Logger *logger, bool firstRadarOnly)
+{
+    return scan(logger, getLocalAddresses(), firstRadarOnly);
 }
 
-std::vector<AddressSet> scan(quill::Logger *logger, const std::vector<uint32_t> & addresses)
+std::vector<AddressSet> scan(quill::Logger *logger, const std::vector<uint32_t> & addresses, bool firstRadarOnly)
 {
     std::vector<AddressSet> ret;
+    scan(logger, addresses, std::chrono::seconds(3), [&](AddressSet const &a)
+    {
+        ret.push_back(a);
+        // each report carries the A and B address sets
+        return !firstRadarOnly || ret.size() < 2;
+    });
+    return ret;
+}
+
+void scan(quill::Logger *logger, const std::vector<uint32_t> &addresses, std::chrono::milliseconds timeout, ScanCallback const &callback)
+{
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    const std::chrono::milliseconds probe_interval(250);
+
+    uint8_t ma_bytes[] = {236,6,7,5};
+    uint32_t ma = *reinterpret_cast<uint32_t *>(ma_bytes);
+
+    // One listener joined on every interface, also catching b201 reports
+    // that were not asked for. IP_PKTINFO tells which interface a report
+    // arrived on.
+    int listen_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if(listen_sock < 0)
+    {
+        perror("socket");
+        return;
+    }
+    int one = 1;
+    if (setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&one, sizeof(one)) ||
+        setsockopt(listen_sock, IPPROTO_IP, IP_PKTINFO, (const char *)&one, sizeof(one)))
+    {
+        perror("listen socket options");
+        close(listen_sock);
+        return;
+    }
+    sockaddr_in listenAddress;
+    memset(&listenAddress, 0, sizeof(listenAddress));
+    listenAddress.sin_family = AF_INET;
+    listenAddress.sin_addr.s_addr = htonl(INADDR_ANY);
+    listenAddress.sin_port = htons(6878);
+    if (bind(listen_sock, (sockaddr *)&listenAddress, sizeof(listenAddress)) < 0)
+    {
+        perror("bind");
+        close(listen_sock);
+        return;
+    }
+
+    struct Probe
+    {
+        uint32_t interface;
+        int send_sock;
+        bool answered;
+        std::chrono::steady_clock::time_point next_probe;
+    };
+    std::vector<Probe> probes;
     for(auto a: addresses)
     {
         LOG_INFO(logger, "Local interface: {}", ipAddressToString(a));
-        int listen_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-        if(listen_sock < 0)
-        {
-            perror("socket");
-            continue;
-        }
-        int one = 1;
-        if (setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&one, sizeof(one)))
-        {
-            perror("reuse");
-            close(listen_sock);
-            continue;
-        }
-        timeval timeout;      
-        timeout.tv_sec = 1;
-        timeout.tv_usec = 0;
-        if (setsockopt (listen_sock, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout)) < 0)
-        {
-            perror("socket set timeout");
-            close(listen_sock);
-            continue;
-        }
-        sockaddr_in listenAddress;
-        memset(&listenAddress, 0, sizeof(listenAddress));
-        listenAddress.sin_family = AF_INET;
-        listenAddress.sin_addr.s_addr = htonl(INADDR_ANY);
-        listenAddress.sin_port = htons(6878);
-        if (bind(listen_sock, (sockaddr *)&listenAddress, sizeof(listenAddress)) < 0)
-        {
-            perror("bind");
-            close(listen_sock);
-            continue;
-        }
         ip_mreq mreq;
         mreq.imr_interface.s_addr = a;
-        in_addr ma;
-        uint8_t ma_bytes[] = {236,6,7,5};
-        ma.s_addr = *reinterpret_cast<uint32_t *>(ma_bytes);
-        mreq.imr_multiaddr = ma;
+        mreq.imr_multiaddr.s_addr = ma;
         if (setsockopt(listen_sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, (const char *)&mreq, sizeof(mreq)))
         {
             perror("multicast add membership");
-            close(listen_sock);
             continue;
         }
         int send_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-        if (setsockopt(send_sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&one, sizeof(one)))
+        if(send_sock < 0)
+        {
+            perror("socket");
+            continue;
+        }
+        in_addr multicast_interface;
+        multicast_interface.s_addr = a;
+        if (setsockopt(send_sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&one, sizeof(one)) ||
+            setsockopt(send_sock, IPPROTO_IP, IP_MULTICAST_IF, (const char *)&multicast_interface, sizeof(multicast_interface)))
         {
-            perror("reuse");
-            close(listen_sock);
+            perror("send socket options");
             close(send_sock);
             continue;
         }
@@ -115,60 +172,119 @@ std::vector<AddressSet> scan(quill::Logger *logger, const std::vector<uint32_t>
         if(bind(send_sock, (sockaddr *)&sendAddress, sizeof(sendAddress)) < 0)
         {
             perror("bind");
-            close(listen_sock);
-            close(send_sock);
-            continue;
-        }
-        uint16_t data = 0xb101;
-        
-        sendAddress.sin_addr.s_addr = ma.s_addr;
-        sendAddress.sin_port = htons(6878);
-        if(sendto(send_sock,&data,sizeof(data),0,(sockaddr*)&sendAddress,sizeof(sendAddress))!=sizeof(data))
-        {
-            perror("sendto");
-            close(listen_sock);
             close(send_sock);
             continue;
         }
-        
-        int count = 0;
-        while(count < 3)
+        probes.push_back({a, send_sock, false, std::chrono::steady_clock::now()});
+    }
+
+    // interface index to local address, to attribute received reports
+    std::map<int, uint32_t> interface_addresses;
+    ifaddrs *addr_list;
+    if (!getifaddrs(&addr_list))
+    {
+        for (ifaddrs * addr = addr_list; addr; addr = addr->ifa_next)
+            if(validInterface(addr))
+                interface_addresses[if_nametoindex(addr->ifa_name)] = ((sockaddr_in *)(addr->ifa_addr))->sin_addr.s_addr;
+        freeifaddrs(addr_list);
+    }
+
+    std::vector<std::pair<uint32_t, std::string> > found;
+    bool keep_going = !probes.empty();
+    while(keep_going)
+    {
+        auto now = std::chrono::steady_clock::now();
+        if(now >= deadline)
+            break;
+
+        auto wake = deadline;
+        for(auto &p: probes)
         {
-            uint8_t in_data[1024];
-            sockaddr_in from_addr;
-            unsigned int from_addr_len = sizeof(from_addr);
-            int nbytes = recvfrom(listen_sock,in_data,1024,0,(sockaddr*)&from_addr,&from_addr_len);
-            if(nbytes > 0)
+            if(p.answered)
+                continue;
+            if(now >= p.next_probe)
             {
-                LOG_INFO(logger, "Number of bytes recieved: {}, needs to be {} and start with b201", nbytes, sizeof(RadarReport_b201));
-                RadarReport_b201* b201 =  reinterpret_cast<RadarReport_b201*>(in_data);
-                if(nbytes >= 150 && b201->id == 0xb201) {
-                    AddressSet asa;
-                    asa.label = "HaloA";
-                    asa.data = b201->addrDataA;
-                    asa.send = b201->addrSendA;
-                    asa.report = b201->addrReportA;
-                    asa.interface = a;
-                    ret.push_back(asa);
-                    AddressSet asb;
-                    asb.label = "HaloB";
-                    asb.data = b201->addrDataB;
-                    asb.send = b201->addrSendB;
-                    asb.report = b201->addrReportB;
-                    asb.interface = a;
-                    ret.push_back(asb);
-                    break;
-                }
+                uint16_t data = 0xb101;
+                sockaddr_in sendAddress;
+                memset(&sendAddress, 0, sizeof(sendAddress));
+                sendAddress.sin_family = AF_INET;
+                sendAddress.sin_addr.s_addr = ma;
+                sendAddress.sin_port = htons(6878);
+                if(sendto(p.send_sock,&data,sizeof(data),0,(sockaddr*)&sendAddress,sizeof(sendAddress))!=sizeof(data))
+                    perror("sendto");
+                p.next_probe = now + probe_interval;
             }
-            count += 1;
+            wake = std::min(wake, p.next_probe);
         }
-        close(listen_sock);
-        close(send_sock);
-        if(!ret.empty())
+
+        pollfd pfd;
+        pfd.fd = listen_sock;
+        pfd.events = POLLIN;
+        int wait_ms = std::max<int>(0, std::chrono::duration_cast<std::chrono::milliseconds>(wake - now).count() + 1);
+        int ready = poll(&pfd, 1, wait_ms);
+        if(ready < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            perror("poll");
             break;
+        }
+        if(ready == 0)
+            continue;
+
+        uint8_t in_data[1024];
+        uint8_t control[CMSG_SPACE(sizeof(in_pktinfo))];
+        iovec iov;
+        iov.iov_base = in_data;
+        iov.iov_len = sizeof(in_data);
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        int nbytes = recvmsg(listen_sock, &msg, MSG_DONTWAIT);
+        if(nbytes <= 0)
+            continue;
+
+        RadarReport_b201* b201 =  reinterpret_cast<RadarReport_b201*>(in_data);
+        if(nbytes < 150 || b201->id != 0xb201)
+            continue;
+
+        uint32_t interface = 0;
+        for(cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+            if(cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO)
+            {
+                in_pktinfo *info = reinterpret_cast<in_pktinfo*>(CMSG_DATA(cmsg));
+                auto ia = interface_addresses.find(info->ipi_ifindex);
+                interface = ia != interface_addresses.end() ? ia->second : info->ipi_spec_dst.s_addr;
+            }
+        auto probe = std::find_if(probes.begin(), probes.end(), [&](Probe const &p){ return p.interface == interface; });
+        if(probe == probes.end())
+            continue;
+        probe->answered = true;
+
+        auto sets = addressSetsFromReport(*b201, interface);
+        auto key = std::make_pair(interface, sets.front().serialno);
+        if(std::find(found.begin(), found.end(), key) != found.end())
+            continue;
+        found.push_back(key);
+        LOG_INFO(logger, "Radar {} found on {} after {} ms", key.second, ipAddressToString(interface),
+            std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - (deadline - timeout)).count());
+
+        for(auto const &a: sets)
+            if(!callback(a))
+            {
+                keep_going = false;
+                break;
+            }
+        if(std::all_of(probes.begin(), probes.end(), [](Probe const &p){ return p.answered; }))
+            keep_going = false;
     }
-    
-    return ret;
+
+    for(auto &p: probes)
+        close(p.send_sock);
+    close(listen_sock);
 }
 
 std::string AddressSet::str() const
@@ -178,31 +294,99 @@ std::string AddressSet::str() const
     return ret.str();
 }
 
-Radar::Radar(AddressSet const &addresses):m_addresses(addresses),m_exitFlag(false)
+Radar::Radar(AddressSet const &addresses, RadarConfig const &config):m_addresses(addresses),m_config(config),m_exitFlag(false),m_overload(config.overload)
+{
+    openSendSocket();
+
+    MetricsRegistry &metrics = MetricsRegistry::global();
+    MetricLabels labels = {{"channel", m_addresses.label}};
+    m_packetCount = metrics.counter("halo_radar_packets_total", "Data packets received.", labels);
+    m_byteCount = metrics.counter("halo_radar_bytes_total", "Data bytes received.", labels);
+    m_spokeCount = metrics.counter("halo_radar_spokes_total", "Spokes decoded.", labels);
+    m_droppedScanlines = metrics.counter("halo_radar_dropped_spokes_total", "Valid spokes dropped for lack of a free scanline.", labels);
+    m_kernelDrops = metrics.counter("halo_radar_kernel_drops_total", "Data datagrams dropped by the kernel on a full socket buffer.", labels);
+    m_receiveBuffer = metrics.gauge("halo_radar_receive_buffer_bytes", "Data socket SO_RCVBUF as granted.", labels);
+    m_decodeSeconds = metrics.histogram("halo_radar_decode_seconds", "Time to unpack the spokes of a packet.", labels);
+    m_processDataSeconds = metrics.histogram("halo_radar_process_data_seconds", "Time spent in the processData callback per packet.", labels);
+    m_receiveBacklog = metrics.gauge("halo_radar_receive_backlog_ratio", "Share of the receive buffer or ring waiting to be read.", labels);
+    m_overloadGauge = metrics.gauge("halo_radar_overload_level", "Load shedding level, 0 for full fidelity, see OverloadLevel.", labels);
+    m_overloadTransitions = metrics.counter("halo_radar_overload_transitions_total", "Changes of the load shedding level.", labels);
+    m_commandQueue.reset(new CommandQueue([this](mmsghdr *messages, unsigned count) { return sendCommandBatch(messages, count); },
+                                          std::chrono::milliseconds(m_config.commandWindowMilliseconds),
+                                          std::chrono::milliseconds(m_config.commandTimeoutMilliseconds), labels));
+    m_subscriptions.reset(new SubscriptionHub(labels));
+
+    const int max_scanlines = sizeof(RawSector::lines)/sizeof(RawScanline);
+    m_scanlines.reserve(max_scanlines);
+    m_spareScanlines.resize(max_scanlines);
+    for(auto &s: m_spareScanlines)
+    {
+        s.intensities.reserve(sizeof(RawScanline::data)*2);
+        s.doppler.reserve(sizeof(RawScanline::data)*2);
+    }
+    
+    sendHeartbeat();
+}
+
+Radar::~Radar()
+{
+    {
+        const std::lock_guard<std::mutex> lock(m_exitFlagMutex);
+        m_exitFlag = true;
+    }
+    m_dataThread.join();
+    m_reportThread.join();
+    m_subscriptions.reset();
+    // sends what is still queued
+    m_commandQueue.reset();
+    close(m_sendSocket);
+}
+
+void Radar::openSendSocket()
 {
+    // called with m_addressMutex held, or from the constructor
     m_sendSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
     int one = 1;
     setsockopt(m_sendSocket, SOL_SOCKET, SO_REUSEADDR, (const char *)&one, sizeof(one));
     
     memset(&m_sendAddress, 0, sizeof(m_sendAddress));
     m_sendAddress.sin_family = AF_INET;
-    m_sendAddress.sin_addr.s_addr = addresses.interface;
+    m_sendAddress.sin_addr.s_addr = m_addresses.interface;
     bind(m_sendSocket, (sockaddr *)&m_sendAddress, sizeof(m_sendAddress));
     
-    m_sendAddress.sin_addr.s_addr = addresses.send.address;
-    m_sendAddress.sin_port = addresses.send.port;
-    
-    sendHeartbeat();
+    m_sendAddress.sin_addr.s_addr = m_addresses.send.address;
+    m_sendAddress.sin_port = m_addresses.send.port;
 }
 
-Radar::~Radar()
+AddressSet Radar::addresses() const
+{
+    const std::lock_guard<std::mutex> lock(m_addressMutex);
+    return m_addresses;
+}
+
+void Radar::updateAddresses(AddressSet const &addresses)
 {
     {
-        const std::lock_guard<std::mutex> lock(m_exitFlagMutex);
-        m_exitFlag = true;
+        const std::lock_guard<std::mutex> lock(m_addressMutex);
+        bool interface_changed = addresses.interface != m_addresses.interface;
+        m_addresses.data = addresses.data;
+        m_addresses.send = addresses.send;
+        m_addresses.report = addresses.report;
+        m_addresses.interface = addresses.interface;
+        m_addresses.serialno = addresses.serialno;
+        if(interface_changed)
+        {
+            close(m_sendSocket);
+            openSendSocket();
+        }
+        else
+        {
+            m_sendAddress.sin_addr.s_addr = m_addresses.send.address;
+            m_sendAddress.sin_port = m_addresses.send.port;
+        }
     }
-    m_dataThread.join();
-    m_reportThread.join();
+    m_addressGeneration++;
+    sendHeartbeat();
 }
 
 void Radar::startThreads()
@@ -211,6 +395,195 @@ void Radar::startThreads()
     m_reportThread = std::thread(&Radar::reportThread,this);
 }
 
+std::vector<ThreadReport> Radar::threadReports() const
+{
+    const std::lock_guard<std::mutex> lock(m_threadReportMutex);
+    return {m_dataThreadReport, m_reportThreadReport};
+}
+
+void Radar::setupThread(std::string const &name, std::vector<int> const &cpus, int priority, ThreadReport &report)
+{
+    bool affinityApplied = cpus.empty() || setCurrentThreadAffinity(cpus);
+    if(!affinityApplied)
+        std::cerr << name << " could not pin thread to cpus " << cpuListToString(cpus) << std::endl;
+    bool realtimeApplied = priority <= 0 || setCurrentThreadRealtime(priority);
+    if(!realtimeApplied)
+        perror((name + " SCHED_FIFO").c_str());
+
+    const std::lock_guard<std::mutex> lock(m_threadReportMutex);
+    report = currentThreadReport(name);
+    report.affinityApplied = affinityApplied;
+    report.realtimeApplied = realtimeApplied;
+}
+
+RadarStatistics Radar::statistics() const
+{
+    RadarStatistics ret;
+    ret.packets = m_packetCount->value();
+    ret.bytes = m_byteCount->value();
+    ret.spokes = m_spokeCount->value();
+    ret.kernelDrops = m_kernelDrops->value();
+    ret.droppedSpokes = m_droppedScanlines->value();
+    ret.overloadLevel = overloadLevel();
+    ret.receiveBacklog = m_receiveBacklog->value();
+    return ret;
+}
+
+void Radar::addStage(std::shared_ptr<ProcessingStage> stage)
+{
+    auto seconds = MetricsRegistry::global().histogram("halo_radar_stage_seconds", "Time spent in a processing stage per packet.",
+                                                       {{"channel", m_addresses.label}, {"stage", stage->name()}});
+    const std::lock_guard<std::mutex> lock(m_stagesMutex);
+    m_stages.push_back(stage);
+    m_stageSeconds.push_back(seconds);
+}
+
+void Radar::removeStage(std::shared_ptr<ProcessingStage> const &stage)
+{
+    const std::lock_guard<std::mutex> lock(m_stagesMutex);
+    for(size_t i = 0; i < m_stages.size(); i++)
+        if(m_stages[i] == stage)
+        {
+            m_stages.erase(m_stages.begin() + i);
+            m_stageSeconds.erase(m_stageSeconds.begin() + i);
+            break;
+        }
+}
+
+std::shared_ptr<Subscription> Radar::subscribeSpokes(SubscriptionConfig const &config, SubscriptionHub::SpokeCallback callback)
+{
+    return m_subscriptions->subscribeSpokes(config, std::move(callback));
+}
+
+std::shared_ptr<Subscription> Radar::subscribeSectors(SubscriptionConfig const &config, SubscriptionHub::SectorCallback callback)
+{
+    return m_subscriptions->subscribeSectors(config, std::move(callback));
+}
+
+std::shared_ptr<Subscription> Radar::subscribeRevolutions(SubscriptionConfig const &config, SubscriptionHub::RevolutionCallback callback)
+{
+    return m_subscriptions->subscribeRevolutions(config, std::move(callback));
+}
+
+std::shared_ptr<Subscription> Radar::subscribeRegion(RegionOfInterest const &region, SubscriptionConfig const &config, SubscriptionHub::RegionCallback callback)
+{
+    return m_subscriptions->subscribeRegion(region, config, std::move(callback));
+}
+
+void Radar::unsubscribe(std::shared_ptr<Subscription> const &subscription)
+{
+    m_subscriptions->unsubscribe(subscription);
+}
+
+int Radar::reopenListenerSocket(int sock, bool data, uint32_t &generation)
+{
+    generation = m_addressGeneration;
+    if(sock >= 0)
+        close(sock);
+    AddressSet addresses = this->addresses();
+    IPAddress const &group = data ? addresses.data : addresses.report;
+    int ret = createListenerSocket(addresses.interface, group.address, group.port);
+    if(ret < 0)
+        perror(data ? "data socket" : "report socket");
+    else if(data)
+        tuneDataSocket(ret);
+    return ret;
+}
+
+void Radar::tuneDataSocket(int sock)
+{
+    SocketReport report;
+    report.name = m_addresses.label + " data socket";
+    report.requestedReceiveBuffer = m_config.receiveBufferBytes;
+    report.requestedBusyPoll = m_config.busyPollMicroseconds;
+
+    if(m_config.receiveBufferBytes > 0)
+    {
+        // SO_RCVBUFFORCE needs CAP_NET_ADMIN but is not capped by rmem_max
+        int size = m_config.receiveBufferBytes;
+        report.receiveBufferForced = setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) == 0;
+        if(!report.receiveBufferForced)
+            setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+    socklen_t len = sizeof(report.receiveBuffer);
+    getsockopt(sock, SOL_SOCKET, SO_RCVBUF, &report.receiveBuffer, &len);
+    // the kernel doubles the value for bookkeeping overhead
+    if(report.receiveBuffer/2 < m_config.receiveBufferBytes)
+        report.applied = false;
+
+#ifdef SO_BUSY_POLL
+    if(m_config.busyPollMicroseconds > 0)
+    {
+        int usec = m_config.busyPollMicroseconds;
+        if(setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) < 0)
+            report.applied = false;
+    }
+    len = sizeof(report.busyPoll);
+    getsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &report.busyPoll, &len);
+#else
+    if(m_config.busyPollMicroseconds > 0)
+        report.applied = false;
+#endif
+
+    int one = 1;
+    report.dropCounting = setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one)) == 0;
+    if(!report.dropCounting)
+        report.applied = false;
+
+    m_receiveBuffer->set(report.receiveBuffer);
+    const std::lock_guard<std::mutex> lock(m_threadReportMutex);
+    m_socketReport = report;
+}
+
+double Radar::socketBacklog(int sock) const
+{
+    // FIONREAD on a UDP socket only gives the size of the next datagram
+#ifdef SO_MEMINFO
+    uint32_t meminfo[SK_MEMINFO_VARS];
+    socklen_t len = sizeof(meminfo);
+    if(getsockopt(sock, SOL_SOCKET, SO_MEMINFO, meminfo, &len) == 0 && len > SK_MEMINFO_RCVBUF*sizeof(uint32_t) && meminfo[SK_MEMINFO_RCVBUF])
+        return double(meminfo[SK_MEMINFO_RMEM_ALLOC])/meminfo[SK_MEMINFO_RCVBUF];
+#endif
+    return 0.0;
+}
+
+void Radar::updateOverload(double backlog)
+{
+    m_receiveBacklog->set(backlog);
+    if(!m_overload.update(backlog, std::chrono::steady_clock::now()))
+        return;
+    OverloadLevel level = m_overload.level();
+    OverloadLevel previous = m_overloadLevel.exchange(level, std::memory_order_relaxed);
+    m_overloadGauge->set(level);
+    m_overloadTransitions->add();
+    std::cerr << m_addresses.label << " data " << (level > previous ? "overloaded" : "recovering") << ", backlog " << int(backlog*100)
+              << "%, now " << overloadLevelName(level) << std::endl;
+}
+
+SocketReport Radar::socketReport() const
+{
+    const std::lock_guard<std::mutex> lock(m_threadReportMutex);
+    return m_socketReport;
+}
+
+std::string SocketReport::str() const
+{
+    std::stringstream ret;
+    if(backend != RECEIVE_SOCKET)
+    {
+        ret << name << ": " << (backend == RECEIVE_XDP ? "AF_XDP UMEM " : "TPACKET_V3 ring ") << receiveBuffer/1024 << " kB";
+        return ret.str();
+    }
+    ret << name << ": SO_RCVBUF " << receiveBuffer << (receiveBufferForced ? " (forced)" : "");
+    if(requestedReceiveBuffer > 0)
+        ret << ", requested " << requestedReceiveBuffer;
+    ret << ", SO_BUSY_POLL " << busyPoll << " us";
+    if(requestedBusyPoll > 0)
+        ret << ", requested " << requestedBusyPoll;
+    ret << ", drop counting " << (dropCounting ? "on" : "FAILED");
+    return ret.str();
+}
+
 int Radar::createListenerSocket(uint32_t interface, uint32_t mcast_address, uint16_t port)
 {
     int ret = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
@@ -253,15 +626,42 @@ int Radar::createListenerSocket(uint32_t interface, uint32_t mcast_address, uint
 
 void Radar::dataThread()
 {
-    int data_socket = createListenerSocket(m_addresses.interface,
-    m_addresses.data.address, m_addresses.data.port);
-    if(data_socket < 0)
+    setupThread(m_addresses.label + " data", m_config.dataCpus, m_config.dataPriority, m_dataThreadReport);
     {
-        perror("data socket");
-        return;
+        const std::lock_guard<std::mutex> lock(m_threadReportMutex);
+        m_dataThreadReport.faultsCounted = true;
+    }
+
+    // each backend falls back to the next simpler one if it can not be opened
+    if(m_config.backend == RECEIVE_XDP)
+    {
+        XdpConfig config;
+        config.queue = m_config.xdpQueue;
+        config.nativeMode = m_config.xdpNativeMode;
+        XdpSocket receiver(config);
+        if(receiveFrames(receiver, RECEIVE_XDP))
+            return;
+        if(!receiver.verifierLog().empty() && m_config.logger)
+            LOG_ERROR(m_config.logger, "{} XDP program rejected:\n{}", m_addresses.label, receiver.verifierLog());
     }
+    if(m_config.backend != RECEIVE_SOCKET)
+    {
+        PacketRing receiver;
+        if(receiveFrames(receiver, RECEIVE_PACKET_RING))
+            return;
+    }
+    receiveSocket();
+}
+
+void Radar::receiveSocket()
+{
+    uint32_t generation;
+    // a failed open is retried in the loop, the interface may come back
+    int data_socket = reopenListenerSocket(-1, true, generation);
     
     uint8_t in_data[65535];
+    alignas(cmsghdr) uint8_t control[CMSG_SPACE(sizeof(uint32_t))];
+    uint32_t socket_drops = 0;  // last SO_RXQ_OVFL count of the current socket
     while(true)
     {
         {
@@ -269,50 +669,281 @@ void Radar::dataThread()
             if(m_exitFlag)
                 break;
         }
-        sockaddr_in from_addr;
-        unsigned int from_addr_len = sizeof(from_addr);
-        int nbytes = recvfrom(data_socket,in_data,65535,0,(sockaddr*)&from_addr,&from_addr_len);
-        if(nbytes > 0)
+        if(generation != m_addressGeneration || data_socket < 0)
+        {
+            data_socket = reopenListenerSocket(data_socket, true, generation);
+            socket_drops = 0;
+            if(data_socket < 0)
+            {
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+                continue;
+            }
+        }
+        iovec iov;
+        iov.iov_base = in_data;
+        iov.iov_len = sizeof(in_data);
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        int nbytes = recvmsg(data_socket, &msg, 0);
+        if(nbytes <= 0)
+            updateOverload(0.0);
+        else
+        {
+            // SO_RXQ_OVFL carries the socket's running drop count once it
+            // is non zero
+            for(cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c))
+                if(c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_RXQ_OVFL)
+                {
+                    uint32_t drops;
+                    memcpy(&drops, CMSG_DATA(c), sizeof(drops));
+                    if(drops != socket_drops)
+                        m_kernelDrops->add(uint32_t(drops - socket_drops));
+                    socket_drops = drops;
+                }
+            processSector(in_data, nbytes);
+            if(m_dataPackets % overload_sample_packets == 0)
+                updateOverload(socketBacklog(data_socket));
+        }
+    }
+    if(data_socket >= 0)
+        close(data_socket);
+}
+
+template<typename Receiver> bool Radar::receiveFrames(Receiver &receiver, ReceiveBackend backend)
+{
+    const char *kind = backend == RECEIVE_XDP ? " AF_XDP socket" : " packet ring";
+    uint32_t generation = 0;
+    bool opened = false;
+    while(true)
+    {
         {
-            RawSector *sector = reinterpret_cast<RawSector*>(in_data);
-            //std::cerr << "sector stuff: " << int(sector->stuff[0]) << ", " << int(sector->stuff[1]) << ", " << int(sector->stuff[2]) << ", " << int(sector->stuff[3]) << ", " << int(sector->stuff[4]) << std::endl;
-            std::vector<Scanline> scanlines;
-            for(int i = 0; i < sector->scanline_count; i++)
+            const std::lock_guard<std::mutex> lock(m_exitFlagMutex);
+            if(m_exitFlag)
+                break;
+        }
+        if(generation != m_addressGeneration || !receiver.isOpen())
+        {
+            generation = m_addressGeneration;
+            AddressSet addresses = this->addresses();
+            if(!receiver.open(addresses.interface, addresses.data.address, addresses.data.port))
             {
-                if (sector->lines[i].status == 2) //valid
+                // most likely missing capabilities, which will not change
+                if(!opened)
                 {
-                    Scanline s;
-                    if(sector->lines[i].large_range == 128)
-                        if(sector->lines[i].small_range == -1)
-                            s.range = 0;
-                        else
-                            s.range = sector->lines[i].small_range/4.0;
-                    else
-                        s.range = sector->lines[i].large_range*sector->lines[i].small_range/512.0;
-                    s.angle = sector->lines[i].angle*360.0/4096.0;
-                    for(int j = 0; j < 512; j++)
-                    {
-                        s.intensities.push_back(sector->lines[i].data[j]&0x0f);
-                        s.intensities.push_back((sector->lines[i].data[j]&0xf0)>>4);
-                    }
-                    scanlines.push_back(s);
+                    perror((addresses.label + kind + ", falling back").c_str());
+                    return false;
                 }
+                perror((addresses.label + kind).c_str());
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+                continue;
             }
-            this->processData(scanlines);
+            opened = true;
+            SocketReport report;
+            report.name = addresses.label + " data" + kind;
+            report.backend = backend;
+            report.receiveBuffer = receiver.bufferBytes();
+            report.dropCounting = true;
+            const std::lock_guard<std::mutex> lock(m_threadReportMutex);
+            m_socketReport = report;
         }
+        const uint8_t *data;
+        int size;
+        // the drop counter costs a system call, read it when idle or now and then
+        bool received = receiver.next(data, size, 1000);
+        if(received)
+            processSector(data, size);
+        if(!received || m_dataPackets % 1024 == 0)
+            m_kernelDrops->add(receiver.takeDrops());
+        if(!received)
+            updateOverload(0.0);
+        else if(m_dataPackets % overload_sample_packets == 0)
+            updateOverload(receiver.backlog());
     }
-    close(data_socket);
+    return true;
 }
 
-void Radar::reportThread()
+namespace
+{
+
+// Meters covered by the spoke.
+float scanlineRange(RawScanline const &line)
+{
+    if(line.large_range == 128)
+        return line.small_range == 0xffff ? 0 : line.small_range/4.0;
+    return line.large_range*line.small_range/512.0;
+}
+
+// Every other spoke is shed under OVERLOAD_HALF_AZIMUTH; they come every 2
+// angle units.
+bool shedSpoke(RawScanline const &line, OverloadLevel overload)
+{
+    return overload >= OVERLOAD_HALF_AZIMUTH && (line.angle & 2);
+}
+
+} // namespace
+
+uint64_t Radar::decodeRegions(const RawSector *sector, int scanlineCount, uint8_t dopplerState, OverloadLevel overload)
 {
-    int report_socket = createListenerSocket(m_addresses.interface,
-    m_addresses.report.address, m_addresses.report.port);
-    if(report_socket < 0)
+    uint64_t ret = 0;
+    m_subscriptions->beginRegions();
+    for(int i = 0; i < scanlineCount; i++)
     {
-        perror("report socket");
-        return;
+        RawScanline const &line = sector->lines[i];
+        if(line.status != 2 || shedSpoke(line, overload))
+            continue;
+        RegionSpoke *r = m_subscriptions->addRegionSpoke(line.angle*360.0/4096.0, scanlineRange(line), sizeof(RawScanline::data)*2);
+        if(!r)
+            continue;
+        if(dopplerState != 0)
+            r->doppler.resize(r->intensities.size());
+        // spans start on a byte and hold whole ones
+        for(auto const &span: r->spans)
+        {
+            const uint8_t *packed = line.data + span.firstBin/2;
+            if(dopplerState == 0)
+                unpackSpoke(packed, span.count/2, r->intensities.data() + span.offset);
+            else
+                unpackDopplerSpoke(packed, span.count/2, r->intensities.data() + span.offset, r->doppler.data() + span.offset, dopplerState == 1);
+        }
+        ret++;
     }
+    m_subscriptions->publishRegions();
+    return ret;
+}
+
+void Radar::processSector(const uint8_t *data, int size)
+{
+    auto decode_start = std::chrono::steady_clock::now();
+    const RawSector *sector = reinterpret_cast<const RawSector*>(data);
+    const uint8_t doppler_state = m_dopplerState.load(std::memory_order_relaxed);
+    const OverloadLevel overload = m_overload.level();
+    // ring frames end where the datagram does, never read past it
+    int scanline_count = 0;
+    if(size >= int(offsetof(RawSector, lines)))
+        scanline_count = std::min<int>(sector->scanline_count, (size - offsetof(RawSector, lines))/sizeof(RawScanline));
+    //std::cerr << "sector stuff: " << int(sector->stuff[0]) << ", " << int(sector->stuff[1]) << ", " << int(sector->stuff[2]) << ", " << int(sector->stuff[3]) << ", " << int(sector->stuff[4]) << std::endl;
+    bool whole = m_config.decodeWholeSpokes || m_subscriptions->wantsWholeSpokes();
+    if(!whole)
+    {
+        const std::lock_guard<std::mutex> lock(m_stagesMutex);
+        whole = !m_stages.empty();
+    }
+    uint64_t region_spokes = 0;
+    if(!whole && m_subscriptions->hasRegions())
+        region_spokes = decodeRegions(sector, scanline_count, doppler_state, overload);
+    for(int i = 0; whole && i < scanline_count && !m_spareScanlines.empty(); i++)
+    {
+        if (sector->lines[i].status == 2) //valid
+        {
+            if(shedSpoke(sector->lines[i], overload))
+                continue;
+            m_scanlines.push_back(std::move(m_spareScanlines.back()));
+            m_spareScanlines.pop_back();
+            Scanline &s = m_scanlines.back();
+            s.range = scanlineRange(sector->lines[i]);
+            s.angle = sector->lines[i].angle*360.0/4096.0;
+            s.rangeDecimation = overload >= OVERLOAD_HALF_RANGE ? 2 : 1;
+            if(doppler_state == 0)
+            {
+                s.doppler.clear();
+                if(s.rangeDecimation == 1)
+                {
+                    s.intensities.resize(sizeof(RawScanline::data)*2);
+                    unpackSpoke(sector->lines[i].data, sizeof(RawScanline::data), s.intensities.data());
+                }
+                else
+                {
+                    s.intensities.resize(sizeof(RawScanline::data));
+                    unpackSpokeHalfRange(sector->lines[i].data, sizeof(RawScanline::data), s.intensities.data());
+                }
+            }
+            else
+            {
+                s.intensities.resize(sizeof(RawScanline::data)*2);
+                s.doppler.resize(sizeof(RawScanline::data)*2);
+                unpackDopplerSpoke(sector->lines[i].data, sizeof(RawScanline::data), s.intensities.data(), s.doppler.data(), doppler_state == 1);
+                if(s.rangeDecimation != 1)
+                {
+                    halveSpoke(s.intensities.data(), s.doppler.data(), s.intensities.size());
+                    s.intensities.resize(sizeof(RawScanline::data));
+                    s.doppler.resize(sizeof(RawScanline::data));
+                }
+            }
+        }
+    }
+    if(m_spareScanlines.empty())
+    {
+        uint64_t dropped = 0;
+        for(int i = 0; i < scanline_count; i++)
+            if(sector->lines[i].status == 2 && !shedSpoke(sector->lines[i], overload))
+                dropped++;
+        if(dropped > m_scanlines.size())
+            m_droppedScanlines->add(dropped - m_scanlines.size());
+    }
+    auto stage_start = std::chrono::steady_clock::now();
+    m_decodeSeconds->observe(std::chrono::duration<double>(stage_start - decode_start).count());
+    {
+        const std::lock_guard<std::mutex> lock(m_stagesMutex);
+        for(size_t i = 0; i < m_stages.size(); i++)
+        {
+            if(overload >= OVERLOAD_SKIP_OPTIONAL && m_stages[i]->optional())
+                continue;
+            m_stages[i]->process(m_scanlines);
+            auto stage_end = std::chrono::steady_clock::now();
+            m_stageSeconds[i]->observe(std::chrono::duration<double>(stage_end - stage_start).count());
+            stage_start = stage_end;
+        }
+    }
+    m_packetCount->add();
+    m_dataPackets++;
+    m_byteCount->add(size);
+    m_spokeCount->add(m_scanlines.size() + region_spokes);
+    if(whole)
+    {
+        this->processData(m_scanlines);
+        m_processDataSeconds->observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - stage_start).count());
+        m_subscriptions->publish(m_scanlines);
+    }
+    while(!m_scanlines.empty())
+    {
+        m_spareScanlines.push_back(std::move(m_scanlines.back()));
+        m_scanlines.pop_back();
+    }
+
+    const uint64_t warmup_packets = 64;
+    if(m_dataPackets == warmup_packets)
+        currentThreadFaults(m_warmupMinorFaults, m_warmupMajorFaults);
+    else if(m_dataPackets > warmup_packets && m_dataPackets % 256 == 0)
+    {
+        long minor = 0, major = 0;
+        currentThreadFaults(minor, major);
+        const std::lock_guard<std::mutex> lock(m_threadReportMutex);
+        m_dataThreadReport.minorFaults = minor - m_warmupMinorFaults;
+        m_dataThreadReport.majorFaults = major - m_warmupMajorFaults;
+        // the startup report predates warm-up, this one shows the faults
+        // after it
+        const bool first = !m_dataThreadReport.warmedUp;
+        m_dataThreadReport.warmedUp = true;
+        if(first && m_config.logger)
+        {
+            if(m_dataThreadReport.minorFaults || m_dataThreadReport.majorFaults)
+                LOG_WARNING(m_config.logger, "{}", m_dataThreadReport.str());
+            else
+                LOG_INFO(m_config.logger, "{}", m_dataThreadReport.str());
+        }
+    }
+}
+
+void Radar::reportThread()
+{
+    setupThread(m_addresses.label + " report", m_config.reportCpus, m_config.reportPriority, m_reportThreadReport);
+
+    uint32_t generation;
+    int report_socket = reopenListenerSocket(-1, false, generation);
 
     uint8_t in_data[65535];
     while(true)
@@ -322,277 +953,60 @@ void Radar::reportThread()
             if(m_exitFlag)
                 break;
         }
+        if(generation != m_addressGeneration || report_socket < 0)
+        {
+            report_socket = reopenListenerSocket(report_socket, false, generation);
+            if(report_socket < 0)
+            {
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+                continue;
+            }
+        }
         sockaddr_in from_addr;
         unsigned int from_addr_len = sizeof(from_addr);
         int nbytes = recvfrom(report_socket,in_data,65535,0,(sockaddr*)&from_addr,&from_addr_len);
         if(nbytes > 0)
         {
-            if(nbytes >= 2)
+            ReportValue values[max_report_values];
+            int count = decodeReport(in_data, nbytes, values);
+            if(count < 0)
             {
-                std::map<std::string,std::string> new_state;
                 uint16_t id = *reinterpret_cast<uint16_t*>(in_data);
+                std::cerr << m_addresses.label << " " << nbytes << " bytes of report data, ";
+                std::cerr << "id: " << std::showbase << std::hex << id << std::noshowbase << std::dec << std::endl;
+            }
+            else if(count > 0 && *reinterpret_cast<uint16_t*>(in_data) == 0xc408)
+            {
+                RadarReport_c408 *c408 = reinterpret_cast<RadarReport_c408*>(in_data);
+                m_dopplerState.store(c408->doppler_state <= 2 ? c408->doppler_state : 0, std::memory_order_relaxed);
+            }
+            if(count > 0)
+                m_commandQueue->confirm(values, count);
 
-                switch(id)
-                {
-                    case 0xc401:
-                        switch(in_data[2])
-                        {
-                            case 1:
-                                new_state["status"] = "standby";
-                                break;
-                            case 2:
-                                new_state["status"] = "transmit";
-                                break;
-                            case 5:
-                                new_state["status"] = "spinning_up";
-                                break;
-                            default:
-                                new_state["status"] = "unknown";
-                        }
-                        break;
-                    case 0xc402:
-                    {
-                        RadarReport_c402 *c402 = reinterpret_cast<RadarReport_c402*>(in_data);
-                        if(nbytes >= sizeof(RadarReport_c402))
-                        {
-                            new_state["range"] = std::to_string(c402->range/10);
-                            
-                            switch(c402->mode)
-                            {
-                                case 0:
-                                    new_state["mode"] = "custom";
-                                    break;
-                                case 1:
-                                    new_state["mode"] = "harbor";
-                                    break;
-                                case 2:
-                                    new_state["mode"] = "offshore";
-                                    break;
-                                case 4:
-                                    new_state["mode"] = "weather";
-                                    break;
-                                case 5:
-                                    new_state["mode"] = "bird";
-                                    break;
-                                default:
-                                    new_state["mode"] = "unknown";
-                            }
-                            
-                            new_state["gain"] = std::to_string(c402->gain*100/255.0);
-                            if(c402->gain_auto)
-                                new_state["gain_mode"] = "auto";
-                            else
-                                new_state["gain_mode"] = "manual";
-                            
-                            new_state["sea_clutter"] = std::to_string(c402->sea_clutter*100/255.0);
-                            if(c402->sea_clutter_auto)
-                                new_state["sea_clutter_mode"] = "auto";
-                            else
-                                new_state["sea_clutter_mode"] = "manual";
-                            
-                            new_state["rain_clutter"] = std::to_string(c402->rain_clutter*100/255.0);
-                            
-                            switch(c402->interference_rejection)
-                            {
-                                case 0:
-                                    new_state["interference_rejection"] = "off";
-                                    break;
-                                case 1:
-                                    new_state["interference_rejection"] = "low";
-                                    break;
-                                case 2:
-                                    new_state["interference_rejection"] = "medium";
-                                    break;
-                                case 3:
-                                    new_state["interference_rejection"] = "high";
-                                    break;
-                                default:
-                                    new_state["interference_rejection"] = "unknown";
-                            }
-                            
-                            switch(c402->target_expansion)
-                            {
-                                case 0:
-                                    new_state["target_expansion"] = "off";
-                                    break;
-                                case 1:
-                                    new_state["target_expansion"] = "low";
-                                    break;
-                                case 2:
-                                    new_state["target_expansion"] = "medium";
-                                    break;
-                                case 3:
-                                    new_state["target_expansion"] = "high";
-                                    break;
-                                default:
-                                    new_state["target_expansion"] = "unknown";
-                            }
-                        }
-                        break;
-                    }
-                    case 0xc403:
-                        // not sure
-                        break;
-                    case 0xc404:
-                    {
-                        RadarReport_c404 *c404 = reinterpret_cast<RadarReport_c404*>(in_data);
-                        if(nbytes >= sizeof(RadarReport_c404))
-                        {
-                            new_state["bearing_alignment"] = std::to_string(c404->bearing_alignment/10.0);
-                            new_state["antenna_height"] = std::to_string(c404->antenna_height/1000.0);
-                            switch(c404->lights)
-                            {
-                                case 0:
-                                    new_state["lights"] = "off";
-                                    break;
-                                case 1:
-                                    new_state["lights"] = "low";
-                                    break;
-                                case 2:
-                                    new_state["lights"] = "medium";
-                                    break;
-                                case 3:
-                                    new_state["lights"] = "high";
-                                    break;
-                                default:
-                                    new_state["lights"] = "unknown";
-                            }
-                        }
-                        break;
-                    }
-                    case 0xc406:
-                        // not sure
-                        break;
-                    case 0xc408:
-                    {
-                        RadarReport_c408 *c408 = reinterpret_cast<RadarReport_c408*>(in_data);
-                        if(nbytes >= sizeof(RadarReport_c408))
-                        {
-                            switch(c408->sea_state)
-                            {
-                                case 0:
-                                    new_state["sea_state"] = "calm";
-                                    break;
-                                case 1:
-                                    new_state["sea_state"] = "moderate";
-                                    break;
-                                case 2:
-                                    new_state["sea_state"] = "rough";
-                                    break;
-                                default:
-                                    new_state["sea_state"] = "unknown";
-                            }
-                            
-                            switch(c408->scan_speed)
-                            {
-                                case 0:
-                                    new_state["scan_speed"] = "off";
-                                    break;
-                                case 1:
-                                    new_state["scan_speed"] = "medium";
-                                    break;
-                                case 3:
-                                    new_state["scan_speed"] = "high";
-                                    break;
-                                default:
-                                    new_state["scan_speed"] = "default";
-                            }
-                            
-                            if(c408->sls_auto)
-                                new_state["sidelobe_suppression_mode"] = "auto";
-                            else
-                                new_state["sidelobe_suppression_mode"] = "manual";
-                            new_state["sidelobe_suppression"] = std::to_string(c408->side_lobe_suppression*100/255.0);
-                            
-                            switch(c408->noise_rejection)
-                            {
-                                case 0:
-                                    new_state["noise_rejection"] = "off";
-                                    break;
-                                case 1:
-                                    new_state["noise_rejection"] = "low";
-                                    break;
-                                case 2:
-                                    new_state["noise_rejection"] = "medium";
-                                    break;
-                                case 3:
-                                    new_state["noise_rejection"] = "high";
-                                    break;
-                                default:
-                                    new_state["noise_rejection"] = "unknown";
-                            }
-                            
-                            switch(c408->target_separation)
-                            {
-                                case 0:
-                                    new_state["target_separation"] = "off";
-                                    break;
-                                case 1:
-                                    new_state["target_separation"] = "low";
-                                    break;
-                                case 2:
-                                    new_state["target_separation"] = "medium";
-                                    break;
-                                case 3:
-                                    new_state["target_separation"] = "high";
-                                    break;
-                                default:
-                                    new_state["target_separation"] = "unknown";
-                            }
-                            
-                            new_state["auto_sea_clutter_nudge"] = std::to_string(c408->auto_sea_clutter_nudge);
-                            
-                            switch(c408->doppler_state)
-                            {
-                                case 0:
-                                    new_state["doppler_mode"] = "off";
-                                    break;
-                                case 1:
-                                    new_state["doppler_mode"] = "normal";
-                                    break;
-                                case 2:
-                                    new_state["doppler_mode"] = "approaching_only";
-                                    break;
-                                default:
-                                    new_state["doppler_mode"] = "unknown";
-                            }
-                            
-                            new_state["doppler_speed"] = std::to_string(c408->doppler_speed/100.0);
-                        }
-                        break;
-                    }
-                    case 0xc409:
-                        break;
-                    case 0xc40a:
-                        break;
-                    case 0xc611:
-                        // heartbeat
-                        break;
-                    default:
-                        std::cerr << m_addresses.label << " " << nbytes << " bytes of report data, ";
-                        std::cerr << "id: " << std::showbase << std::hex << id << std::noshowbase << std::dec << std::endl;                        
-                }
-                
-                bool state_updated = false;
-                for(auto kv: new_state)
-                {
-                    if(m_state.find(kv.first) == m_state.end() || m_state[kv.first] != kv.second)
-                    {
-                       m_state[kv.first] = kv.second;
-                       state_updated = true;
-                    }
-                }
-                
-                if(state_updated)
-                    this->stateUpdated();
+            bool state_updated = false;
+            for(int i = 0; i < count; i++)
+            {
+                auto s = m_state.find(values[i].key);
+                if(s == m_state.end())
+                    m_state.emplace(values[i].key, values[i].value);
+                else if(s->second != values[i].value)
+                    s->second = values[i].value;
+                else
+                    continue;
+                state_updated = true;
             }
+
+            if(state_updated)
+                this->stateUpdated();
         }
     }
-    close(report_socket);
+    if(report_socket >= 0)
+        close(report_socket);
 }
 
 void Radar::sendCommand(const uint8_t data[], int size)
 {
+    const std::lock_guard<std::mutex> lock(m_addressMutex);
     sendto(m_sendSocket, data, size, 0, (sockaddr*)&m_sendAddress,sizeof(m_sendAddress));
 }
 
@@ -625,138 +1039,41 @@ bool Radar::checkHeartbeat()
     return false;
 }
 
-void Radar::sendCommand(std::string const &key, std::string const &value)
+int Radar::sendCommandBatch(mmsghdr *messages, unsigned count)
 {
-    if(key == "status")
-    {
-        if(value == "transmit")
-        {
-            uint8_t data1[] = {0x00,0xc1,0x01};
-            sendCommand(data1,3);
-            uint8_t data2[] = {0x01,0xc1,0x01};
-            sendCommand(data2,3);
-        }
-        else if(value == "standby")
-        {
-            uint8_t data1[] = {0x00,0xc1,0x01};
-            sendCommand(data1,3);
-            uint8_t data2[] = {0x01,0xc1,0x00};
-            sendCommand(data2,3);
-        }
-    }
-    if(key == "range")
-    {
-        RangeCmd cmd;
-        cmd.range = std::stof(value)*10;
-        sendCommand(cmd);
-    }
-    if(key == "bearing_alignment")
-    {
-        BearingAlignmentCmd cmd;
-        cmd.bearing_alignment = std::stof(value)*10;
-        sendCommand(cmd);
-    }
-    if(key == "gain")
-    {
-        GainCmd cmd;
-        if (value == "auto")
-            cmd.gain_auto = 1;
-        else
-            cmd.gain = std::stof(value)*255/100;
-        sendCommand(cmd);
-    }
-    if(key == "sea_clutter")
+    const std::lock_guard<std::mutex> lock(m_addressMutex);
+    for(unsigned i = 0; i < count; i++)
     {
-        SeaClutterCmd cmd;
-        if (value == "auto")
-            cmd.sea_clutter_auto = 1;
-        else
-            cmd.sea_clutter = std::stof(value)*255/100;
-        sendCommand(cmd);
+        messages[i].msg_hdr.msg_name = &m_sendAddress;
+        messages[i].msg_hdr.msg_namelen = sizeof(m_sendAddress);
     }
-    if(key == "rain_clutter")
+    unsigned sent = 0;
+    while(sent < count)
     {
-        RainClutterCmd cmd;
-        cmd.rain_clutter = std::stof(value)*255/100;
-        sendCommand(cmd);
+        int n = sendmmsg(m_sendSocket, messages + sent, count - sent, 0);
+        if(n <= 0)
+            break;
+        sent += n;
     }
-    if(key == "sidelobe_suppression")
-    {
-        SidelobeSuppressionCmd cmd;
-        if (value == "auto")
-            cmd.sls_auto = 1;
-        else
-            cmd.sidelobe_suppression = std::stof(value)*255/100;
-        sendCommand(cmd);
-    }
-    std::map<std::string,uint8_t> lmhMap;
-    lmhMap["off"] = 0;
-    lmhMap["low"] = 1;
-    lmhMap["medium"] = 2;
-    lmhMap["high"] = 3;
-    if(key == "interference_rejection")
-        sendCommand(EnumCmd(0xc108,lmhMap[value]));
-    if(key == "sea_state")
-    {
-        EnumCmd cmd(0xc10b,0);
-        if(value == "moderate")
-            cmd.value = 1;
-        if(value == "rough")
-            cmd.value = 2;
-        sendCommand(cmd);
-    }
-    if(key == "scan_speed")
-    {
-        EnumCmd cmd(0xc10f,0);
-        if(value == "medium")
-            cmd.value = 1;
-        if(value == "high")
-            cmd.value = 3;
-        sendCommand(cmd);
-    }
-    if(key == "mode")
-    {
-        EnumCmd cmd(0xc110,0);
-        if(value == "harbor")
-            cmd.value = 1;
-        if(value == "offshore")
-            cmd.value = 2;
-        if(value == "weather")
-            cmd.value = 4;
-        if(value == "bird")
-            cmd.value = 5;
-        sendCommand(cmd);
-    }
-    if(key == "auto_sea_clutter_nudge")
-        sendCommand(AutoSeaClutterNudgeCmd(std::stof(value)));
-    if(key == "target_expansion")
-        sendCommand(EnumCmd(0xc112,lmhMap[value]));
-    if(key == "noise_rejection")
-        sendCommand(EnumCmd(0xc121,lmhMap[value]));
-    if(key == "target_separation")
-        sendCommand(EnumCmd(0xc122,lmhMap[value]));
-    if(key == "doppler_mode")
-    {
-        EnumCmd cmd(0xc123,0);
-        if(value == "normal")
-            cmd.value = 1;
-        if(value == "approaching_only")
-            cmd.value = 2;
-        sendCommand(cmd);
-    }
-    if(key == "doppler_speed")
-        sendCommand(DopplerSpeedCmd(std::stof(value)*100));
-    if(key == "antenna_height")
-        sendCommand(AntennaHeightCmd(std::stof(value)*1000));
-    if(key == "lights")
-        sendCommand(EnumCmd(0xc131,lmhMap[value]));
-    
-    
-    
+    return sent;
+}
+
+std::future<CommandResult> Radar::sendCommand(std::string const &key, std::string const &value)
+{
+    return m_commandQueue->submit(key, value);
+}
+
+CommandStatistics Radar::commandStatistics() const
+{
+    return m_commandQueue->statistics();
 }
 
 HeadingSender::HeadingSender(uint32_t bindAddress)
 {
+    MetricsRegistry &metrics = MetricsRegistry::global();
+    m_packetsSent = metrics.counter("halo_heading_packets_sent_total", "Heading and companion packets sent.");
+    m_sendErrors = metrics.counter("halo_heading_send_errors_total", "Heading and companion packets that failed to send.");
+
     m_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
 
     int one = 1;
@@ -821,7 +1138,10 @@ void HeadingSender::senderThread()
                 const std::lock_guard<std::mutex> lock(m_headingMutex);
                 m_headingPacket.heading = (uint16_t)(m_heading * 63488.0 / 360.0);
             }
-            sendto(m_socket, &m_headingPacket, sizeof(m_headingPacket), 0, (sockaddr*)&m_sendAddress, sizeof(m_sendAddress));
+            if(sendto(m_socket, &m_headingPacket, sizeof(m_headingPacket), 0, (sockaddr*)&m_sendAddress, sizeof(m_sendAddress)) == sizeof(m_headingPacket))
+                m_packetsSent->add();
+            else
+                m_sendErrors->add();
             m_lastHeadingSent = now;
         }
         if (now-m_lastMysterySent > m_mysterySendInterval)
@@ -831,7 +1151,10 @@ void HeadingSender::senderThread()
             m_mysteryPacket.epoch = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
             m_mysteryPacket.mystery1 = 0;
             m_mysteryPacket.mystery2 = 0;
-            sendto(m_socket, &m_mysteryPacket, sizeof(m_mysteryPacket), 0, (sockaddr*)&m_sendAddress, sizeof(m_sendAddress));
+            if(sendto(m_socket, &m_mysteryPacket, sizeof(m_mysteryPacket), 0, (sockaddr*)&m_sendAddress, sizeof(m_sendAddress)) == sizeof(m_mysteryPacket))
+                m_packetsSent->add();
+            else
+                m_sendErrors->add();
             m_lastMysterySent = now;
         }
         auto sleepTime = min(m_lastHeadingSent+m_headingSendInterval-now, m_lastMysterySent+m_mysterySendInterval-now);
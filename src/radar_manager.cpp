@@ -0,0 +1,284 @@
+#include "radar_manager.h"
+
+#include <algorithm>
+
+#include "logger.h"
+#include "thread_utils.h"
+
+namespace halo_radar
+{
+
+namespace
+{
+
+// the A and B channels of a Halo come in on the same interface
+const size_t channels_per_node = 2;
+
+} // namespace
+
+RadarManager::RadarManager(quill::Logger *logger, RadarFactory factory):m_logger(logger),m_factory(factory)
+{
+}
+
+RadarManager::~RadarManager()
+{
+    stopDiscovery();
+}
+
+void RadarManager::discover(std::vector<uint32_t> const &interfaces, std::chrono::milliseconds timeout,
+                            std::shared_ptr<DiscoveryCache> cache, std::function<void(AddressSet const &)> onStarted)
+{
+    stopDiscovery();
+
+    if(cache && cache->load())
+    {
+        auto local = interfaces.empty() ? getLocalAddresses() : interfaces;
+        for(auto const &a: cache->addressSets())
+        {
+            if(std::find(local.begin(), local.end(), a.interface) == local.end())
+                continue;
+            LOG_INFO(m_logger, "Starting {} from cache {}", a.label, cache->path());
+            if(add(a) && onStarted)
+                onStarted(a);
+        }
+    }
+
+    m_stopDiscovery = false;
+    m_discoveryThread = std::thread(&RadarManager::discoveryThread, this, interfaces, timeout, cache, onStarted);
+}
+
+void RadarManager::stopDiscovery()
+{
+    m_stopDiscovery = true;
+    if(m_discoveryThread.joinable())
+        m_discoveryThread.join();
+}
+
+void RadarManager::discoveryThread(std::vector<uint32_t> interfaces, std::chrono::milliseconds timeout,
+                                   std::shared_ptr<DiscoveryCache> cache, std::function<void(AddressSet const &)> onStarted)
+{
+    while(!m_stopDiscovery)
+    {
+        auto addresses = interfaces.empty() ? getLocalAddresses() : interfaces;
+        if(addresses.empty())
+        {
+            LOG_ERROR(m_logger, "No usable interfaces!");
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            continue;
+        }
+
+        std::vector<AddressSet> found;
+        scan(m_logger, addresses, timeout, [&](AddressSet const &a)
+        {
+            found.push_back(a);
+            auto r = radar(a.label);
+            if(!r)
+            {
+                if(add(a) && onStarted)
+                    onStarted(a);
+            }
+            else if(!sameAddresses(r->addresses(), a))
+            {
+                LOG_WARNING(m_logger, "{} moved, was {}, switching to {}", a.label, r->addresses().str(), a.str());
+                r->updateAddresses(a);
+            }
+            return !m_stopDiscovery;
+        });
+
+        if(!found.empty())
+        {
+            if(cache && cache->update(found) && !cache->save())
+                LOG_WARNING(m_logger, "Could not write discovery cache {}", cache->path());
+            break;
+        }
+        LOG_ERROR(m_logger, "No radars found!");
+    }
+}
+
+void RadarManager::setChannelConfig(std::string const &label, RadarConfig const &config)
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    m_channelConfigs[label] = config;
+}
+
+void RadarManager::setDefaultConfig(RadarConfig const &config)
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    m_defaultConfig = config;
+}
+
+RadarConfig RadarManager::channelConfig(AddressSet const &addresses)
+{
+    RadarConfig config = m_defaultConfig;
+    auto c = m_channelConfigs.find(addresses.label);
+    if(c != m_channelConfigs.end())
+        config = c->second;
+    if(!config.logger)
+        config.logger = m_logger;
+
+    if(m_numaAware && (config.dataCpus.empty() || config.reportCpus.empty()))
+    {
+        int node = interfaceNumaNode(addresses.interface);
+        auto cpus = numaNodeCpus(node);
+        if(!cpus.empty())
+        {
+            auto &labels = m_numaChannels[node];
+            size_t slot = std::find(labels.begin(), labels.end(), addresses.label) - labels.begin();
+            if(slot == labels.size())
+                labels.push_back(addresses.label);
+
+            std::vector<int> share = cpus;
+            if(cpus.size() >= channels_per_node)
+            {
+                size_t part = slot % channels_per_node;
+                share.assign(cpus.begin() + part*cpus.size()/channels_per_node, cpus.begin() + (part + 1)*cpus.size()/channels_per_node);
+            }
+            std::vector<int> data = share;
+            std::vector<int> report = share;
+            if(share.size() >= 2)
+            {
+                data.assign(share.begin(), share.begin() + 1);
+                report.assign(share.begin() + 1, share.end());
+            }
+            if(config.dataCpus.empty())
+                config.dataCpus = data;
+            if(config.reportCpus.empty())
+                config.reportCpus = report;
+
+            if(slot < channels_per_node && share.size() >= 2)
+                LOG_INFO(m_logger, "{} interface {} is on NUMA node {}, cpus {}, using {} for this channel", addresses.label, ipAddressToString(addresses.interface), node,
+                         cpuListToString(cpus), cpuListToString(share));
+            else
+                LOG_WARNING(m_logger, "{} interface {} is on NUMA node {}, cpus {}, too few to isolate: using {} shared with other threads", addresses.label,
+                            ipAddressToString(addresses.interface), node, cpuListToString(cpus), cpuListToString(share));
+        }
+    }
+    return config;
+}
+
+std::shared_ptr<Radar> RadarManager::add(AddressSet const &addresses)
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    for(auto r: m_radars)
+        if(r->addresses().label == addresses.label)
+            return r;
+
+    RadarConfig config = channelConfig(addresses);
+    LOG_INFO(m_logger, "Starting {} with data cpus [{}], report cpus [{}]", addresses.str(), cpuListToString(config.dataCpus), cpuListToString(config.reportCpus));
+    auto radar = m_factory(addresses, config);
+    if(radar)
+    {
+        m_radars.push_back(radar);
+        m_lastSamples[addresses.label] = {radar->statistics(), std::chrono::steady_clock::now()};
+    }
+    return radar;
+}
+
+std::vector<std::shared_ptr<Radar>> RadarManager::radars() const
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    return m_radars;
+}
+
+std::shared_ptr<Radar> RadarManager::radar(std::string const &label) const
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    for(auto r: m_radars)
+        if(r->addresses().label == label)
+            return r;
+    return nullptr;
+}
+
+bool RadarManager::empty() const
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    return m_radars.empty();
+}
+
+void RadarManager::clear()
+{
+    std::vector<std::shared_ptr<Radar>> radars;
+    {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        radars.swap(m_radars);
+        m_lastSamples.clear();
+    }
+    // radars are destroyed here, outside the lock, joining their threads
+}
+
+bool RadarManager::sendCommand(std::string const &label, std::string const &key, std::string const &value)
+{
+    bool sent = false;
+    for(auto r: radars())
+        if(label == "all" || r->addresses().label == label)
+        {
+            r->sendCommand(key, value);
+            sent = true;
+        }
+    return sent;
+}
+
+std::vector<ChannelThroughput> RadarManager::throughput()
+{
+    std::vector<ChannelThroughput> ret;
+    auto now = std::chrono::steady_clock::now();
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    for(auto r: m_radars)
+    {
+        ChannelThroughput ct;
+        ct.label = r->addresses().label;
+        auto statistics = r->statistics();
+        auto &last = m_lastSamples[ct.label];
+        double seconds = std::chrono::duration<double>(now - last.time).count();
+        if(seconds > 0.0)
+        {
+            ct.packetsPerSecond = (statistics.packets - last.statistics.packets)/seconds;
+            ct.spokesPerSecond = (statistics.spokes - last.statistics.spokes)/seconds;
+            ct.megabytesPerSecond = (statistics.bytes - last.statistics.bytes)/seconds/1.0e6;
+        }
+        ct.kernelDrops = statistics.kernelDrops - last.statistics.kernelDrops;
+        ct.droppedSpokes = statistics.droppedSpokes - last.statistics.droppedSpokes;
+        ct.overloadLevel = statistics.overloadLevel;
+        ct.receiveBacklog = statistics.receiveBacklog;
+        last.statistics = statistics;
+        last.time = now;
+        ret.push_back(ct);
+    }
+    return ret;
+}
+
+void RadarManager::logThroughput()
+{
+    for(auto const &ct: throughput())
+    {
+        if(ct.kernelDrops == 0 && ct.droppedSpokes == 0 && ct.overloadLevel == OVERLOAD_NONE)
+            LOG_INFO(m_logger, "{}: {:.1f} packets/s, {:.1f} spokes/s, {:.3f} MB/s", ct.label, ct.packetsPerSecond, ct.spokesPerSecond, ct.megabytesPerSecond);
+        else
+            LOG_WARNING(m_logger, "{}: {:.1f} packets/s, {:.1f} spokes/s, {:.3f} MB/s, {} packets dropped by the kernel, {} spokes dropped, shedding load: {} ({:.0f}% backlog)", ct.label,
+                        ct.packetsPerSecond, ct.spokesPerSecond, ct.megabytesPerSecond, ct.kernelDrops, ct.droppedSpokes,
+                        overloadLevelName(ct.overloadLevel), ct.receiveBacklog*100);
+    }
+}
+
+void RadarManager::logThreadReports()
+{
+    for(auto r: radars())
+    {
+        for(auto const &report: r->threadReports())
+        {
+            if(report.affinityApplied && report.realtimeApplied)
+                LOG_INFO(m_logger, "{}", report.str());
+            else
+                LOG_WARNING(m_logger, "{}", report.str());
+        }
+        auto socket = r->socketReport();
+        if(socket.name.empty())
+            continue;
+        if(socket.applied)
+            LOG_INFO(m_logger, "{}", socket.str());
+        else
+            LOG_WARNING(m_logger, "{}", socket.str());
+    }
+}
+
+} // namespace halo_radar
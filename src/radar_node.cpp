@@ -11,8 +11,24 @@
 #include <string>
 #include <thread>
 #include <sstream>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
 
 #include "radar.h"
+#include "radar_manager.h"
+#include "shm_ring.h"
+#include "spoke_codec.h"
+#include "cfar.h"
+#include "tracker.h"
+#include "persistence_filter.h"
+#include "interference_filter.h"
+#include "range_resampler.h"
+#include "revolution_archive.h"
+#include "sector_capture.h"
+#include "metrics.h"
+#include "thread_utils.h"
 #include "angular_speed_estimator.h"
 #include "logger.h"
 
@@ -67,10 +83,13 @@ struct RadarControlValue
 class HaloRadar : public halo_radar::Radar
 {
 public:
-    HaloRadar(halo_radar::AddressSet const &addresses) : halo_radar::Radar(addresses)
+    HaloRadar(halo_radar::AddressSet const &addresses, halo_radar::RadarConfig const &config = halo_radar::RadarConfig())
+        : halo_radar::Radar(addresses, config)
     {
         m_rangeCorrectionFactor = 1.024; // Default value
         m_frame_id = "radar";            // Default frame ID
+        m_sectorsPublished = halo_radar::MetricsRegistry::global().counter("halo_radar_sectors_published_total", "Sectors handed to publishData.",
+                                                                           {{"channel", addresses.label}});
         startHeartbeatTimer();
         startThreads();
     }
@@ -87,6 +106,8 @@ public:
         stopHeartbeatTimer();
     }
 
+    double rangeCorrectionFactor() const { return m_rangeCorrectionFactor; }
+
 protected:
     void processData(std::vector<halo_radar::Scanline> const &scanlines) override
     {
@@ -115,15 +136,9 @@ protected:
         }
 
         auto angular_speed = m_estimator.update(rs.stamp, rs.angle_start);
-        double scan_time = 0.0;
-        if (angular_speed != 0.0)
-            scan_time = 2 * M_PI / fabs(angular_speed);
-
+        double scan_time, time_increment;
+        scanTiming(angular_speed, rs.angle_increment, scan_time, time_increment);
         rs.scan_time = std::chrono::duration<double>(scan_time);
-
-        double time_increment = 0.0;
-        if (scan_time > 0)
-            time_increment = std::abs(rs.angle_increment) / scan_time;
         rs.time_increment = std::chrono::duration<double>(time_increment);
 
         publishData(rs);
@@ -236,11 +251,12 @@ private:
         }
     }
 
-    void publishData(const RadarSector &rs)
+    void publishData(const RadarSector &/*rs*/)
     {
         // Implement handling of radar data
-        // For example, print data or process it further
-        std::cout << "Radar data received at time: " << std::chrono::duration_cast<std::chrono::milliseconds>(rs.stamp.time_since_epoch()).count() << " ms" << std::endl;
+        // For example, print data or process it further; throughput and
+        // latency are on the metrics endpoint
+        m_sectorsPublished->add();
     }
 
     void publishState(const RadarControlSet &rcs)
@@ -267,14 +283,28 @@ private:
     AngularSpeedEstimator m_estimator;
     std::thread m_heartbeatThread;
     bool m_running = true;
+    std::shared_ptr<halo_radar::Counter> m_sectorsPublished;
 };
 
 std::shared_ptr<halo_radar::HeadingSender> headingSender;
 
-// Function to handle user commands
-void commandHandler(std::shared_ptr<HaloRadar> radar)
+// Forwards commands to one channel, or to every channel for "all"
+struct ChannelSender
+{
+    halo_radar::RadarManager &manager;
+    std::string channel;
+    void sendCommand(std::string const &key, std::string const &value)
+    {
+        if (!manager.sendCommand(channel, key, value))
+            std::cerr << "No radar on channel " << channel << std::endl;
+    }
+};
+
+// Function to handle user commands, sent to the selected channel
+void commandHandler(halo_radar::RadarManager &manager)
 {
     std::string line;
+    std::string channel = "all";
     std::cout << "Enter commands (type 'help' for a list of commands, 'exit' to quit):" << std::endl;
     while (true)
     {
@@ -295,6 +325,8 @@ void commandHandler(std::shared_ptr<HaloRadar> radar)
         if (command == "help")
         {
             std::cout << "Supported commands:" << std::endl;
+            std::cout << "  channel [HaloA|HaloB|all]" << std::endl;
+            std::cout << "  stats" << std::endl;
             std::cout << "  status [standby|transmit]" << std::endl;
             std::cout << "  range [value]" << std::endl;
             std::cout << "  gain [value|auto]" << std::endl;
@@ -304,10 +336,41 @@ void commandHandler(std::shared_ptr<HaloRadar> radar)
             continue;
         }
 
+        if (command == "stats")
+        {
+            for (auto const &ct : manager.throughput())
+                std::cout << "  " << ct.label << ": " << ct.packetsPerSecond << " packets/s, " << ct.spokesPerSecond
+                          << " spokes/s, " << ct.megabytesPerSecond << " MB/s" << std::endl;
+            for (auto const &r : manager.radars())
+            {
+                auto cs = r->commandStatistics();
+                std::cout << "  " << r->addresses().label << " commands: " << cs.submitted << " submitted, " << cs.coalesced
+                          << " coalesced, " << cs.datagrams << " datagrams in " << cs.batches << " batches, "
+                          << cs.acknowledged << " acknowledged (mean " << cs.meanRoundTripSeconds * 1000.0 << " ms, max "
+                          << cs.maxRoundTripSeconds * 1000.0 << " ms), " << cs.timedOut << " timed out" << std::endl;
+            }
+            continue;
+        }
+
         // Parse command and arguments
         std::string arg1;
         iss >> arg1;
 
+        if (command == "channel")
+        {
+            if (arg1 == "all" || manager.radar(arg1))
+            {
+                channel = arg1;
+                std::cout << "Commands now go to " << channel << std::endl;
+            }
+            else
+                std::cerr << "Unknown channel " << arg1 << std::endl;
+            continue;
+        }
+
+        ChannelSender channelSender{manager, channel};
+        auto radar = &channelSender;
+
         if (command == "status" && (arg1 == "standby" || arg1 == "transmit" || arg1 == "spinning_up" || arg1 == "unknown"))
         {
             radar->sendCommand(command, arg1);
@@ -442,58 +505,371 @@ int main(int argc, char **argv)
     // Grab logger
     quill::Logger *logger = initialize_logger();
 
-    std::vector<std::shared_ptr<HaloRadar>> radars;
+    halo_radar::RadarManager manager(logger, [](halo_radar::AddressSet const &addresses, halo_radar::RadarConfig const &config)
+                                     { return std::make_shared<HaloRadar>(addresses, config); });
     std::vector<uint32_t> hostIPs;
+    int statsInterval = 0;
+    int realtimePriority = 0;
+    std::string shmPrefix;
+    std::string archivePrefix;
+    std::string capturePrefix;
+    bool codecStats = false;
+    std::map<std::string, std::shared_ptr<halo_radar::SpokeCodecMeter>> codecMeters;
+    // guards the per channel stats maps, filled as channels start
+    std::mutex statsMutex;
+    bool cfar = false;
+    halo_radar::CfarConfig cfarConfig;
+    std::map<std::string, std::shared_ptr<std::atomic<uint64_t>>> cfarDetections;
+    bool track = false;
+    bool persistence = false;
+    bool interferenceFilter = false;
+    float resampleMetersPerBin = 0.0;
+    std::map<std::string, std::shared_ptr<halo_radar::InterferenceFilter>> interferenceFilters;
+    std::map<std::string, std::shared_ptr<std::atomic<uint64_t>>> confirmedTracks;
+    float guardZoneMeters = 0.0;
+    bool regionsOnly = false;
+    std::map<std::string, std::shared_ptr<std::atomic<uint64_t>>> guardZoneEchoes;
+    auto cache = std::make_shared<halo_radar::DiscoveryCache>("radar_discovery.cache");
+    size_t prefaultMegabytes = 64;
+    int metricsPort = 0;
+    int receiveBufferBytes = 0;
+    int busyPollMicroseconds = 0;
+    bool packetRing = false;
+    bool xdp = false;
+    bool xdpNative = false;
+    bool shedding = true;
     // Optionally populate hostIPs from command-line arguments or configuration
 
-    // Start the scanning thread
-    std::future<void> scanResult = std::async(std::launch::async, [&]()
-                                              {
-        while (radars.empty())
+    // Per channel thread placement, e.g. --data-cpus HaloA=2 --report-cpus HaloA=3
+    std::map<std::string, halo_radar::RadarConfig> channelConfigs;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if ((arg == "--data-cpus" || arg == "--report-cpus") && i + 1 < argc)
         {
-            std::vector<halo_radar::AddressSet> as;
-            if (hostIPs.empty())
-                as = halo_radar::scan(logger);
-            else
-                as = halo_radar::scan(logger, hostIPs);
-            if (as.empty())
-                LOG_ERROR(logger, "No radars found!");
-            for (auto a : as)
+            std::string value = argv[++i];
+            auto eq = value.find('=');
+            if (eq == std::string::npos)
             {
-                radars.push_back(std::make_shared<HaloRadar>(a));
-                if (!headingSender)
-                    headingSender = std::make_shared<halo_radar::HeadingSender>(a.interface);
+                LOG_ERROR(logger, "Expected LABEL=CPUS after {}, got {}", arg, value);
+                return -1;
             }
-            if (radars.empty())
-                std::this_thread::sleep_for(std::chrono::seconds(1));
-        } });
+            auto cpus = halo_radar::parseCpuList(value.substr(eq + 1));
+            auto &config = channelConfigs[value.substr(0, eq)];
+            if (arg == "--data-cpus")
+                config.dataCpus = cpus;
+            else
+                config.reportCpus = cpus;
+        }
+        else if (arg == "--realtime" && i + 1 < argc)
+            realtimePriority = std::atoi(argv[++i]);
+        else if (arg == "--prefault-mb" && i + 1 < argc)
+            prefaultMegabytes = std::atoi(argv[++i]);
+        else if (arg == "--cache" && i + 1 < argc)
+            cache = std::make_shared<halo_radar::DiscoveryCache>(argv[++i]);
+        else if (arg == "--no-cache")
+            cache.reset();
+        else if (arg == "--shm" && i + 1 < argc)
+            shmPrefix = argv[++i];
+        else if (arg == "--capture" && i + 1 < argc)
+            capturePrefix = argv[++i];
+        else if (arg == "--archive" && i + 1 < argc)
+            archivePrefix = argv[++i];
+        else if (arg == "--codec-stats")
+            codecStats = true;
+        else if (arg == "--cfar" && i + 1 < argc)
+        {
+            std::string type = argv[++i];
+            cfar = true;
+            cfarConfig.type = type == "os" ? halo_radar::CFAR_ORDERED_STATISTIC : halo_radar::CFAR_CELL_AVERAGING;
+        }
+        else if (arg == "--resample" && i + 1 < argc)
+            resampleMetersPerBin = std::atof(argv[++i]);
+        else if (arg == "--interference-filter")
+            interferenceFilter = true;
+        else if (arg == "--persistence")
+            persistence = true;
+        else if (arg == "--track")
+            track = true;
+        else if (arg == "--no-numa")
+            manager.setNumaAware(false);
+        else if (arg == "--rcvbuf" && i + 1 < argc)
+            receiveBufferBytes = std::atoi(argv[++i]);
+        else if (arg == "--busy-poll" && i + 1 < argc)
+            busyPollMicroseconds = std::atoi(argv[++i]);
+        else if (arg == "--packet-ring")
+            packetRing = true;
+        else if (arg == "--xdp")
+            xdp = true;
+        else if (arg == "--xdp-native")
+            xdp = xdpNative = true;
+        else if (arg == "--no-shedding")
+            shedding = false;
+        else if (arg == "--guard-zone" && i + 1 < argc)
+            guardZoneMeters = std::atof(argv[++i]);
+        else if (arg == "--regions-only")
+            regionsOnly = true;
+        else if (arg == "--metrics-port" && i + 1 < argc)
+            metricsPort = std::atoi(argv[++i]);
+        else if (arg == "--stats-interval" && i + 1 < argc)
+            statsInterval = std::atoi(argv[++i]);
+        else if (arg == "--interface" && i + 1 < argc)
+            hostIPs.push_back(halo_radar::ipAddressFromString(argv[++i]));
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--interface IP]... [--data-cpus LABEL=CPUS]... [--report-cpus LABEL=CPUS]... [--cache PATH|--no-cache] [--shm PREFIX] [--archive PREFIX] [--capture PREFIX] [--codec-stats] [--cfar ca|os] [--interference-filter] [--persistence] [--resample METERS_PER_BIN] [--track] [--guard-zone METERS [--regions-only]] [--no-numa] [--rcvbuf BYTES] [--busy-poll USECS] [--packet-ring|--xdp|--xdp-native] [--no-shedding] [--metrics-port PORT] [--stats-interval SECONDS] [--realtime PRIORITY [--prefault-mb MB]]" << std::endl;
+            return -1;
+        }
+    }
+    // Real-time mode: data threads at the given SCHED_FIFO priority, report
+    // threads just below, with all memory locked and prefaulted up front
+    halo_radar::RadarConfig defaultConfig;
+    if (realtimePriority > 0)
+    {
+        auto report = halo_radar::lockProcessMemory(prefaultMegabytes * 1024 * 1024, 512 * 1024);
+        if (report.locked)
+            LOG_INFO(logger, "Real-time mode: {}", report.str());
+        else
+            LOG_WARNING(logger, "Real-time mode: {}", report.str());
+        defaultConfig.dataPriority = realtimePriority;
+        defaultConfig.reportPriority = std::max(1, realtimePriority - 1);
+    }
+    // Data socket sizing for bursts, and busy polling for latency; or the
+    // AF_PACKET ring or AF_XDP instead of the socket, given the capabilities
+    defaultConfig.receiveBufferBytes = receiveBufferBytes;
+    defaultConfig.busyPollMicroseconds = busyPollMicroseconds;
+    if (packetRing)
+        defaultConfig.backend = halo_radar::RECEIVE_PACKET_RING;
+    if (xdp)
+        defaultConfig.backend = halo_radar::RECEIVE_XDP;
+    defaultConfig.xdpNativeMode = xdpNative;
+    // Under CPU pressure the data path gives up resolution rather than
+    // whole sectors, unless asked to keep full fidelity and drop instead
+    defaultConfig.overload.enabled = shedding;
+    // Only decode what region subscriptions such as the guard zone cover,
+    // sectors are then not published
+    defaultConfig.decodeWholeSpokes = !regionsOnly;
+    manager.setDefaultConfig(defaultConfig);
+    // channels given cpus differ from the defaults in placement only
+    for (auto const &cc : channelConfigs)
+    {
+        auto config = defaultConfig;
+        config.dataCpus = cc.second.dataCpus;
+        config.reportCpus = cc.second.reportCpus;
+        manager.setChannelConfig(cc.first, config);
+    }
+
+    // Prometheus scrape endpoint, local only; a proxy or agent on the host
+    // forwards it if needed
+    halo_radar::MetricsServer metricsServer;
+    if (metricsPort > 0)
+    {
+        if (metricsServer.start(htonl(INADDR_LOOPBACK), metricsPort))
+            LOG_INFO(logger, "Metrics on http://127.0.0.1:{}/metrics", metricsPort);
+        else
+            LOG_ERROR(logger, "Could not serve metrics on port {}: {}", metricsPort, strerror(errno));
+    }
+
+    // Start cached channels right away and discover in the background
+    // with --shm, each channel is published to PREFIX_<label>_spokes and
+    // PREFIX_<label>_revolutions for other processes
+    manager.discover(hostIPs, std::chrono::seconds(1), cache, [&](halo_radar::AddressSet const &a)
+                     {
+                         // filters first, so everything after them sees filtered spokes
+                         if (interferenceFilter && manager.radar(a.label))
+                         {
+                             auto filter = std::make_shared<halo_radar::InterferenceFilter>();
+                             manager.radar(a.label)->addStage(filter);
+                             const std::lock_guard<std::mutex> lock(statsMutex);
+                             interferenceFilters[a.label] = filter;
+                         }
+                         if (persistence && manager.radar(a.label))
+                             manager.radar(a.label)->addStage(std::make_shared<halo_radar::PersistenceStage>());
+                         // one range grid for all range settings, after the filters
+                         // since those compare bins of neighbouring spokes
+                         if (resampleMetersPerBin > 0.0 && manager.radar(a.label))
+                         {
+                             halo_radar::ResampleConfig resample;
+                             resample.metersPerBin = resampleMetersPerBin;
+                             auto haloRadar = std::dynamic_pointer_cast<HaloRadar>(manager.radar(a.label));
+                             if (haloRadar)
+                                 resample.rangeCorrection = haloRadar->rangeCorrectionFactor();
+                             manager.radar(a.label)->addStage(std::make_shared<halo_radar::RangeResampler>(resample));
+                         }
+                         if (codecStats && manager.radar(a.label))
+                         {
+                             auto meter = std::make_shared<halo_radar::SpokeCodecMeter>();
+                             manager.radar(a.label)->addStage(meter);
+                             const std::lock_guard<std::mutex> lock(statsMutex);
+                             codecMeters[a.label] = meter;
+                         }
+                         if (cfar && manager.radar(a.label))
+                         {
+                             auto detections = std::make_shared<std::atomic<uint64_t>>(0);
+                             manager.radar(a.label)->addStage(std::make_shared<halo_radar::CfarStage>(cfarConfig, [detections](std::vector<halo_radar::CfarDetection> const &d)
+                                                                                                     { detections->fetch_add(d.size(), std::memory_order_relaxed); }));
+                             const std::lock_guard<std::mutex> lock(statsMutex);
+                             cfarDetections[a.label] = detections;
+                         }
+                         // contacts of each revolution feed a tracker on its own thread,
+                         // dropping revolutions rather than holding up the data thread
+                         if (track && manager.radar(a.label))
+                         {
+                             auto confirmed = std::make_shared<std::atomic<uint64_t>>(0);
+                             auto extractor = std::make_shared<halo_radar::BlobExtractor>();
+                             auto tracker = std::make_shared<halo_radar::Tracker>();
+                             auto contacts = std::make_shared<std::vector<halo_radar::Contact>>();
+                             auto updates = std::make_shared<std::vector<halo_radar::TrackUpdate>>();
+                             halo_radar::SubscriptionConfig trackSubscription;
+                             trackSubscription.name = "track";
+                             trackSubscription.capacity = 2;
+                             trackSubscription.policy = halo_radar::BACKPRESSURE_DROP_OLDEST;
+                             manager.radar(a.label)->subscribeRevolutions(trackSubscription, [=](halo_radar::RevolutionPtr const &revolution)
+                                                                          {
+                                                                              extractor->extract(*revolution, *contacts);
+                                                                              tracker->update(revolution->number, revolution->stamp, *contacts, *updates);
+                                                                              uint64_t n = 0;
+                                                                              for (auto const &u : *updates)
+                                                                                  n += u.status == halo_radar::TRACK_CONFIRMED || u.status == halo_radar::TRACK_COASTING;
+                                                                              confirmed->store(n, std::memory_order_relaxed); });
+                             const std::lock_guard<std::mutex> lock(statsMutex);
+                             confirmedTracks[a.label] = confirmed;
+                         }
+                         // with --capture, sectors go to PREFIX_<label>.hrs for radar_reprocess
+                         if (!capturePrefix.empty() && manager.radar(a.label))
+                         {
+                             auto capture = std::make_shared<halo_radar::SectorCaptureStage>(capturePrefix + "_" + a.label + ".hrs", a.label);
+                             if (capture->isOpen())
+                                 manager.radar(a.label)->addStage(capture);
+                             else
+                                 LOG_ERROR(logger, "{}: could not create capture: {}", a.label, strerror(errno));
+                         }
+                         // with --archive, revolutions go to PREFIX_<label>.hra, written on
+                         // their own thread so a slow disk drops revolutions from the archive
+                         // instead of holding up the data thread; an index block every 16
+                         // revolutions, readers of the live file index the rest from the chunks
+                         if (!archivePrefix.empty() && manager.radar(a.label))
+                         {
+                             auto writer = std::make_shared<halo_radar::ArchiveWriter>();
+                             if (writer->open(archivePrefix + "_" + a.label + ".hra", 16))
+                             {
+                                 halo_radar::SubscriptionConfig archiveSubscription;
+                                 archiveSubscription.name = "archive";
+                                 archiveSubscription.capacity = 4;
+                                 archiveSubscription.policy = halo_radar::BACKPRESSURE_DROP_OLDEST;
+                                 manager.radar(a.label)->subscribeRevolutions(archiveSubscription, [writer](halo_radar::RevolutionPtr const &revolution)
+                                                                              { writer->write(*revolution); });
+                             }
+                             else
+                                 LOG_ERROR(logger, "{}: could not create archive: {}", a.label, strerror(errno));
+                         }
+                         // with --guard-zone, strong echoes within METERS all around are
+                         // counted from a region subscription
+                         if (guardZoneMeters > 0.0 && manager.radar(a.label))
+                         {
+                             auto echoes = std::make_shared<std::atomic<uint64_t>>(0);
+                             halo_radar::RegionOfInterest guardZone;
+                             guardZone.maxRange = guardZoneMeters;
+                             halo_radar::SubscriptionConfig guardSubscription;
+                             guardSubscription.name = "guard_zone";
+                             manager.radar(a.label)->subscribeRegion(guardZone, guardSubscription, [echoes](halo_radar::RegionView const &spoke)
+                                                                     {
+                                                                         uint64_t n = 0;
+                                                                         for (size_t i = 0; i < spoke.count; i++)
+                                                                             n += spoke.intensities[i] >= 8;
+                                                                         echoes->fetch_add(n, std::memory_order_relaxed); });
+                             const std::lock_guard<std::mutex> lock(statsMutex);
+                             guardZoneEchoes[a.label] = echoes;
+                         }
+                         if (!shmPrefix.empty())
+                         {
+                             auto publisher = std::make_shared<halo_radar::ShmPublisher>(shmPrefix + "_" + a.label);
+                             auto radar = manager.radar(a.label);
+                             if (publisher->isOpen() && radar)
+                                 radar->addStage(publisher);
+                         }
+                         if (!headingSender)
+                             headingSender = std::make_shared<halo_radar::HeadingSender>(a.interface);
+                     });
 
     // Wait until at least one radar is found
-    scanResult.wait();
+    while (manager.empty())
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
 
-    if (radars.empty())
+    if (manager.empty())
     {
         LOG_CRITICAL(logger, "Failed to find any radars. Exiting.");
         return -1;
     }
 
+    // Startup report of what the channel threads actually got; each data
+    // thread logs its own again with the page faults once warmed up
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    manager.logThreadReports();
+
+    // Periodic per channel throughput report
+    std::atomic<bool> running(true);
+    std::thread statsThread;
+    if (statsInterval > 0)
+        statsThread = std::thread([&]()
+                                  {
+            auto next = std::chrono::steady_clock::now();
+            while (running)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                if (std::chrono::steady_clock::now() - next >= std::chrono::seconds(statsInterval))
+                {
+                    manager.logThroughput();
+                    {
+                        const std::lock_guard<std::mutex> lock(statsMutex);
+                        for (auto const &cm : codecMeters)
+                        {
+                            auto cs = cm.second->take();
+                            LOG_INFO(logger, "{}: spoke codec ratio {:.2f} over {} spokes, {:.0f} MB/s", cm.first, cs.ratio(), cs.spokes, cs.megabytesPerSecond());
+                        }
+                        for (auto const &cd : cfarDetections)
+                            LOG_INFO(logger, "{}: {} CFAR detections", cd.first, cd.second->exchange(0));
+                        for (auto const &f : interferenceFilters)
+                        {
+                            auto is = f.second->take();
+                            LOG_INFO(logger, "{}: interference filter replaced {} cells ({:.3f}%) over {} spokes", f.first, is.replacedCells, 100.0 * is.replacedFraction(), is.spokes);
+                        }
+                        for (auto const &ct : confirmedTracks)
+                            LOG_INFO(logger, "{}: {} confirmed tracks", ct.first, ct.second->load());
+                        for (auto const &gz : guardZoneEchoes)
+                            LOG_INFO(logger, "{}: {} strong echo bins in the guard zone", gz.first, gz.second->exchange(0));
+                    }
+                    if (realtimePriority > 0)
+                        manager.logThreadReports();
+                    next = std::chrono::steady_clock::now();
+                }
+            } });
+
     // Start the command handler thread
-    std::thread cmdThread(commandHandler, radars[0]); // Assuming single radar
+    std::thread cmdThread(commandHandler, std::ref(manager));
 
     // Optionally, perform other tasks or enter a main loop here
 
     // Wait for the command thread to finish (user types 'exit')
     cmdThread.join();
 
+    running = false;
+    if (statsThread.joinable())
+        statsThread.join();
+
     // Clean up resources
-    for (auto radar : radars)
+    for (auto radar : manager.radars())
     {
-        radar->stopHeartbeatTimer();
+        auto haloRadar = std::dynamic_pointer_cast<HaloRadar>(radar);
+        if (haloRadar)
+            haloRadar->stopHeartbeatTimer();
     }
+    manager.stopDiscovery();
+    manager.clear();
 
     // Optionally, perform additional cleanup or logging here
 
     LOG_INFO(logger, "Exiting radar application.");
 
     return 0;
-}
\ No newline at end of file
+}
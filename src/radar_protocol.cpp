@@ -0,0 +1,227 @@
+#include "radar_protocol.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace halo_radar
+{
+
+const ReportDescriptor *findReport(uint16_t id)
+{
+    if((id & 0xfff0) == 0xc400)
+    {
+        uint8_t i = report_index[id & 0x0f];
+        return i == 0xff ? nullptr : &reports[i];
+    }
+    for(auto const &r: reports)
+        if(r.id == id)
+            return &r;
+    return nullptr;
+}
+
+const CommandDescriptor *findCommand(std::string const &key)
+{
+    size_t slot = fnv1a(key.data(), key.size()) % command_slots;
+    while(command_index[slot] != 0xff)
+    {
+        const CommandDescriptor &c = commands[command_index[slot]];
+        if(key == c.key)
+            return &c;
+        slot = (slot + 1) % command_slots;
+    }
+    return nullptr;
+}
+
+namespace
+{
+
+int64_t readField(const uint8_t *data, ReportField const &f)
+{
+    switch(f.width)
+    {
+        case 1:
+            return f.isSigned ? int64_t(int8_t(data[f.offset])) : int64_t(data[f.offset]);
+        case 2:
+        {
+            uint16_t v;
+            memcpy(&v, data + f.offset, sizeof(v));
+            return f.isSigned ? int64_t(int16_t(v)) : int64_t(v);
+        }
+        default:
+        {
+            uint32_t v;
+            memcpy(&v, data + f.offset, sizeof(v));
+            return f.isSigned ? int64_t(int32_t(v)) : int64_t(v);
+        }
+    }
+}
+
+const char *enumName(EnumNames const &names, int64_t wire)
+{
+    for(size_t i = 0; i < names.count; i++)
+        if(names.names[i].wire == wire)
+            return names.names[i].name;
+    return names.unknown;
+}
+
+uint8_t enumWire(EnumNames const &names, std::string const &name)
+{
+    for(size_t i = 0; i < names.count; i++)
+        if(name == names.names[i].name)
+            return names.names[i].wire;
+    return 0;
+}
+
+const char *findValue(const ReportValue *values, int count, const char *key)
+{
+    for(int i = 0; i < count; i++)
+        if(strcmp(values[i].key, key) == 0)
+            return values[i].value;
+    return nullptr;
+}
+
+struct CommandWriter
+{
+    uint8_t *data;
+    int &size;
+
+    template<typename T> void put(T value)
+    {
+        memcpy(data + size, &value, sizeof(T));
+        size += sizeof(T);
+    }
+};
+
+} // namespace
+
+int decodeReport(const uint8_t *data, int size, ReportValue *values)
+{
+    if(size < 2)
+        return 0;
+    uint16_t id;
+    memcpy(&id, data, sizeof(id));
+    const ReportDescriptor *r = findReport(id);
+    if(!r)
+        return -1;
+    if(size < r->size)
+        return 0;
+    for(size_t i = 0; i < r->fieldCount; i++)
+    {
+        ReportField const &f = r->fields[i];
+        ReportValue &v = values[i];
+        v.key = f.key;
+        int64_t raw = readField(data, f);
+        // same text as std::to_string, which the state has always used
+        switch(f.kind)
+        {
+            case VALUE_ENUM:
+                snprintf(v.value, sizeof(v.value), "%s", enumName(*f.names, raw));
+                break;
+            case VALUE_INTEGER:
+                snprintf(v.value, sizeof(v.value), "%lld", (long long)(raw/f.divisor));
+                break;
+            case VALUE_REAL:
+                snprintf(v.value, sizeof(v.value), "%f", double(raw*f.multiplier)/f.divisor);
+                break;
+            case VALUE_AUTO_FLAG:
+                snprintf(v.value, sizeof(v.value), "%s", raw ? "auto" : "manual");
+                break;
+        }
+    }
+    return int(r->fieldCount);
+}
+
+bool reportConfirms(CommandDescriptor const &command, std::string const &value, const ReportValue *values, int count)
+{
+    const char *reported = findValue(values, count, command.key);
+    if(command.modeKey)
+    {
+        const char *mode = findValue(values, count, command.modeKey);
+        if(!mode)
+            return false;
+        if(command.allowAuto && value == "auto")
+            return strcmp(mode, "auto") == 0;
+        if(strcmp(mode, "manual") != 0)
+            return false;
+    }
+    if(!reported)
+        return false;
+    if(command.kind == COMMAND_STATUS || command.kind == COMMAND_ENUM)
+        return value == reported;
+    // the command truncates to a wire step and the report may round to
+    // another, so allow a step either way
+    char *end;
+    double requested = strtod(value.c_str(), &end);
+    if(end == value.c_str())
+        return false;
+    return std::fabs(strtod(reported, nullptr) - requested) < 2*command.step;
+}
+
+bool encodeCommand(std::string const &key, std::string const &value, CommandPackets &packets)
+{
+    packets.count = 0;
+    const CommandDescriptor *c = findCommand(key);
+    if(!c)
+        return false;
+
+    packets.size[0] = 0;
+    CommandWriter out{packets.data[0], packets.size[0]};
+    out.put(c->id);
+    switch(c->kind)
+    {
+        case COMMAND_STATUS:
+        {
+            if(value != "transmit" && value != "standby")
+                return false;
+            out.put(uint8_t(1));
+            packets.size[1] = 0;
+            CommandWriter second{packets.data[1], packets.size[1]};
+            second.put(uint16_t(c->id + 1));
+            second.put(uint8_t(value == "transmit" ? 1 : 0));
+            packets.count = 2;
+            return true;
+        }
+        case COMMAND_ENUM:
+            out.put(enumWire(*c->names, value));
+            break;
+        case COMMAND_VALUE16:
+            out.put(uint16_t(std::stof(value)*c->scale));
+            break;
+        case COMMAND_VALUE32:
+            out.put(uint32_t(std::stof(value)*c->scale));
+            break;
+        case COMMAND_LEVEL:
+            out.put(uint32_t(c->sub));
+            if(c->allowAuto && value == "auto")
+            {
+                out.put(uint32_t(1));
+                out.put(uint8_t(0));
+            }
+            else
+            {
+                uint8_t level = std::stof(value)*255/100;
+                out.put(uint32_t(0));
+                out.put(level);
+            }
+            break;
+        case COMMAND_ONE_VALUE32:
+            out.put(uint32_t(1));
+            out.put(uint32_t(std::stof(value)*c->scale));
+            break;
+        case COMMAND_NUDGE:
+        {
+            int8_t nudge = std::stof(value);
+            out.put(c->sub);
+            out.put(nudge);
+            out.put(nudge);
+            out.put(uint8_t(0x04));
+            break;
+        }
+    }
+    packets.count = 1;
+    return true;
+}
+
+} // namespace halo_radar
@@ -0,0 +1,294 @@
+// Offline fix up of sector capture files, in one streaming pass:
+//  - angle increments of sectors that cross forward, which were computed
+//    the wrong way round the circle
+//  - scan times and time increments, from a per channel estimate of the
+//    antenna speed
+// Each file is read, fixed and written on its own three threads, with
+// several files in flight at once, so a fleet of recordings goes through at
+// disk speed. Payloads stay compressed throughout, only headers change.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+
+#include "sector_capture.h"
+#include "angular_speed_estimator.h"
+
+namespace
+{
+
+// Sectors travel between the threads in batches to keep locking rare.
+struct Batch
+{
+    std::vector<halo_radar::SectorRecord> records;
+    std::vector<std::vector<uint8_t>> payloads;
+};
+
+const size_t batch_sectors = 256;
+const size_t queue_batches = 8;
+
+template <typename T>
+class BoundedQueue
+{
+public:
+    // Blocks while full. Returns false once closed.
+    bool push(T &&item)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notFull.wait(lock, [this]
+                       { return m_items.size() < queue_batches || m_closed; });
+        if (m_closed)
+            return false;
+        m_items.push_back(std::move(item));
+        m_notEmpty.notify_one();
+        return true;
+    }
+
+    // Blocks while empty. Returns false once closed and drained.
+    bool pop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notEmpty.wait(lock, [this]
+                        { return !m_items.empty() || m_closed; });
+        if (m_items.empty())
+            return false;
+        item = std::move(m_items.front());
+        m_items.pop_front();
+        m_notFull.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+        m_notEmpty.notify_all();
+        m_notFull.notify_all();
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_notEmpty;
+    std::condition_variable m_notFull;
+    std::deque<T> m_items;
+    bool m_closed = false;
+};
+
+void fixAngleIncrement(halo_radar::SectorRecord &record)
+{
+    // angles decrease as the antenna turns, a positive increment means the
+    // sector was measured across forward the long way round
+    if (record.scanlines > 1 && record.angleIncrement > 0.0)
+    {
+        double angle_finish = record.angleStart + record.angleIncrement * (record.scanlines - 1);
+        angle_finish -= 2 * M_PI;
+        record.angleIncrement = (angle_finish - record.angleStart) / double(record.scanlines - 1);
+    }
+}
+
+void fixScanTime(halo_radar::SectorRecord &record, AngularSpeedEstimator &estimator)
+{
+    TimePoint t(std::chrono::duration_cast<TimePoint::duration>(std::chrono::nanoseconds(record.stamp)));
+    double scan_time, time_increment;
+    // the same timing HaloRadar::processData publishes
+    scanTiming(estimator.update(t, record.angleStart), record.angleIncrement, scan_time, time_increment);
+    record.scanTime = scan_time;
+    record.timeIncrement = time_increment;
+}
+
+struct FileResult
+{
+    bool ok = false;
+    uint64_t sectors = 0;
+    uint64_t bytes = 0;
+};
+
+// Whether two paths name the same existing file.
+bool sameFile(std::string const &a, std::string const &b)
+{
+    struct stat sa, sb;
+    return stat(a.c_str(), &sa) == 0 && stat(b.c_str(), &sb) == 0 &&
+           sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+FileResult reprocessFile(std::string const &in, std::string const &out)
+{
+    FileResult result;
+    // opening the output would truncate the capture being read
+    if (sameFile(in, out))
+    {
+        std::cerr << in << ": output would overwrite the input, skipped" << std::endl;
+        return result;
+    }
+    halo_radar::SectorCaptureReader reader;
+    if (!reader.open(in))
+    {
+        std::cerr << in << ": not a sector capture file" << std::endl;
+        return result;
+    }
+    halo_radar::SectorCaptureWriter writer;
+    if (!writer.open(out))
+    {
+        std::cerr << out << ": " << strerror(errno) << std::endl;
+        return result;
+    }
+
+    BoundedQueue<Batch> toFix;
+    BoundedQueue<Batch> toWrite;
+    std::atomic<bool> writeFailed(false);
+    bool readFailed = false;
+
+    std::thread readThread([&]()
+                           {
+        Batch batch;
+        halo_radar::SectorRecord record;
+        std::vector<uint8_t> payload;
+        bool stopped = false;
+        while (reader.next(record, payload))
+        {
+            batch.records.push_back(record);
+            batch.payloads.push_back(std::move(payload));
+            payload = std::vector<uint8_t>();
+            if (batch.records.size() == batch_sectors)
+            {
+                if (!toFix.push(std::move(batch)))
+                {
+                    stopped = true;
+                    break;
+                }
+                batch = Batch();
+            }
+        }
+        readFailed = !stopped && !reader.atEnd();
+        if (!batch.records.empty())
+            toFix.push(std::move(batch));
+        toFix.close(); });
+
+    // estimation is sequential per channel, so one thread does all of it
+    std::thread fixThread([&]()
+                          {
+        std::map<std::string, AngularSpeedEstimator> estimators;
+        Batch batch;
+        while (toFix.pop(batch))
+        {
+            for (auto &record : batch.records)
+            {
+                fixAngleIncrement(record);
+                std::string channel(record.channel, strnlen(record.channel, sizeof(record.channel)));
+                fixScanTime(record, estimators[channel]);
+            }
+            if (!toWrite.push(std::move(batch)))
+                break;
+        }
+        toWrite.close(); });
+
+    Batch batch;
+    while (toWrite.pop(batch))
+    {
+        for (size_t i = 0; i < batch.records.size(); i++)
+        {
+            if (!writer.write(batch.records[i], batch.payloads[i].data(), batch.payloads[i].size()))
+            {
+                writeFailed = true;
+                break;
+            }
+            result.sectors++;
+            result.bytes += sizeof(halo_radar::SectorRecord) + batch.payloads[i].size();
+        }
+        if (writeFailed)
+        {
+            // unblock the other two
+            toWrite.close();
+            toFix.close();
+            break;
+        }
+    }
+    readThread.join();
+    fixThread.join();
+    writer.close();
+    if (writeFailed)
+        std::cerr << out << ": write failed: " << strerror(errno) << std::endl;
+    else if (readFailed)
+        std::cerr << in << ": corrupt or truncated record after " << result.sectors << " sectors" << std::endl;
+    result.ok = !writeFailed && !readFailed;
+    return result;
+}
+
+std::string outputPath(std::string const &in, std::string const &outputDirectory)
+{
+    if (outputDirectory.empty())
+        return in + ".reprocessed";
+    auto slash = in.rfind('/');
+    return outputDirectory + "/" + (slash == std::string::npos ? in : in.substr(slash + 1));
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    unsigned jobs = std::max(1u, std::thread::hardware_concurrency() / 3);
+    std::string outputDirectory;
+    std::vector<std::string> files;
+    bool usage = false;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "-j" && i + 1 < argc)
+            jobs = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "-o" && i + 1 < argc)
+            outputDirectory = argv[++i];
+        else if (!arg.empty() && arg[0] == '-')
+            usage = true;
+        else
+            files.push_back(arg);
+    }
+    if (files.empty() || usage)
+    {
+        std::cout << "Usage: radar_reprocess [-j JOBS] [-o OUTPUT_DIRECTORY] capture...\n"
+                  << "Fixes angle increments and scan times. Output goes to OUTPUT_DIRECTORY,\n"
+                  << "or next to each input with a .reprocessed suffix.\n";
+        return -1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::atomic<size_t> next(0);
+    std::atomic<uint64_t> sectors(0), bytes(0);
+    std::atomic<int> failed(0);
+    std::mutex outputMutex;
+    auto worker = [&]()
+    {
+        for (size_t i = next++; i < files.size(); i = next++)
+        {
+            auto out = outputPath(files[i], outputDirectory);
+            auto result = reprocessFile(files[i], out);
+            sectors += result.sectors;
+            bytes += result.bytes;
+            if (!result.ok)
+                failed++;
+            const std::lock_guard<std::mutex> lock(outputMutex);
+            std::cout << files[i] << " -> " << out << ": " << result.sectors << " sectors" << (result.ok ? "" : " (failed)") << std::endl;
+        }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned j = 1; j < std::min<size_t>(jobs, files.size()); j++)
+        workers.emplace_back(worker);
+    worker();
+    for (auto &w : workers)
+        w.join();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << sectors << " sectors, " << bytes / 1.0e6 << " MB in " << seconds << " s ("
+              << (seconds > 0 ? bytes / 1.0e6 / seconds : 0.0) << " MB/s)" << std::endl;
+    return failed ? 1 : 0;
+}
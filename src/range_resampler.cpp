@@ -0,0 +1,151 @@
+#include "range_resampler.h"
+
+#include <cmath>
+#include <algorithm>
+
+#include "radar.h"
+
+namespace halo_radar
+{
+
+namespace
+{
+
+// ranges are a few dozen settings, this only guards against a stream of
+// odd values filling memory
+const size_t max_cached_tables = 64;
+
+const uint16_t past_spoke = 0xffff;
+
+} // namespace
+
+RangeResampler::RangeResampler(ResampleConfig const &config):m_config(config),m_rangeCorrection(config.rangeCorrection)
+{
+    m_intensities.reserve(m_config.bins);
+    m_doppler.reserve(m_config.bins);
+}
+
+std::shared_ptr<const RangeResampler::Table> RangeResampler::build(float range, float correction, uint16_t inputBins) const
+{
+    auto t = std::make_shared<Table>();
+    t->taps.resize(m_config.bins);
+    const double inWidth = double(range)*correction/std::max<uint16_t>(inputBins, 1);
+    const double outWidth = m_config.metersPerBin > 0.0 ? m_config.metersPerBin : double(range)*correction/std::max<uint16_t>(m_config.bins, 1);
+    t->range = outWidth*m_config.bins;
+
+    for(size_t j = 0; j < m_config.bins; j++)
+    {
+        Tap &tap = t->taps[j];
+        tap = {past_spoke, 1, 0};
+        if(inWidth <= 0.0 || inputBins == 0)
+            continue;
+        if(outWidth > inWidth)
+        {
+            // wider output bins, maximum over the input bins they overlap
+            size_t first = std::floor(j*outWidth/inWidth);
+            size_t end = std::ceil((j+1)*outWidth/inWidth);
+            end = std::min<size_t>(end, inputBins);
+            if(first >= end)
+                continue;
+            tap.index = first;
+            tap.span = std::min<size_t>(end - first, 255);
+        }
+        else
+        {
+            // narrower output bins, interpolate between input bin centers
+            double x = std::max(0.0, (j + 0.5)*outWidth/inWidth - 0.5);
+            size_t first = x;
+            if(first >= inputBins)
+                continue;
+            tap.index = first;
+            if(first + 1 < inputBins)
+                tap.weight = std::min(255L, std::lround((x - first)*256.0));
+        }
+    }
+    return t;
+}
+
+RangeResampler::Table const *RangeResampler::table(float range, float correction, uint16_t inputBins)
+{
+    Key key(range, correction, inputBins);
+    if(m_last && key == m_lastKey)
+        return m_last.get();
+
+    const std::lock_guard<std::mutex> lock(m_cacheMutex);
+    auto it = m_cache.find(key);
+    if(it == m_cache.end())
+    {
+        if(m_cache.size() >= max_cached_tables)
+            m_cache.clear();
+        it = m_cache.emplace(key, build(range, correction, inputBins)).first;
+    }
+    m_lastKey = key;
+    m_last = it->second;
+    return m_last.get();
+}
+
+void RangeResampler::prewarm(std::vector<float> const &ranges, uint16_t inputBins)
+{
+    const float correction = m_rangeCorrection;
+    for(float range: ranges)
+    {
+        Key key(range, correction, inputBins);
+        auto t = build(range, correction, inputBins);
+        const std::lock_guard<std::mutex> lock(m_cacheMutex);
+        m_cache.emplace(key, t);
+    }
+}
+
+size_t RangeResampler::cachedTables() const
+{
+    const std::lock_guard<std::mutex> lock(m_cacheMutex);
+    return m_cache.size();
+}
+
+void RangeResampler::process(std::vector<Scanline> &scanlines)
+{
+    const float correction = m_rangeCorrection;
+    for(auto &s: scanlines)
+    {
+        const uint16_t n = std::min<size_t>(s.intensities.size(), 0xffff);
+        Table const *t = table(s.range, correction, n);
+        const uint8_t *in = s.intensities.data();
+        const bool doppler = s.doppler.size() == n && n > 0;
+
+        m_intensities.resize(m_config.bins);
+        m_doppler.resize(doppler ? m_config.bins : 0);
+        for(size_t j = 0; j < m_config.bins; j++)
+        {
+            Tap const &tap = t->taps[j];
+            if(tap.index == past_spoke)
+            {
+                m_intensities[j] = 0;
+                if(doppler)
+                    m_doppler[j] = DOPPLER_NONE;
+                continue;
+            }
+            if(tap.span > 1)
+            {
+                const uint8_t *first = in + tap.index;
+                const uint8_t *peak = std::max_element(first, first + tap.span);
+                m_intensities[j] = *peak;
+                if(doppler)
+                    m_doppler[j] = s.doppler[peak - in];
+            }
+            else
+            {
+                uint8_t a = in[tap.index];
+                uint8_t b = tap.weight ? in[tap.index + 1] : a;
+                m_intensities[j] = (a*(256 - tap.weight) + b*tap.weight + 128) >> 8;
+                if(doppler)
+                    m_doppler[j] = s.doppler[tap.index + (tap.weight >= 128)];
+            }
+        }
+        s.intensities.assign(m_intensities.begin(), m_intensities.end());
+        s.doppler.assign(m_doppler.begin(), m_doppler.end());
+        s.range = t->range;
+        s.rangeDecimation = 1;
+    }
+}
+
+} // namespace halo_radar
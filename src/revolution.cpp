@@ -0,0 +1,83 @@
+#include "revolution.h"
+
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#include "radar.h"
+
+namespace halo_radar
+{
+
+void Revolution::resize(uint16_t s, uint16_t b)
+{
+    spokes = s;
+    bins = b;
+    intensities.assign(size_t(spokes)*bins, 0);
+    present.assign(spokes, 0);
+}
+
+void Revolution::clear()
+{
+    std::fill(intensities.begin(), intensities.end(), 0);
+    std::fill(present.begin(), present.end(), 0);
+}
+
+RevolutionAssembler::RevolutionAssembler(uint16_t spokes, uint16_t bins)
+{
+    m_current.resize(spokes, bins);
+    m_completed.resize(spokes, bins);
+}
+
+size_t RevolutionAssembler::row(float angle, uint16_t spokes)
+{
+    long r = std::lround(angle*spokes/360.0);
+    r %= spokes;
+    if(r < 0)
+        r += spokes;
+    return r;
+}
+
+bool RevolutionAssembler::add(Scanline const &scanline)
+{
+    size_t r = row(scanline.angle, m_current.spokes);
+
+    // a jump back of more than half a turn means the antenna passed north
+    bool wrapped = !m_empty && r < m_lastRow && m_lastRow - r > m_current.spokes/2;
+    if(wrapped)
+    {
+        std::swap(m_current, m_completed);
+        m_current.clear();
+        m_current.number = ++m_number;
+        m_empty = true;
+    }
+    if(m_empty)
+    {
+        m_current.stamp = std::chrono::system_clock::now();
+        m_empty = false;
+    }
+
+    size_t n;
+    if(scanline.rangeDecimation > 1)
+    {
+        // back to raw bins, so a row means the same at every load level
+        const size_t d = scanline.rangeDecimation;
+        n = std::min<size_t>(scanline.intensities.size()*d, m_current.bins);
+        uint8_t *row = m_current.spoke(r);
+        for(size_t i = 0; i < n; i++)
+            row[i] = scanline.intensities[i/d];
+    }
+    else
+    {
+        n = std::min<size_t>(scanline.intensities.size(), m_current.bins);
+        memcpy(m_current.spoke(r), scanline.intensities.data(), n);
+    }
+    if(n < m_current.bins)
+        memset(m_current.spoke(r)+n, 0, m_current.bins-n);
+    m_current.present[r] = 1;
+    m_current.range = scanline.range;
+    m_lastRow = r;
+    return wrapped;
+}
+
+} // namespace halo_radar
@@ -0,0 +1,414 @@
+#include "revolution_archive.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+
+#include "radar.h"
+
+namespace halo_radar
+{
+
+namespace
+{
+
+const uint32_t file_magic = 0x52415248;     // "HRAR"
+const uint32_t chunk_magic = 0x4b435248;    // "HRCK"
+const uint32_t index_magic = 0x42495248;    // "HRIB"
+const uint32_t trailer_magic = 0x58495248;  // "HRIX"
+const uint32_t archive_version = 2;
+
+uint64_t trailerCheck(ArchiveTrailer const &t)
+{
+    return t.indexOffset ^ t.entries ^ t.previous ^ t.magic;
+}
+
+uint64_t blockSize(uint64_t entries)
+{
+    return sizeof(ArchiveIndexHeader) + entries*sizeof(ArchiveIndexEntry) + sizeof(ArchiveTrailer);
+}
+
+bool pwriteAll(int fd, const void *data, size_t size, uint64_t offset)
+{
+    const uint8_t *p = reinterpret_cast<const uint8_t*>(data);
+    while(size > 0)
+    {
+        ssize_t n = pwrite(fd, p, size, offset);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            return false;
+        }
+        p += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+} // namespace
+
+ArchiveWriter::ArchiveWriter():m_encoder(1)
+{
+}
+
+ArchiveWriter::~ArchiveWriter()
+{
+    close();
+}
+
+bool ArchiveWriter::open(std::string const &path, unsigned indexInterval)
+{
+    close();
+    m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(m_fd < 0)
+        return false;
+    m_indexInterval = std::max(indexInterval, 1u);
+    m_sinceIndex = 0;
+    m_lastBlock = 0;
+    m_index.clear();
+
+    ArchiveFileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = file_magic;
+    header.version = archive_version;
+    m_end = sizeof(header);
+    if(!pwriteAll(m_fd, &header, sizeof(header), 0) || !writeIndex())
+    {
+        ::close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+bool ArchiveWriter::writeIndex()
+{
+    ArchiveIndexHeader header;
+    header.magic = index_magic;
+    header.reserved = 0;
+    header.entries = m_sinceIndex;
+    ArchiveTrailer trailer;
+    trailer.magic = trailer_magic;
+    trailer.version = archive_version;
+    trailer.indexOffset = m_end;
+    trailer.entries = m_sinceIndex;
+    trailer.previous = m_lastBlock;
+    trailer.check = trailerCheck(trailer);
+
+    const ArchiveIndexEntry *entries = m_index.data() + m_index.size() - m_sinceIndex;
+    const size_t entryBytes = m_sinceIndex*sizeof(ArchiveIndexEntry);
+    if(!pwriteAll(m_fd, &header, sizeof(header), m_end) ||
+       !pwriteAll(m_fd, entries, entryBytes, m_end + sizeof(header)) ||
+       !pwriteAll(m_fd, &trailer, sizeof(trailer), m_end + sizeof(header) + entryBytes))
+        return false;
+    m_lastBlock = m_end;
+    m_end += blockSize(m_sinceIndex);
+    m_sinceIndex = 0;
+    return true;
+}
+
+bool ArchiveWriter::write(Revolution const &revolution)
+{
+    if(m_fd < 0)
+        return false;
+
+    m_buffer.clear();
+    m_encoder.encode(revolution, m_buffer);
+
+    ArchiveChunkHeader header;
+    header.magic = chunk_magic;
+    header.size = m_buffer.size();
+    header.number = revolution.number;
+    header.stamp = std::chrono::duration_cast<std::chrono::nanoseconds>(revolution.stamp.time_since_epoch()).count();
+
+    iovec iov[2];
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = m_buffer.data();
+    iov[1].iov_len = m_buffer.size();
+    const size_t total = sizeof(header) + m_buffer.size();
+    ssize_t written = pwritev(m_fd, iov, 2, m_end);
+    size_t n = written > 0 ? written : 0;
+    if(n < total)
+    {
+        bool ok;
+        if(n < sizeof(header))
+            ok = pwriteAll(m_fd, reinterpret_cast<uint8_t*>(&header) + n, sizeof(header) - n, m_end + n) &&
+                pwriteAll(m_fd, m_buffer.data(), m_buffer.size(), m_end + sizeof(header));
+        else
+            ok = pwriteAll(m_fd, m_buffer.data() + (n - sizeof(header)), total - n, m_end + n);
+        if(!ok)
+        {
+            // drop whatever made it to the file
+            if(ftruncate(m_fd, m_end) < 0)
+                perror("archive truncate");
+            return false;
+        }
+    }
+
+    ArchiveIndexEntry entry;
+    entry.offset = m_end;
+    entry.size = header.size;
+    entry.number = header.number;
+    entry.stamp = header.stamp;
+    m_index.push_back(entry);
+    m_end += total;
+
+    if(++m_sinceIndex >= m_indexInterval)
+        return writeIndex();
+    return true;
+}
+
+void ArchiveWriter::close()
+{
+    if(m_fd < 0)
+        return;
+    if(m_sinceIndex > 0)
+        writeIndex();
+    ::close(m_fd);
+    m_fd = -1;
+}
+
+ArchiveReader::ArchiveReader()
+{
+}
+
+ArchiveReader::~ArchiveReader()
+{
+    close();
+}
+
+bool ArchiveReader::open(std::string const &path)
+{
+    close();
+    m_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(m_fd < 0)
+        return false;
+    if(!refresh())
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void ArchiveReader::close()
+{
+    if(m_data)
+        munmap(const_cast<uint8_t*>(m_data), m_size);
+    m_data = nullptr;
+    m_size = 0;
+    m_indexed = 0;
+    m_index.clear();
+    if(m_fd >= 0)
+        ::close(m_fd);
+    m_fd = -1;
+}
+
+bool ArchiveReader::map()
+{
+    struct stat st;
+    if(fstat(m_fd, &st) < 0 || size_t(st.st_size) < sizeof(ArchiveFileHeader))
+        return false;
+    if(m_data && size_t(st.st_size) == m_size)
+        return true;
+    if(m_data)
+        munmap(const_cast<uint8_t*>(m_data), m_size);
+    m_data = nullptr;
+    m_size = st.st_size;
+    void *p = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+    if(p == MAP_FAILED)
+    {
+        m_size = 0;
+        return false;
+    }
+    m_data = reinterpret_cast<const uint8_t*>(p);
+    return true;
+}
+
+bool ArchiveReader::loadFooter()
+{
+    if(m_size < sizeof(ArchiveFileHeader) + blockSize(0))
+        return false;
+    // blocks from the last to the first
+    std::vector<std::pair<uint64_t, uint64_t>> blocks;
+    uint64_t end = m_size;
+    size_t entries = 0;
+    while(end > sizeof(ArchiveFileHeader))
+    {
+        ArchiveTrailer trailer;
+        memcpy(&trailer, m_data + end - sizeof(trailer), sizeof(trailer));
+        if(trailer.magic != trailer_magic || trailer.check != trailerCheck(trailer) || trailer.entries > m_size ||
+           trailer.indexOffset + blockSize(trailer.entries) != end)
+            return false;
+        ArchiveIndexHeader header;
+        memcpy(&header, m_data + trailer.indexOffset, sizeof(header));
+        if(header.magic != index_magic || header.entries != trailer.entries)
+            return false;
+        blocks.emplace_back(trailer.indexOffset + sizeof(header), trailer.entries);
+        entries += trailer.entries;
+        if(trailer.previous == 0)
+            break;
+        if(trailer.previous >= trailer.indexOffset)
+            return false;
+        ArchiveIndexHeader previous;
+        memcpy(&previous, m_data + trailer.previous, sizeof(previous));
+        if(previous.magic != index_magic || previous.entries > m_size ||
+           trailer.previous + blockSize(previous.entries) > trailer.indexOffset)
+            return false;
+        end = trailer.previous + blockSize(previous.entries);
+    }
+    m_index.clear();
+    m_index.reserve(entries);
+    for(auto b = blocks.rbegin(); b != blocks.rend(); ++b)
+    {
+        auto first = reinterpret_cast<const ArchiveIndexEntry*>(m_data + b->first);
+        m_index.insert(m_index.end(), first, first + b->second);
+    }
+    m_indexed = m_size;
+    return true;
+}
+
+void ArchiveReader::scanChunks()
+{
+    uint64_t offset = m_indexed;
+    while(offset + sizeof(uint32_t) <= m_size)
+    {
+        uint32_t magic;
+        memcpy(&magic, m_data + offset, sizeof(magic));
+        if(magic == index_magic)
+        {
+            // already covered by the chunks before it
+            ArchiveIndexHeader header;
+            if(offset + sizeof(header) > m_size)
+                break;
+            memcpy(&header, m_data + offset, sizeof(header));
+            if(header.entries > m_size || offset + blockSize(header.entries) > m_size)
+                break;
+            offset += blockSize(header.entries);
+            continue;
+        }
+        ArchiveChunkHeader header;
+        if(magic != chunk_magic || offset + sizeof(header) > m_size)
+            break;
+        memcpy(&header, m_data + offset, sizeof(header));
+        if(offset + sizeof(header) + header.size > m_size)
+            break;
+        ArchiveIndexEntry entry;
+        entry.offset = offset;
+        entry.size = header.size;
+        entry.number = header.number;
+        entry.stamp = header.stamp;
+        m_index.push_back(entry);
+        offset += sizeof(header) + header.size;
+    }
+    m_indexed = offset;
+}
+
+bool ArchiveReader::refresh()
+{
+    if(m_fd < 0 || !map())
+        return false;
+    ArchiveFileHeader header;
+    memcpy(&header, m_data, sizeof(header));
+    if(header.magic != file_magic || header.version != archive_version)
+        return false;
+    // a finished file is indexed from its footer; anything else, and
+    // whatever was appended since, from the chunk headers past the last
+    // one already indexed
+    if(m_indexed == 0 && !loadFooter())
+    {
+        m_index.clear();
+        m_indexed = sizeof(ArchiveFileHeader);
+    }
+    scanChunks();
+    return true;
+}
+
+size_t ArchiveReader::find(uint64_t number) const
+{
+    auto it = std::lower_bound(m_index.begin(), m_index.end(), number, [](ArchiveIndexEntry const &e, uint64_t n)
+                               { return e.number < n; });
+    if(it == m_index.end() || it->number != number)
+        return m_index.size();
+    return it - m_index.begin();
+}
+
+size_t ArchiveReader::lowerBound(std::chrono::system_clock::time_point stamp) const
+{
+    int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(stamp.time_since_epoch()).count();
+    auto it = std::lower_bound(m_index.begin(), m_index.end(), ns, [](ArchiveIndexEntry const &e, int64_t t)
+                               { return e.stamp < t; });
+    return it - m_index.begin();
+}
+
+bool ArchiveReader::read(size_t i, Revolution &revolution) const
+{
+    if(i >= m_index.size())
+        return false;
+    ArchiveIndexEntry const &e = m_index[i];
+    if(e.offset + sizeof(ArchiveChunkHeader) + e.size > m_size)
+        return false;
+    RevolutionDeltaDecoder decoder;
+    if(!decoder.decode(m_data + e.offset + sizeof(ArchiveChunkHeader), e.size))
+        return false;
+    revolution = decoder.revolution();
+    return true;
+}
+
+size_t ArchiveReader::readRange(std::chrono::system_clock::time_point from, std::chrono::system_clock::time_point to,
+                                Callback const &callback, unsigned threads) const
+{
+    const size_t first = lowerBound(from);
+    const size_t last = std::max(first, lowerBound(to));
+    std::atomic<size_t> next(first);
+    std::atomic<size_t> decoded(0);
+
+    auto worker = [&]()
+    {
+        RevolutionDeltaDecoder decoder;
+        for(size_t i = next++; i < last; i = next++)
+        {
+            ArchiveIndexEntry const &e = m_index[i];
+            if(e.offset + sizeof(ArchiveChunkHeader) + e.size > m_size)
+                continue;
+            if(!decoder.decode(m_data + e.offset + sizeof(ArchiveChunkHeader), e.size))
+                continue;
+            callback(i, decoder.revolution());
+            decoded++;
+        }
+    };
+    threads = std::max(1u, std::min<unsigned>(threads, last - first));
+    std::vector<std::thread> workers;
+    for(unsigned t = 1; t < threads; t++)
+        workers.emplace_back(worker);
+    worker();
+    for(auto &w: workers)
+        w.join();
+    return decoded;
+}
+
+ArchiveStage::ArchiveStage(std::string const &path, unsigned indexInterval, uint16_t spokes, uint16_t bins)
+    :m_assembler(spokes, bins)
+{
+    m_writer.open(path, indexInterval);
+}
+
+void ArchiveStage::process(std::vector<Scanline> &scanlines)
+{
+    if(!m_writer.isOpen())
+        return;
+    for(auto const &s: scanlines)
+        if(m_assembler.add(s))
+            m_writer.write(m_assembler.completed());
+}
+
+} // namespace halo_radar
@@ -0,0 +1,231 @@
+#include "revolution_delta.h"
+
+#include <cstring>
+
+#include "radar.h"
+#include "spoke_codec.h"
+
+namespace halo_radar
+{
+
+namespace
+{
+
+const uint16_t delta_magic = 0x4452;
+
+template<typename T> void append(std::vector<uint8_t> &out, T const &value)
+{
+    const uint8_t *p = reinterpret_cast<const uint8_t*>(&value);
+    out.insert(out.end(), p, p + sizeof(T));
+}
+
+// First bin at or after start where a and b differ, or bins.
+size_t firstDifference(const uint8_t *a, const uint8_t *b, size_t start, size_t bins)
+{
+    size_t i = start;
+    while(i + 8 <= bins)
+    {
+        uint64_t wa, wb;
+        memcpy(&wa, a + i, 8);
+        memcpy(&wb, b + i, 8);
+        if(wa != wb)
+            break;
+        i += 8;
+    }
+    while(i < bins && a[i] == b[i])
+        i++;
+    return i;
+}
+
+RevolutionDeltaHeader makeHeader(Revolution const &revolution, uint8_t type)
+{
+    RevolutionDeltaHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = delta_magic;
+    header.type = type;
+    header.number = revolution.number;
+    header.stamp = std::chrono::duration_cast<std::chrono::nanoseconds>(revolution.stamp.time_since_epoch()).count();
+    header.range = revolution.range;
+    header.spokes = revolution.spokes;
+    header.bins = revolution.bins;
+    return header;
+}
+
+} // namespace
+
+RevolutionDeltaEncoder::RevolutionDeltaEncoder(unsigned keyframeInterval, uint16_t mergeGap)
+    :m_keyframeInterval(keyframeInterval),m_mergeGap(mergeGap)
+{
+}
+
+bool RevolutionDeltaEncoder::encode(Revolution const &revolution, std::vector<uint8_t> &out)
+{
+    bool keyframe = m_keyframeRequested || m_sinceKeyframe + 1 >= m_keyframeInterval ||
+        revolution.spokes != m_reference.spokes || revolution.bins != m_reference.bins;
+    if(keyframe)
+    {
+        encodeKeyframe(revolution, out);
+        m_sinceKeyframe = 0;
+        m_keyframeRequested = false;
+    }
+    else
+    {
+        encodeDelta(revolution, out);
+        m_sinceKeyframe++;
+    }
+    return keyframe;
+}
+
+void RevolutionDeltaEncoder::encodeKeyframe(Revolution const &revolution, std::vector<uint8_t> &out)
+{
+    append(out, makeHeader(revolution, REVOLUTION_KEYFRAME));
+    if(m_reference.spokes != revolution.spokes || m_reference.bins != revolution.bins)
+        m_reference.resize(revolution.spokes, revolution.bins);
+    for(size_t r = 0; r < revolution.spokes; r++)
+    {
+        out.push_back(revolution.present[r]);
+        if(revolution.present[r])
+        {
+            encodeSpoke(revolution.spoke(r), revolution.bins, out);
+            memcpy(m_reference.spoke(r), revolution.spoke(r), revolution.bins);
+        }
+        else
+            memset(m_reference.spoke(r), 0, revolution.bins);
+    }
+}
+
+uint32_t RevolutionDeltaEncoder::encodeDelta(Revolution const &revolution, std::vector<uint8_t> &out)
+{
+    size_t header_offset = out.size();
+    append(out, makeHeader(revolution, REVOLUTION_DELTA));
+    uint32_t records = 0;
+    const size_t bins = revolution.bins;
+    for(size_t r = 0; r < revolution.spokes; r++)
+    {
+        if(!revolution.present[r])
+            continue;
+        const uint8_t *current = revolution.spoke(r);
+        uint8_t *reference = m_reference.spoke(r);
+        size_t b = firstDifference(current, reference, 0, bins);
+        while(b < bins)
+        {
+            size_t start = b;
+            size_t last = b;
+            for(size_t j = b + 1; j < bins && j - last <= m_mergeGap; j++)
+                if(current[j] != reference[j])
+                    last = j;
+            size_t count = last - start + 1;
+
+            RevolutionDeltaRecord record;
+            record.row = r;
+            record.start = start;
+            record.count = count;
+            append(out, record);
+            size_t j = 0;
+            for(; j + 1 < count; j += 2)
+                out.push_back((current[start+j] & 0x0f) | (current[start+j+1] << 4));
+            if(j < count)
+                out.push_back(current[start+j] & 0x0f);
+            memcpy(reference + start, current + start, count);
+            records++;
+
+            b = firstDifference(current, reference, last + 1, bins);
+        }
+    }
+    reinterpret_cast<RevolutionDeltaHeader*>(out.data() + header_offset)->records = records;
+    return records;
+}
+
+bool RevolutionDeltaDecoder::decode(const uint8_t *in, size_t size)
+{
+    if(size < sizeof(RevolutionDeltaHeader))
+        return false;
+    RevolutionDeltaHeader header;
+    memcpy(&header, in, sizeof(header));
+    if(header.magic != delta_magic)
+        return false;
+    size_t used = sizeof(header);
+
+    if(header.type == REVOLUTION_KEYFRAME)
+    {
+        if(m_revolution.spokes != header.spokes || m_revolution.bins != header.bins)
+            m_revolution.resize(header.spokes, header.bins);
+        for(size_t r = 0; r < header.spokes; r++)
+        {
+            if(used >= size)
+                return false;
+            m_revolution.present[r] = in[used++];
+            if(m_revolution.present[r])
+            {
+                size_t n = decodeSpoke(in + used, size - used, m_revolution.spoke(r), header.bins);
+                if(n == 0)
+                    return false;
+                used += n;
+            }
+            else
+                memset(m_revolution.spoke(r), 0, header.bins);
+        }
+        m_hasKeyframe = true;
+    }
+    else if(header.type == REVOLUTION_DELTA)
+    {
+        if(!m_hasKeyframe || m_revolution.spokes != header.spokes || m_revolution.bins != header.bins)
+            return false;
+        for(uint32_t i = 0; i < header.records; i++)
+        {
+            RevolutionDeltaRecord record;
+            if(used + sizeof(record) > size)
+                return false;
+            memcpy(&record, in + used, sizeof(record));
+            used += sizeof(record);
+            size_t packed = (record.count + 1)/2;
+            if(record.row >= header.spokes || size_t(record.start) + record.count > header.bins || used + packed > size)
+                return false;
+            uint8_t *o = m_revolution.spoke(record.row) + record.start;
+            const uint8_t *p = in + used;
+            size_t j = 0;
+            for(; j + 1 < record.count; j += 2)
+            {
+                o[j] = p[j/2] & 0x0f;
+                o[j+1] = p[j/2] >> 4;
+            }
+            if(j < record.count)
+                o[j] = p[j/2] & 0x0f;
+            used += packed;
+            m_revolution.present[record.row] = 1;
+        }
+    }
+    else
+        return false;
+
+    m_revolution.number = header.number;
+    m_revolution.stamp = std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(header.stamp)));
+    m_revolution.range = header.range;
+    return true;
+}
+
+RevolutionDeltaStage::RevolutionDeltaStage(Callback callback, unsigned keyframeInterval, uint16_t spokes, uint16_t bins)
+    :m_callback(callback),m_assembler(spokes, bins),m_encoder(keyframeInterval)
+{
+}
+
+void RevolutionDeltaStage::requestKeyframe()
+{
+    m_keyframeRequested = true;
+}
+
+void RevolutionDeltaStage::process(std::vector<Scanline> &scanlines)
+{
+    for(auto const &s: scanlines)
+        if(m_assembler.add(s))
+        {
+            if(m_keyframeRequested.exchange(false))
+                m_encoder.requestKeyframe();
+            m_message.clear();
+            bool keyframe = m_encoder.encode(m_assembler.completed(), m_message);
+            if(m_callback)
+                m_callback(m_message.data(), m_message.size(), keyframe);
+        }
+}
+
+} // namespace halo_radar
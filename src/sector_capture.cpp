@@ -0,0 +1,160 @@
+#include "sector_capture.h"
+
+#include <cmath>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+
+#include "radar.h"
+#include "spoke_codec.h"
+
+namespace halo_radar
+{
+
+namespace
+{
+
+const uint32_t capture_magic = 0x43535248;  // "HRSC"
+const uint32_t record_magic = 0x54434553;   // "SECT"
+const uint32_t capture_version = 1;
+
+// sectors are a few kilobytes, anything far past that is corruption
+const uint32_t max_payload = 16*1024*1024;
+
+} // namespace
+
+void setSectorChannel(SectorRecord &record, std::string const &label)
+{
+    memset(record.channel, 0, sizeof(record.channel));
+    memcpy(record.channel, label.data(), std::min(label.size(), sizeof(record.channel) - 1));
+}
+
+SectorCaptureWriter::~SectorCaptureWriter()
+{
+    close();
+}
+
+bool SectorCaptureWriter::open(std::string const &path)
+{
+    close();
+    m_file = fopen(path.c_str(), "wb");
+    if(!m_file)
+        return false;
+    setvbuf(m_file, nullptr, _IOFBF, 1 << 20);
+    SectorCaptureHeader header;
+    header.magic = capture_magic;
+    header.version = capture_version;
+    if(fwrite(&header, sizeof(header), 1, m_file) != 1)
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void SectorCaptureWriter::close()
+{
+    if(m_file)
+        fclose(m_file);
+    m_file = nullptr;
+}
+
+bool SectorCaptureWriter::write(SectorRecord &record, const uint8_t *payload, size_t size)
+{
+    if(!m_file)
+        return false;
+    record.magic = record_magic;
+    record.size = size;
+    return fwrite(&record, sizeof(record), 1, m_file) == 1 &&
+        (size == 0 || fwrite(payload, size, 1, m_file) == 1);
+}
+
+SectorCaptureReader::~SectorCaptureReader()
+{
+    close();
+}
+
+bool SectorCaptureReader::open(std::string const &path)
+{
+    close();
+    m_atEnd = false;
+    m_file = fopen(path.c_str(), "rb");
+    if(!m_file)
+        return false;
+    setvbuf(m_file, nullptr, _IOFBF, 1 << 20);
+    SectorCaptureHeader header;
+    if(fread(&header, sizeof(header), 1, m_file) != 1 || header.magic != capture_magic || header.version != capture_version)
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void SectorCaptureReader::close()
+{
+    if(m_file)
+        fclose(m_file);
+    m_file = nullptr;
+}
+
+bool SectorCaptureReader::next(SectorRecord &record, std::vector<uint8_t> &payload)
+{
+    if(!m_file)
+        return false;
+    size_t n = fread(&record, 1, sizeof(record), m_file);
+    if(n != sizeof(record))
+    {
+        m_atEnd = n == 0 && feof(m_file);
+        return false;
+    }
+    if(record.magic != record_magic || record.size > max_payload)
+        return false;
+    payload.resize(record.size);
+    return record.size == 0 || fread(payload.data(), record.size, 1, m_file) == 1;
+}
+
+SectorCaptureStage::SectorCaptureStage(std::string const &path, std::string const &label):m_label(label)
+{
+    m_writer.open(path);
+}
+
+void SectorCaptureStage::process(std::vector<Scanline> &scanlines)
+{
+    if(scanlines.empty() || !m_writer.isOpen())
+        return;
+
+    SectorRecord record;
+    memset(&record, 0, sizeof(record));
+    record.stamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    setSectorChannel(record, m_label);
+    // same angles as HaloRadar::processData
+    record.angleStart = 2.0*M_PI*(360 - scanlines.front().angle)/360.0;
+    if(scanlines.size() > 1)
+    {
+        double angle_max = 2.0*M_PI*(360 - scanlines.back().angle)/360.0;
+        if(angle_max > record.angleStart && angle_max - record.angleStart > M_PI)
+            angle_max -= 2.0*M_PI;
+        record.angleIncrement = (angle_max - record.angleStart)/double(scanlines.size() - 1);
+    }
+    record.rangeMax = scanlines.front().range;
+    record.scanlines = scanlines.size();
+    record.bins = scanlines.front().intensities.size();
+
+    m_payload.clear();
+    for(auto const &s: scanlines)
+    {
+        // the format has one bin count per sector
+        if(s.intensities.size() >= record.bins)
+            encodeSpoke(s.intensities.data(), record.bins, m_payload);
+        else
+        {
+            std::vector<uint8_t> padded(s.intensities);
+            padded.resize(record.bins, 0);
+            encodeSpoke(padded.data(), record.bins, m_payload);
+        }
+    }
+    m_writer.write(record, m_payload.data(), m_payload.size());
+}
+
+} // namespace halo_radar
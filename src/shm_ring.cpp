@@ -0,0 +1,332 @@
+#include "shm_ring.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <algorithm>
+
+#include "radar.h"
+
+namespace halo_radar
+{
+
+namespace
+{
+
+const uint32_t shm_magic = 0x48524152; // "RARH"
+const uint32_t shm_version = 2;
+
+size_t align(size_t size)
+{
+    return (size + 63) & ~size_t(63);
+}
+
+int64_t nanoseconds(std::chrono::system_clock::time_point t)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+}
+
+// Marks a segment left under name retired, so its readers move on.
+void retire(std::string const &name)
+{
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if(fd < 0)
+        return;
+    struct stat st;
+    if(fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(ShmRingHeader))
+    {
+        void *memory = mmap(nullptr, sizeof(ShmRingHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(memory != MAP_FAILED)
+        {
+            reinterpret_cast<ShmRingHeader*>(memory)->retired.store(1, std::memory_order_release);
+            munmap(memory, sizeof(ShmRingHeader));
+        }
+    }
+    close(fd);
+}
+
+} // namespace
+
+ShmRingWriter::ShmRingWriter()
+{
+}
+
+ShmRingWriter::~ShmRingWriter()
+{
+    if(m_memory)
+    {
+        reinterpret_cast<ShmRingHeader*>(m_memory)->retired.store(1, std::memory_order_release);
+        munmap(m_memory, m_size);
+        int fd = shm_open(m_name.c_str(), O_RDONLY, 0);
+        if(fd >= 0)
+        {
+            struct stat st;
+            bool ours = fstat(fd, &st) == 0 && uint64_t(st.st_ino) == m_inode;
+            close(fd);
+            if(ours)
+                shm_unlink(m_name.c_str());
+        }
+    }
+}
+
+bool ShmRingWriter::create(std::string const &name, uint32_t slotCount, uint32_t payloadSize)
+{
+    m_name = name[0] == '/' ? name : "/" + name;
+    m_slotSize = align(sizeof(ShmSlotHeader) + payloadSize);
+    m_size = align(sizeof(ShmRingHeader)) + size_t(slotCount)*m_slotSize;
+
+    // a segment left by an earlier writer may still be mapped by readers,
+    // truncating it would fault them; they get a fresh one instead
+    retire(m_name);
+    shm_unlink(m_name.c_str());
+    int fd = shm_open(m_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if(fd < 0)
+        return false;
+    struct stat st;
+    if(ftruncate(fd, m_size) < 0 || fstat(fd, &st) < 0)
+    {
+        close(fd);
+        shm_unlink(m_name.c_str());
+        return false;
+    }
+    m_inode = st.st_ino;
+    void *memory = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(memory == MAP_FAILED)
+    {
+        shm_unlink(m_name.c_str());
+        return false;
+    }
+    m_memory = reinterpret_cast<uint8_t*>(memory);
+
+    ShmRingHeader *header = reinterpret_cast<ShmRingHeader*>(m_memory);
+    header->version = shm_version;
+    header->slotCount = slotCount;
+    header->slotSize = m_slotSize;
+    header->writeSequence.store(0, std::memory_order_relaxed);
+    header->retired.store(0, std::memory_order_relaxed);
+    for(uint32_t i = 0; i < slotCount; i++)
+        reinterpret_cast<ShmSlotHeader*>(m_memory + align(sizeof(ShmRingHeader)) + size_t(i)*m_slotSize)->sequence.store(0, std::memory_order_relaxed);
+    // readers check the magic last, after everything else is in place
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = shm_magic;
+    return true;
+}
+
+uint8_t *ShmRingWriter::begin()
+{
+    ShmRingHeader *header = reinterpret_cast<ShmRingHeader*>(m_memory);
+    m_slot = reinterpret_cast<ShmSlotHeader*>(m_memory + align(sizeof(ShmRingHeader)) + (m_sequence % header->slotCount)*m_slotSize);
+    m_slot->sequence.store(2*m_sequence+1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    return reinterpret_cast<uint8_t*>(m_slot + 1);
+}
+
+void ShmRingWriter::commit(uint32_t size, uint32_t type)
+{
+    ShmRingHeader *header = reinterpret_cast<ShmRingHeader*>(m_memory);
+    m_slot->size = size;
+    m_slot->type = type;
+    m_slot->sequence.store(2*m_sequence+2, std::memory_order_release);
+    m_sequence++;
+    header->writeSequence.store(m_sequence, std::memory_order_release);
+}
+
+uint64_t ShmRingWriter::published() const
+{
+    return m_sequence;
+}
+
+ShmRingReader::ShmRingReader()
+{
+}
+
+ShmRingReader::~ShmRingReader()
+{
+    if(m_memory)
+        munmap(m_memory, m_size);
+}
+
+bool ShmRingReader::open(std::string const &name)
+{
+    m_name = name[0] == '/' ? name : "/" + name;
+    if(!map())
+        return false;
+    m_next = m_header->writeSequence.load(std::memory_order_acquire);
+    m_dropped = 0;
+    return true;
+}
+
+bool ShmRingReader::map()
+{
+    int fd = shm_open(m_name.c_str(), O_RDONLY, 0);
+    if(fd < 0)
+        return false;
+    struct stat st;
+    if(fstat(fd, &st) < 0 || size_t(st.st_size) < sizeof(ShmRingHeader))
+    {
+        close(fd);
+        return false;
+    }
+    void *memory = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(memory == MAP_FAILED)
+        return false;
+
+    const ShmRingHeader *header = reinterpret_cast<const ShmRingHeader*>(memory);
+    bool ok = header->magic == shm_magic && header->version == shm_version && header->slotCount > 0 &&
+        align(sizeof(ShmRingHeader)) + size_t(header->slotCount)*header->slotSize <= size_t(st.st_size) &&
+        !header->retired.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if(!ok)
+    {
+        munmap(memory, st.st_size);
+        return false;
+    }
+    if(m_memory)
+        munmap(m_memory, m_size);
+    m_memory = reinterpret_cast<uint8_t*>(memory);
+    m_size = st.st_size;
+    m_header = header;
+    return true;
+}
+
+ShmSlotHeader *ShmRingReader::slot(uint64_t sequence) const
+{
+    return reinterpret_cast<ShmSlotHeader*>(m_memory + align(sizeof(ShmRingHeader)) + (sequence % m_header->slotCount)*m_header->slotSize);
+}
+
+ShmRingReader::Result ShmRingReader::next(ShmView &view)
+{
+    uint64_t written = m_header->writeSequence.load(std::memory_order_acquire);
+    if(m_next >= written)
+    {
+        if(!m_header->retired.load(std::memory_order_acquire))
+            return EMPTY;
+        auto now = std::chrono::steady_clock::now();
+        if(now < m_retry)
+            return EMPTY;
+        m_retry = now + std::chrono::milliseconds(100);
+        if(!map())
+            return EMPTY;
+        m_next = 0;
+        written = m_header->writeSequence.load(std::memory_order_acquire);
+        if(m_next >= written)
+            return EMPTY;
+    }
+    // keep a slot of margin, the oldest one may already be rewritten
+    if(written - m_next >= m_header->slotCount)
+    {
+        uint64_t resume = written - m_header->slotCount + 1;
+        m_dropped += resume - m_next;
+        m_next = resume;
+        return OVERRUN;
+    }
+
+    ShmSlotHeader *s = slot(m_next);
+    uint64_t sequence = s->sequence.load(std::memory_order_acquire);
+    if(sequence != 2*m_next+2)
+    {
+        m_dropped++;
+        m_next++;
+        return OVERRUN;
+    }
+    view.sequence = m_next;
+    view.type = s->type;
+    view.size = std::min<uint32_t>(s->size, m_header->slotSize - sizeof(ShmSlotHeader));
+    view.data = reinterpret_cast<const uint8_t*>(s + 1);
+    m_next++;
+    return OK;
+}
+
+bool ShmRingReader::valid(ShmView const &view) const
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot(view.sequence)->sequence.load(std::memory_order_relaxed) == 2*view.sequence+2;
+}
+
+ShmPublisher::ShmPublisher(std::string const &name, uint32_t spokeSlots, uint32_t revolutionSlots, uint16_t spokes, uint16_t bins)
+    :m_assembler(spokes, bins)
+{
+    m_open = m_spokes.create(name + "_spokes", spokeSlots, sizeof(ShmSpoke)) &&
+        m_revolutions.create(name + "_revolutions", revolutionSlots, sizeof(ShmRevolution) + size_t(spokes)*bins + spokes);
+    if(!m_open)
+        perror(("shm publisher " + name).c_str());
+}
+
+void ShmPublisher::process(std::vector<Scanline> &scanlines)
+{
+    if(!m_open)
+        return;
+    int64_t stamp = nanoseconds(std::chrono::system_clock::now());
+    for(auto const &s: scanlines)
+    {
+        ShmSpoke *spoke = reinterpret_cast<ShmSpoke*>(m_spokes.begin());
+        spoke->number = m_spokes.published();
+        spoke->stamp = stamp;
+        spoke->angle = s.angle;
+        spoke->range = s.range;
+        spoke->bins = std::min(s.intensities.size(), sizeof(spoke->intensities));
+        memcpy(spoke->intensities, s.intensities.data(), spoke->bins);
+        m_spokes.commit(sizeof(ShmSpoke), SHM_SPOKE);
+
+        if(m_assembler.add(s))
+            publishRevolution(m_assembler.completed());
+    }
+}
+
+void ShmPublisher::publishRevolution(Revolution const &revolution)
+{
+    uint8_t *payload = m_revolutions.begin();
+    ShmRevolution *header = reinterpret_cast<ShmRevolution*>(payload);
+    header->number = revolution.number;
+    header->stamp = nanoseconds(revolution.stamp);
+    header->range = revolution.range;
+    header->spokes = revolution.spokes;
+    header->bins = revolution.bins;
+    uint8_t *intensities = payload + sizeof(ShmRevolution);
+    memcpy(intensities, revolution.intensities.data(), revolution.intensities.size());
+    memcpy(intensities + revolution.intensities.size(), revolution.present.data(), revolution.present.size());
+    m_revolutions.commit(sizeof(ShmRevolution) + revolution.intensities.size() + revolution.present.size(), SHM_REVOLUTION);
+}
+
+bool ShmSubscriber::open(std::string const &name)
+{
+    return m_spokes.open(name + "_spokes") && m_revolutions.open(name + "_revolutions");
+}
+
+bool ShmSubscriber::nextSpoke(const ShmSpoke *&spoke, ShmView &view)
+{
+    ShmRingReader::Result result;
+    while((result = m_spokes.next(view)) == ShmRingReader::OVERRUN)
+        ;
+    if(result != ShmRingReader::OK || view.type != SHM_SPOKE || view.size < sizeof(ShmSpoke))
+        return false;
+    spoke = reinterpret_cast<const ShmSpoke*>(view.data);
+    return true;
+}
+
+bool ShmSubscriber::nextRevolution(const ShmRevolution *&revolution, const uint8_t *&intensities, const uint8_t *&present, ShmView &view)
+{
+    ShmRingReader::Result result;
+    while((result = m_revolutions.next(view)) == ShmRingReader::OVERRUN)
+        ;
+    if(result != ShmRingReader::OK || view.type != SHM_REVOLUTION || view.size < sizeof(ShmRevolution))
+        return false;
+    revolution = reinterpret_cast<const ShmRevolution*>(view.data);
+    size_t cells = size_t(revolution->spokes)*revolution->bins;
+    if(view.size < sizeof(ShmRevolution) + cells + revolution->spokes)
+        return false;
+    intensities = view.data + sizeof(ShmRevolution);
+    present = intensities + cells;
+    return true;
+}
+
+bool ShmSubscriber::valid(ShmView const &view) const
+{
+    return view.type == SHM_REVOLUTION ? m_revolutions.valid(view) : m_spokes.valid(view);
+}
+
+} // namespace halo_radar
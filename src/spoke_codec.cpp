@@ -0,0 +1,361 @@
+#include "spoke_codec.h"
+
+#include <algorithm>
+#include <cstring>
+#include <chrono>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "radar.h"
+
+namespace halo_radar
+{
+
+namespace
+{
+
+const size_t max_literal = 128;
+const size_t max_short_run = 8;
+const size_t max_run = 264;
+const size_t min_run = 3; // shorter runs are cheaper inside a literal
+
+// Length of the run of intensities[0] starting at intensities, at most limit.
+size_t runLength(const uint8_t *intensities, size_t limit)
+{
+    uint8_t v = intensities[0];
+    size_t n = 1;
+#ifdef __SSE2__
+    // 16 values at a time through the long zero and clutter runs
+    const __m128i value = _mm_set1_epi8(v);
+    while(n + 16 <= limit)
+    {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(intensities + n));
+        unsigned differ = ~unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(block, value))) & 0xffff;
+        if(differ)
+            return n + __builtin_ctz(differ);
+        n += 16;
+    }
+#endif
+    // then 8 at a time
+    uint64_t pattern = 0x0101010101010101ull*v;
+    while(n + 8 <= limit)
+    {
+        uint64_t word;
+        memcpy(&word, intensities + n, 8);
+        if(word != pattern)
+            break;
+        n += 8;
+    }
+    while(n < limit && intensities[n] == v)
+        n++;
+    return n;
+}
+
+// Bit k set where intensities[i+k] == intensities[i+k+1], for k < 64 and
+// i+k+1 < count.
+uint64_t equalMask(const uint8_t *intensities, size_t i, size_t count)
+{
+    uint64_t mask = 0;
+    size_t k = 0;
+#ifdef __SSE2__
+    for(; k < 64 && i + k + 17 <= count; k += 16)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(intensities + i + k));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(intensities + i + k + 1));
+        mask |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)))) << k;
+    }
+#endif
+    for(; k < 64 && i + k + 1 < count; k++)
+        mask |= uint64_t(intensities[i+k] == intensities[i+k+1]) << k;
+    return mask;
+}
+
+uint8_t *emitLiteral(const uint8_t *intensities, size_t count, uint8_t *out)
+{
+    *out++ = uint8_t(count-1);
+    size_t i = 0;
+#ifdef __SSE2__
+    // pairs as 16 bit lanes: low | high << 4, then narrowed to bytes
+    const __m128i nibbles = _mm_set1_epi8(0x0f);
+    const __m128i low_byte = _mm_set1_epi16(0x00ff);
+    for(; i + 32 <= count; i += 32)
+    {
+        __m128i a = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(intensities + i)), nibbles);
+        __m128i b = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(intensities + i + 16)), nibbles);
+        a = _mm_and_si128(_mm_or_si128(a, _mm_srli_epi16(a, 4)), low_byte);
+        b = _mm_and_si128(_mm_or_si128(b, _mm_srli_epi16(b, 4)), low_byte);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(a, b));
+        out += 16;
+    }
+#endif
+    for(; i + 1 < count; i += 2)
+        *out++ = (intensities[i] & 0x0f) | (intensities[i+1] << 4);
+    if(i < count)
+        *out++ = intensities[i] & 0x0f;
+    return out;
+}
+
+uint8_t *emitRun(uint8_t value, size_t count, uint8_t *out)
+{
+    if(count <= max_short_run)
+        *out++ = 0x80 | ((count-2) << 4) | value;
+    else
+    {
+        *out++ = 0xf0 | value;
+        *out++ = uint8_t(count-9);
+    }
+    return out;
+}
+
+const uint8_t doppler_approaching_code = 0x0f;
+const uint8_t doppler_receding_code = 0x0e;
+const uint8_t doppler_intensity = 0x0d;
+
+} // namespace
+
+void unpackSpoke(const uint8_t *packed, size_t bytes, uint8_t *intensities)
+{
+    size_t j = 0;
+#ifdef __SSE2__
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    for(; j + 16 <= bytes; j += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(packed + j));
+        __m128i lo = _mm_and_si128(v, mask);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(intensities + 2*j), _mm_unpacklo_epi8(lo, hi));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(intensities + 2*j + 16), _mm_unpackhi_epi8(lo, hi));
+    }
+#endif
+    for(; j < bytes; j++)
+    {
+        intensities[2*j] = packed[j] & 0x0f;
+        intensities[2*j+1] = packed[j] >> 4;
+    }
+}
+
+void unpackDopplerSpoke(const uint8_t *packed, size_t bytes, uint8_t *intensities, uint8_t *doppler, bool receding)
+{
+    size_t j = 0;
+#ifdef __SSE2__
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    const __m128i approaching_code = _mm_set1_epi8(doppler_approaching_code);
+    // 0xff never matches a nibble, which turns the receding test off
+    const __m128i receding_code = _mm_set1_epi8(receding ? doppler_receding_code : 0xff);
+    const __m128i replacement = _mm_set1_epi8(doppler_intensity);
+    const __m128i one = _mm_set1_epi8(DOPPLER_APPROACHING);
+    const __m128i two = _mm_set1_epi8(DOPPLER_RECEDING);
+    auto split = [&](__m128i v, uint8_t *intensity_out, uint8_t *doppler_out)
+    {
+        __m128i approaching = _mm_cmpeq_epi8(v, approaching_code);
+        __m128i receding = _mm_cmpeq_epi8(v, receding_code);
+        __m128i marked = _mm_or_si128(approaching, receding);
+        v = _mm_or_si128(_mm_andnot_si128(marked, v), _mm_and_si128(marked, replacement));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(intensity_out), v);
+        __m128i d = _mm_or_si128(_mm_and_si128(approaching, one), _mm_and_si128(receding, two));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(doppler_out), d);
+    };
+    for(; j + 16 <= bytes; j += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(packed + j));
+        __m128i lo = _mm_and_si128(v, mask);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+        split(_mm_unpacklo_epi8(lo, hi), intensities + 2*j, doppler + 2*j);
+        split(_mm_unpackhi_epi8(lo, hi), intensities + 2*j + 16, doppler + 2*j + 16);
+    }
+#endif
+    for(size_t i = 2*j; i < 2*bytes; i++)
+    {
+        uint8_t v = (i & 1) ? packed[i/2] >> 4 : packed[i/2] & 0x0f;
+        if(v == doppler_approaching_code)
+        {
+            doppler[i] = DOPPLER_APPROACHING;
+            v = doppler_intensity;
+        }
+        else if(receding && v == doppler_receding_code)
+        {
+            doppler[i] = DOPPLER_RECEDING;
+            v = doppler_intensity;
+        }
+        else
+            doppler[i] = DOPPLER_NONE;
+        intensities[i] = v;
+    }
+}
+
+void unpackSpokeHalfRange(const uint8_t *packed, size_t bytes, uint8_t *intensities)
+{
+    size_t j = 0;
+#ifdef __SSE2__
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    for(; j + 16 <= bytes; j += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(packed + j));
+        __m128i lo = _mm_and_si128(v, mask);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(intensities + j), _mm_max_epu8(lo, hi));
+    }
+#endif
+    for(; j < bytes; j++)
+        intensities[j] = std::max<uint8_t>(packed[j] & 0x0f, packed[j] >> 4);
+}
+
+void halveSpoke(uint8_t *intensities, uint8_t *doppler, size_t count)
+{
+    for(size_t i = 0; 2*i + 1 < count; i++)
+    {
+        // prefer the second bin only when it is the stronger, or as strong
+        // and the first carries no doppler class
+        size_t from = 2*i;
+        if(intensities[2*i+1] > intensities[2*i] ||
+           (doppler && intensities[2*i+1] == intensities[2*i] && doppler[2*i] == DOPPLER_NONE))
+            from = 2*i + 1;
+        intensities[i] = intensities[from];
+        if(doppler)
+            doppler[i] = doppler[from];
+    }
+}
+
+void encodeSpoke(const uint8_t *intensities, size_t count, std::vector<uint8_t> &out)
+{
+    // worst case is a one value literal (2 bytes) before every shortest run
+    // (1 byte for 3 values), under one byte per value; written to scratch
+    // space so out is not zero filled up to that bound on every call
+    thread_local std::vector<uint8_t> scratch;
+    if(scratch.size() < count + 2)
+        scratch.resize(count + 2);
+    uint8_t *const begin = scratch.data();
+    uint8_t *o = begin;
+
+    // runs of min_run start where two neighbouring equal flags are set, so
+    // noisy stretches are skipped 63 values at a time and go out as whole
+    // literals
+    static_assert(min_run == 3, "run starts are found from pairs of equal neighbours");
+    size_t literal_start = 0;
+    size_t i = 0;
+    while(i < count)
+    {
+        uint64_t equal = equalMask(intensities, i, count);
+        uint64_t starts = equal & (equal >> 1);
+        if(!starts)
+        {
+            // bit 63 can not start a run within this mask, look again from there
+            i = std::min(i + 63, count);
+            continue;
+        }
+        const unsigned k = __builtin_ctzll(starts);
+        i += k;
+        // the equal flags give the run unless it reaches past them
+        size_t run = __builtin_ctzll(~(equal >> k)) + 1;
+        if(run > 64 - k)
+            run = runLength(intensities + i, std::min(count - i, max_run));
+        while(i > literal_start)
+        {
+            size_t n = std::min(i - literal_start, max_literal);
+            o = emitLiteral(intensities + literal_start, n, o);
+            literal_start += n;
+        }
+        o = emitRun(intensities[i] & 0x0f, run, o);
+        i += run;
+        literal_start = i;
+    }
+    while(count > literal_start)
+    {
+        size_t n = std::min(count - literal_start, max_literal);
+        o = emitLiteral(intensities + literal_start, n, o);
+        literal_start += n;
+    }
+    out.insert(out.end(), begin, o);
+}
+
+void encodePackedSpoke(const uint8_t *packed, size_t bytes, std::vector<uint8_t> &out)
+{
+    uint8_t intensities[2048];
+    while(bytes > 0)
+    {
+        size_t n = std::min(bytes, sizeof(intensities)/2);
+        unpackSpoke(packed, n, intensities);
+        encodeSpoke(intensities, 2*n, out);
+        packed += n;
+        bytes -= n;
+    }
+}
+
+size_t decodeSpoke(const uint8_t *in, size_t size, uint8_t *intensities, size_t count)
+{
+    size_t used = 0;
+    size_t produced = 0;
+    while(produced < count)
+    {
+        if(used >= size)
+            return 0;
+        uint8_t token = in[used++];
+        if(token & 0x80)
+        {
+            size_t n;
+            if((token & 0x70) == 0x70)
+            {
+                if(used >= size)
+                    return 0;
+                n = in[used++] + 9;
+            }
+            else
+                n = ((token >> 4) & 0x07) + 2;
+            if(produced + n > count)
+                return 0;
+            memset(intensities + produced, token & 0x0f, n);
+            produced += n;
+        }
+        else
+        {
+            size_t n = token + 1;
+            size_t packed = (n + 1)/2;
+            if(produced + n > count || used + packed > size)
+                return 0;
+            const uint8_t *p = in + used;
+            uint8_t *o = intensities + produced;
+            size_t j = 0;
+            for(; 2*j + 1 < n; j++)
+            {
+                o[2*j] = p[j] & 0x0f;
+                o[2*j+1] = p[j] >> 4;
+            }
+            if(2*j < n)
+                o[2*j] = p[j] & 0x0f;
+            used += packed;
+            produced += n;
+        }
+    }
+    return used;
+}
+
+void SpokeCodecMeter::process(std::vector<Scanline> &scanlines)
+{
+    auto start = std::chrono::steady_clock::now();
+    uint64_t packed = 0;
+    m_buffer.clear();
+    for(auto const &s: scanlines)
+    {
+        encodeSpoke(s.intensities.data(), s.intensities.size(), m_buffer);
+        packed += (s.intensities.size()+1)/2;
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    m_spokes.fetch_add(scanlines.size(), std::memory_order_relaxed);
+    m_packedBytes.fetch_add(packed, std::memory_order_relaxed);
+    m_encodedBytes.fetch_add(m_buffer.size(), std::memory_order_relaxed);
+    m_encodeNanoseconds.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), std::memory_order_relaxed);
+}
+
+SpokeCodecStatistics SpokeCodecMeter::take()
+{
+    SpokeCodecStatistics ret;
+    ret.spokes = m_spokes.exchange(0);
+    ret.packedBytes = m_packedBytes.exchange(0);
+    ret.encodedBytes = m_encodedBytes.exchange(0);
+    ret.encodeNanoseconds = m_encodeNanoseconds.exchange(0);
+    return ret;
+}
+
+} // namespace halo_radar
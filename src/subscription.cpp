@@ -0,0 +1,387 @@
+#include "subscription.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "radar.h"
+
+namespace halo_radar
+{
+
+bool RegionOfInterest::overlaps(float from, float to) const
+{
+    if(startAngle == endAngle)
+        return false;
+    if(from < 0.0f)
+        return overlaps(from + 360.0f, 360.0f) || overlaps(0.0f, to);
+    if(startAngle < endAngle)
+        return startAngle < to && from < endAngle;
+    // [startAngle, 360) and [0, endAngle)
+    return startAngle < to || from < endAngle;
+}
+
+bool RegionOfInterest::bins(float range, size_t bins, size_t &first, size_t &last) const
+{
+    if(range <= 0.0f)
+    {
+        first = 0;
+        last = bins;
+        return bins > 0;
+    }
+    if(maxRange <= minRange)
+        return false;
+    const double per_bin = double(range)/bins;
+    const double f = std::floor(minRange/per_bin);
+    const double l = std::ceil(maxRange/per_bin);
+    first = f <= 0.0 ? 0 : f >= bins ? bins : size_t(f);
+    last = l >= bins ? bins : size_t(l);
+    // whole bytes, two bins each
+    first &= ~size_t(1);
+    last = std::min(bins, (last + 1) & ~size_t(1));
+    return first < last;
+}
+
+Subscription::Subscription(SubscriptionConfig const &config, MetricLabels labels):m_config(config)
+{
+    labels["subscription"] = config.name;
+    MetricsRegistry &metrics = MetricsRegistry::global();
+    m_delivered = metrics.counter("halo_radar_subscription_delivered_total", "Items handed to a subscriber.", labels);
+    m_dropped = metrics.counter("halo_radar_subscription_dropped_total", "Items a subscriber's full queue discarded.", labels);
+}
+
+Subscription::~Subscription()
+{
+    stop();
+}
+
+size_t Subscription::depth() const
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    return m_count;
+}
+
+void Subscription::start()
+{
+    m_thread = std::thread(&Subscription::run, this);
+}
+
+void Subscription::stop()
+{
+    {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopFlag = true;
+    }
+    m_ready.notify_all();
+    m_space.notify_all();
+    const std::lock_guard<std::mutex> lock(m_joinMutex);
+    if(m_thread.joinable())
+        m_thread.join();
+}
+
+SubscriptionHub::SubscriptionHub(MetricLabels const &labels):m_labels(labels)
+{
+}
+
+SubscriptionHub::~SubscriptionHub()
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    for(auto &s: m_sectorSubscribers)
+        s->stop();
+    for(auto &s: m_revolutionSubscribers)
+        s->stop();
+    for(auto &s: m_regionSubscribers)
+        s.subscription->stop();
+}
+
+std::shared_ptr<Subscription> SubscriptionHub::subscribeSpokes(SubscriptionConfig const &config, SpokeCallback callback)
+{
+    auto ret = std::make_shared<QueuedSubscription<SectorPtr> >(config, m_labels, [callback](SectorPtr const &sector)
+    {
+        for(auto const &s: sector->scanlines)
+            callback(s, sector);
+    });
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    m_sectorSubscribers.push_back(ret);
+    m_subscribers++;
+    return ret;
+}
+
+std::shared_ptr<Subscription> SubscriptionHub::subscribeSectors(SubscriptionConfig const &config, SectorCallback callback)
+{
+    auto ret = std::make_shared<QueuedSubscription<SectorPtr> >(config, m_labels, std::move(callback));
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    m_sectorSubscribers.push_back(ret);
+    m_subscribers++;
+    return ret;
+}
+
+std::shared_ptr<Subscription> SubscriptionHub::subscribeRevolutions(SubscriptionConfig const &config, RevolutionCallback callback)
+{
+    auto ret = std::make_shared<QueuedSubscription<RevolutionPtr> >(config, m_labels, std::move(callback));
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    m_revolutionSubscribers.push_back(ret);
+    m_subscribers++;
+    return ret;
+}
+
+std::shared_ptr<Subscription> SubscriptionHub::subscribeRegion(RegionOfInterest const &region, SubscriptionConfig const &config, RegionCallback callback)
+{
+    RegionSubscriber s;
+    s.region = region;
+    s.subscription = std::make_shared<QueuedSubscription<RegionSectorPtr> >(config, m_labels, [region, callback](RegionSectorPtr const &sector)
+    {
+        // the sector holds the union of all regions, cut out this one
+        for(auto const &r: sector->spokes)
+        {
+            float from, to;
+            rowSpan(RevolutionAssembler::row(r.angle, region_rows), from, to);
+            size_t first, last;
+            if(!region.overlaps(from, to) || !region.bins(r.range, r.bins, first, last))
+                continue;
+            for(auto const &span: r.spans)
+            {
+                size_t f = std::max<size_t>(first, span.firstBin);
+                size_t l = std::min<size_t>(last, span.firstBin + span.count);
+                if(f >= l)
+                    continue;
+                const size_t offset = span.offset + (f - span.firstBin);
+                RegionView v;
+                v.angle = r.angle;
+                v.range = r.range;
+                v.bins = r.bins;
+                v.firstBin = f;
+                v.count = l - f;
+                v.intensities = r.intensities.data() + offset;
+                v.doppler = r.doppler.empty() ? nullptr : r.doppler.data() + offset;
+                callback(v);
+            }
+        }
+    });
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    m_regionSubscribers.push_back(s);
+    rebuildRegionTable();
+    m_subscribers++;
+    m_regions++;
+    return s.subscription;
+}
+
+void SubscriptionHub::rowSpan(size_t row, float &from, float &to)
+{
+    // row rounds to the nearest, so a row reaches half a step either side
+    from = (row - 0.5)*360.0/region_rows;
+    to = (row + 0.5)*360.0/region_rows;
+}
+
+void SubscriptionHub::rebuildRegionTable()
+{
+    auto table = std::make_shared<RegionTable>(region_rows);
+    for(size_t r = 0; r < region_rows; r++)
+    {
+        float from, to;
+        rowSpan(r, from, to);
+        std::vector<RegionBand> &bands = (*table)[r];
+        for(auto const &s: m_regionSubscribers)
+            if(s.region.overlaps(from, to) && s.region.minRange < s.region.maxRange)
+                bands.push_back({s.region.minRange, s.region.maxRange});
+        std::sort(bands.begin(), bands.end(), [](RegionBand const &a, RegionBand const &b){ return a.minRange < b.minRange; });
+        size_t merged = 0;
+        for(size_t i = 0; i < bands.size(); i++)
+            if(merged > 0 && bands[i].minRange <= bands[merged-1].maxRange)
+                bands[merged-1].maxRange = std::max(bands[merged-1].maxRange, bands[i].maxRange);
+            else
+                bands[merged++] = bands[i];
+        bands.resize(merged);
+    }
+    m_regionTable = table;
+}
+
+void SubscriptionHub::unsubscribe(std::shared_ptr<Subscription> const &subscription)
+{
+    // first, so a data thread blocked on its queue lets go of m_mutex
+    subscription->stop();
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    auto s = std::find(m_sectorSubscribers.begin(), m_sectorSubscribers.end(), subscription);
+    if(s != m_sectorSubscribers.end())
+    {
+        m_sectorSubscribers.erase(s);
+        m_subscribers--;
+    }
+    auto r = std::find(m_revolutionSubscribers.begin(), m_revolutionSubscribers.end(), subscription);
+    if(r != m_revolutionSubscribers.end())
+    {
+        m_revolutionSubscribers.erase(r);
+        m_subscribers--;
+    }
+    auto g = std::find_if(m_regionSubscribers.begin(), m_regionSubscribers.end(),
+                          [&](RegionSubscriber const &s){ return s.subscription == subscription; });
+    if(g != m_regionSubscribers.end())
+    {
+        m_regionSubscribers.erase(g);
+        rebuildRegionTable();
+        m_regions--;
+        m_subscribers--;
+    }
+}
+
+template<typename T>
+std::shared_ptr<T> SubscriptionHub::acquire(std::vector<std::shared_ptr<T> > &pool, size_t &next)
+{
+    for(size_t i = 0; i < pool.size(); i++)
+    {
+        auto &p = pool[(next + i) % pool.size()];
+        if(p.use_count() == 1)
+        {
+            // pairs with the release of the last subscriber's reference
+            std::atomic_thread_fence(std::memory_order_acquire);
+            next = (next + i + 1) % pool.size();
+            return p;
+        }
+    }
+    pool.push_back(std::make_shared<T>());
+    return pool.back();
+}
+
+void SubscriptionHub::publish(std::vector<Scanline> const &scanlines)
+{
+    if(empty())
+        return;
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    if(!m_sectorSubscribers.empty() && !scanlines.empty())
+    {
+        auto sector = acquire(m_sectorPool, m_nextSector);
+        sector->number = m_sectorNumber++;
+        sector->stamp = std::chrono::system_clock::now();
+        // assigned element by element so the pooled spokes keep their capacity
+        sector->scanlines.resize(scanlines.size());
+        for(size_t i = 0; i < scanlines.size(); i++)
+        {
+            Scanline &s = sector->scanlines[i];
+            s.angle = scanlines[i].angle;
+            s.range = scanlines[i].range;
+            s.rangeDecimation = scanlines[i].rangeDecimation;
+            s.intensities.assign(scanlines[i].intensities.begin(), scanlines[i].intensities.end());
+            s.doppler.assign(scanlines[i].doppler.begin(), scanlines[i].doppler.end());
+        }
+        SectorPtr shared = sector;
+        sector.reset();
+        for(auto &s: m_sectorSubscribers)
+            s->push(shared);
+    }
+    if(!m_revolutionSubscribers.empty())
+        for(auto const &s: scanlines)
+            if(m_assembler.add(s))
+            {
+                auto revolution = acquire(m_revolutionPool, m_nextRevolution);
+                *revolution = m_assembler.completed();
+                RevolutionPtr shared = revolution;
+                revolution.reset();
+                for(auto &r: m_revolutionSubscribers)
+                    r->push(shared);
+            }
+    if(!m_regionSubscribers.empty() && !scanlines.empty())
+    {
+        // decoded whole anyway, copy out the union of the regions
+        m_table = m_regionTable;
+        startRegionSector();
+        for(auto const &s: scanlines)
+        {
+            RegionSpoke *r = addRegionSpoke(s.angle, s.range, s.intensities.size());
+            if(!r)
+                continue;
+            const bool doppler = s.doppler.size() == s.intensities.size();
+            if(doppler)
+                r->doppler.resize(r->intensities.size());
+            for(auto const &span: r->spans)
+            {
+                auto first = s.intensities.begin() + span.firstBin;
+                std::copy(first, first + span.count, r->intensities.begin() + span.offset);
+                if(doppler)
+                    std::copy(s.doppler.begin() + span.firstBin, s.doppler.begin() + span.firstBin + span.count, r->doppler.begin() + span.offset);
+            }
+        }
+        pushRegionSector();
+    }
+}
+
+void SubscriptionHub::beginRegions()
+{
+    {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        m_table = m_regionTable;
+    }
+    startRegionSector();
+}
+
+RegionSpoke *SubscriptionHub::addRegionSpoke(float angle, float range, size_t bins)
+{
+    if(!m_table || !m_region)
+        return nullptr;
+    std::vector<RegionBand> const &bands = (*m_table)[RevolutionAssembler::row(angle, region_rows)];
+    if(bands.empty())
+        return nullptr;
+    // the bands are disjoint in meters, but may meet once widened to bytes
+    m_spans.clear();
+    for(auto const &b: bands)
+    {
+        RegionOfInterest band;
+        band.minRange = b.minRange;
+        band.maxRange = b.maxRange;
+        size_t first, last;
+        if(!band.bins(range, bins, first, last))
+            continue;
+        if(!m_spans.empty() && first <= m_spans.back().second)
+            m_spans.back().second = std::max(m_spans.back().second, last);
+        else
+            m_spans.emplace_back(first, last);
+    }
+    if(m_spans.empty())
+        return nullptr;
+    if(m_regionSpokes == m_region->spokes.size())
+        m_region->spokes.emplace_back();
+    RegionSpoke &r = m_region->spokes[m_regionSpokes++];
+    r.angle = angle;
+    r.range = range;
+    r.bins = bins;
+    r.spans.clear();
+    size_t offset = 0;
+    for(auto const &s: m_spans)
+    {
+        r.spans.push_back({uint16_t(s.first), uint16_t(s.second - s.first), uint16_t(offset)});
+        offset += s.second - s.first;
+    }
+    r.intensities.resize(offset);
+    r.doppler.clear();
+    return &r;
+}
+
+void SubscriptionHub::publishRegions()
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    pushRegionSector();
+}
+
+void SubscriptionHub::startRegionSector()
+{
+    m_region = acquire(m_regionPool, m_nextRegion);
+    m_regionSpokes = 0;
+}
+
+void SubscriptionHub::pushRegionSector()
+{
+    if(!m_region)
+        return;
+    std::shared_ptr<RegionSector> sector;
+    sector.swap(m_region);
+    m_table.reset();
+    if(m_regionSpokes == 0)
+        return;
+    sector->number = m_regionNumber++;
+    sector->stamp = std::chrono::system_clock::now();
+    sector->spokes.resize(m_regionSpokes);
+    RegionSectorPtr shared = sector;
+    sector.reset();
+    for(auto &s: m_regionSubscribers)
+        s.subscription->push(shared);
+}
+
+} // namespace halo_radar
@@ -0,0 +1,246 @@
+#include "thread_utils.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <cstring>
+#include <cstdlib>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <alloca.h>
+
+namespace halo_radar
+{
+
+bool setCurrentThreadAffinity(std::vector<int> const &cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(auto cpu: cpus)
+        if(cpu >= 0 && cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    if(CPU_COUNT(&set) == 0)
+        return false;
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+std::vector<int> currentThreadAffinity()
+{
+    std::vector<int> ret;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0)
+        for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if(CPU_ISSET(cpu, &set))
+                ret.push_back(cpu);
+    return ret;
+}
+
+bool setCurrentThreadRealtime(int priority)
+{
+    sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+    return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+}
+
+void currentThreadFaults(long &minor, long &major)
+{
+    rusage usage;
+    if(getrusage(RUSAGE_THREAD, &usage) == 0)
+    {
+        minor = usage.ru_minflt;
+        major = usage.ru_majflt;
+    }
+}
+
+ThreadReport currentThreadReport(std::string const &name)
+{
+    ThreadReport ret;
+    ret.name = name;
+    ret.cpus = currentThreadAffinity();
+    sched_param param;
+    if(pthread_getschedparam(pthread_self(), &ret.policy, &param) == 0)
+        ret.priority = param.sched_priority;
+    return ret;
+}
+
+std::string ThreadReport::str() const
+{
+    std::stringstream ret;
+    ret << name << ": cpus [" << cpuListToString(cpus) << "]" << (affinityApplied ? "" : " (pinning FAILED)");
+    ret << ", policy " << (policy == SCHED_FIFO ? "SCHED_FIFO" : policy == SCHED_RR ? "SCHED_RR" : "SCHED_OTHER");
+    ret << " priority " << priority << (realtimeApplied ? "" : " (SCHED_FIFO FAILED)");
+    if(faultsCounted && warmedUp)
+        ret << ", page faults since warm-up: " << minorFaults << " minor, " << majorFaults << " major";
+    else if(faultsCounted)
+        ret << ", page faults: pending warm-up";
+    return ret.str();
+}
+
+std::string MemoryLockReport::str() const
+{
+    std::stringstream ret;
+    ret << "memory " << (locked ? "locked" : "NOT locked") << ", VmLck " << lockedBytes/1024 << " kB";
+    ret << ", prefaulted heap " << prefaultedHeap/1024 << " kB, stack " << prefaultedStack/1024 << " kB";
+    return ret.str();
+}
+
+namespace
+{
+
+void prefaultStack(size_t bytes)
+{
+    // alloca keeps the compiler from shrinking or moving the touched region
+    volatile uint8_t *stack = reinterpret_cast<volatile uint8_t*>(alloca(bytes));
+    for(size_t i = 0; i < bytes; i += 4096)
+        stack[i] = 0;
+}
+
+size_t lockedBytes()
+{
+    std::ifstream in("/proc/self/status");
+    std::string line;
+    while(std::getline(in, line))
+        if(line.compare(0, 6, "VmLck:") == 0)
+            return std::strtoul(line.c_str()+6, nullptr, 10)*1024;
+    return 0;
+}
+
+} // namespace
+
+MemoryLockReport lockProcessMemory(size_t heapBytes, size_t stackBytes)
+{
+    MemoryLockReport ret;
+    ret.locked = mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+
+    // keep freed memory in the heap instead of unmapping it, so pages
+    // touched here stay resident for later allocations
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+
+    if(heapBytes > 0)
+    {
+        uint8_t *heap = reinterpret_cast<uint8_t*>(malloc(heapBytes));
+        if(heap)
+        {
+            for(size_t i = 0; i < heapBytes; i += 4096)
+                heap[i] = 0;
+            free(heap);
+            ret.prefaultedHeap = heapBytes;
+        }
+    }
+    if(stackBytes > 0)
+    {
+        prefaultStack(stackBytes);
+        ret.prefaultedStack = stackBytes;
+    }
+    ret.lockedBytes = lockedBytes();
+    return ret;
+}
+
+int interfaceNumaNode(uint32_t interface)
+{
+    std::string name;
+    ifaddrs *addr_list;
+    if (!getifaddrs(&addr_list))
+    {
+        for (ifaddrs * addr = addr_list; addr; addr = addr->ifa_next)
+            if(addr->ifa_addr && addr->ifa_addr->sa_family == AF_INET && ((sockaddr_in *)(addr->ifa_addr))->sin_addr.s_addr == interface)
+            {
+                name = addr->ifa_name;
+                break;
+            }
+        freeifaddrs(addr_list);
+    }
+    if(name.empty())
+        return -1;
+
+    std::ifstream in("/sys/class/net/" + name + "/device/numa_node");
+    int node = -1;
+    if(!(in >> node))
+        return -1;
+    return node;
+}
+
+int interfaceIndex(uint32_t interface)
+{
+    int ret = 0;
+    ifaddrs *addr_list;
+    if (!getifaddrs(&addr_list))
+    {
+        for (ifaddrs * addr = addr_list; addr; addr = addr->ifa_next)
+            if(addr->ifa_addr && addr->ifa_addr->sa_family == AF_INET && ((sockaddr_in *)(addr->ifa_addr))->sin_addr.s_addr == interface)
+            {
+                ret = if_nametoindex(addr->ifa_name);
+                break;
+            }
+        freeifaddrs(addr_list);
+    }
+    return ret;
+}
+
+std::vector<int> numaNodeCpus(int node)
+{
+    if(node < 0)
+        return {};
+    std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string list;
+    if(!std::getline(in, list))
+        return {};
+    return parseCpuList(list);
+}
+
+std::vector<int> parseCpuList(std::string const &list)
+{
+    std::vector<int> ret;
+    std::stringstream ss(list);
+    std::string item;
+    while(std::getline(ss, item, ','))
+    {
+        if(item.empty())
+            continue;
+        try
+        {
+            auto dash = item.find('-');
+            if(dash == std::string::npos)
+                ret.push_back(std::stoi(item));
+            else
+                for(int cpu = std::stoi(item.substr(0, dash)); cpu <= std::stoi(item.substr(dash+1)); cpu++)
+                    ret.push_back(cpu);
+        }
+        catch (const std::exception &)
+        {
+            return {};
+        }
+    }
+    std::sort(ret.begin(), ret.end());
+    ret.erase(std::unique(ret.begin(), ret.end()), ret.end());
+    return ret;
+}
+
+std::string cpuListToString(std::vector<int> const &cpus)
+{
+    std::stringstream ret;
+    for(size_t i = 0; i < cpus.size(); i++)
+    {
+        size_t j = i;
+        while(j+1 < cpus.size() && cpus[j+1] == cpus[j]+1)
+            j++;
+        if(i > 0)
+            ret << ",";
+        ret << cpus[i];
+        if(j > i)
+            ret << "-" << cpus[j];
+        i = j;
+    }
+    return ret.str();
+}
+
+} // namespace halo_radar
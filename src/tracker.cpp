@@ -0,0 +1,211 @@
+#include "tracker.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace halo_radar
+{
+
+namespace
+{
+
+int64_t cellKey(int32_t cx, int32_t cy)
+{
+    return (int64_t(cx) << 32) | uint32_t(cy);
+}
+
+uint64_t cellHash(int64_t key)
+{
+    return uint64_t(key)*0x9e3779b97f4a7c15ull >> 32;
+}
+
+} // namespace
+
+void Tracker::Axis::predict(float dt, float q)
+{
+    // white acceleration noise of spectral density q
+    p += v*dt;
+    pp += dt*(2.0f*pv + dt*vv) + q*dt*dt*dt/3.0f;
+    pv += dt*vv + q*dt*dt/2.0f;
+    vv += q*dt;
+}
+
+void Tracker::Axis::correct(float z, float r)
+{
+    float s = pp + r;
+    float kp = pp/s;
+    float kv = pv/s;
+    float innovation = z - p;
+    p += kp*innovation;
+    v += kv*innovation;
+    vv -= kv*pv;
+    pv -= kp*pv;
+    pp -= kp*pp;
+}
+
+Tracker::Tracker(TrackerConfig const &config):m_config(config)
+{
+}
+
+void Tracker::buildGrid(std::vector<Contact> const &contacts)
+{
+    size_t buckets = 16;
+    while(buckets < 2*contacts.size())
+        buckets *= 2;
+    m_bucketMask = buckets - 1;
+    m_bucketStart.assign(buckets + 1, 0);
+    m_bucketContacts.resize(contacts.size());
+    m_contactCell.resize(contacts.size());
+
+    const float cell = m_config.gate;
+    for(size_t i = 0; i < contacts.size(); i++)
+    {
+        int64_t key = cellKey(std::floor(contacts[i].x/cell), std::floor(contacts[i].y/cell));
+        m_contactCell[i] = key;
+        m_bucketStart[(cellHash(key) & m_bucketMask) + 1]++;
+    }
+    for(size_t b = 0; b < buckets; b++)
+        m_bucketStart[b+1] += m_bucketStart[b];
+    // fill from the back so each bucket keeps contact order
+    for(size_t i = contacts.size(); i-- > 0;)
+    {
+        uint64_t b = cellHash(m_contactCell[i]) & m_bucketMask;
+        m_bucketContacts[--m_bucketStart[b+1]] = i;
+    }
+    // m_bucketStart[b+1] now is the start of bucket b
+    for(size_t b = 0; b < buckets; b++)
+        m_bucketStart[b] = m_bucketStart[b+1];
+    m_bucketStart[buckets] = contacts.size();
+}
+
+TrackUpdate Tracker::makeUpdate(Track const &track, uint8_t status, uint64_t revolution, int64_t stamp) const
+{
+    TrackUpdate u;
+    u.id = track.id;
+    u.status = status;
+    u.misses = track.misses;
+    u.hits = track.hits;
+    u.revolution = revolution;
+    u.stamp = stamp;
+    u.x = track.x.p;
+    u.y = track.y.p;
+    u.vx = track.x.v;
+    u.vy = track.y.v;
+    u.positionSigma = 0.5f*(std::sqrt(track.x.pp) + std::sqrt(track.y.pp));
+    u.cells = track.misses ? 0 : track.cells;
+    return u;
+}
+
+void Tracker::update(uint64_t revolution, std::chrono::system_clock::time_point stamp,
+                     std::vector<Contact> const &contacts, std::vector<TrackUpdate> &updates)
+{
+    updates.clear();
+    const int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(stamp.time_since_epoch()).count();
+    const float r = m_config.measurementSigma*m_config.measurementSigma;
+    const float q = m_config.acceleration*m_config.acceleration;
+
+    float dt = m_started ? std::chrono::duration<float>(stamp - m_stamp).count() : 0.0f;
+    dt = std::max(dt, 0.0f);
+    m_started = true;
+    m_stamp = stamp;
+    for(auto &t: m_tracks)
+    {
+        t.x.predict(dt, q);
+        t.y.predict(dt, q);
+    }
+
+    // candidate pairs from the 3x3 grid cells around each track
+    buildGrid(contacts);
+    m_candidates.clear();
+    const float cell = m_config.gate;
+    const float gate2 = m_config.gate*m_config.gate;
+    for(uint32_t ti = 0; ti < m_tracks.size(); ti++)
+    {
+        Track const &t = m_tracks[ti];
+        int32_t cx = std::floor(t.x.p/cell);
+        int32_t cy = std::floor(t.y.p/cell);
+        float sx = t.x.pp + r;
+        float sy = t.y.pp + r;
+        for(int32_t dx = -1; dx <= 1; dx++)
+        {
+            for(int32_t dy = -1; dy <= 1; dy++)
+            {
+                int64_t key = cellKey(cx + dx, cy + dy);
+                uint64_t b = cellHash(key) & m_bucketMask;
+                for(uint32_t k = m_bucketStart[b]; k < m_bucketStart[b+1]; k++)
+                {
+                    uint32_t ci = m_bucketContacts[k];
+                    if(m_contactCell[ci] != key)
+                        continue;
+                    float ex = contacts[ci].x - t.x.p;
+                    float ey = contacts[ci].y - t.y.p;
+                    if(ex*ex + ey*ey > gate2)
+                        continue;
+                    m_candidates.push_back({ex*ex/sx + ey*ey/sy, ti, ci});
+                }
+            }
+        }
+    }
+    std::sort(m_candidates.begin(), m_candidates.end(), [](Candidate const &a, Candidate const &b)
+              { return a.distance < b.distance; });
+
+    m_trackContact.assign(m_tracks.size(), -1);
+    m_contactUsed.assign(contacts.size(), 0);
+    for(auto const &c: m_candidates)
+    {
+        if(m_trackContact[c.track] >= 0 || m_contactUsed[c.contact])
+            continue;
+        m_trackContact[c.track] = c.contact;
+        m_contactUsed[c.contact] = 1;
+    }
+
+    size_t kept = 0;
+    for(size_t ti = 0; ti < m_tracks.size(); ti++)
+    {
+        Track t = m_tracks[ti];
+        if(m_trackContact[ti] >= 0)
+        {
+            Contact const &c = contacts[m_trackContact[ti]];
+            t.x.correct(c.x, r);
+            t.y.correct(c.y, r);
+            t.hits = std::min<unsigned>(t.hits + 1, 0xffff);
+            t.misses = 0;
+            t.cells = c.cells;
+            if(t.hits >= m_config.confirmHits)
+                t.confirmed = true;
+            updates.push_back(makeUpdate(t, t.confirmed ? TRACK_CONFIRMED : TRACK_TENTATIVE, revolution, ns));
+        }
+        else
+        {
+            t.misses = std::min<unsigned>(t.misses + 1, 0xff);
+            if(!t.confirmed || t.misses > m_config.maxMisses)
+            {
+                updates.push_back(makeUpdate(t, TRACK_DELETED, revolution, ns));
+                continue;
+            }
+            updates.push_back(makeUpdate(t, TRACK_COASTING, revolution, ns));
+        }
+        m_tracks[kept++] = t;
+    }
+    m_tracks.resize(kept);
+
+    const float speed2 = m_config.initialSpeedSigma*m_config.initialSpeedSigma;
+    for(uint32_t ci = 0; ci < contacts.size(); ci++)
+    {
+        if(m_contactUsed[ci])
+            continue;
+        Contact const &c = contacts[ci];
+        Track t;
+        t.id = m_nextId++;
+        t.x = {c.x, 0.0f, r, 0.0f, speed2};
+        t.y = {c.y, 0.0f, r, 0.0f, speed2};
+        t.hits = 1;
+        t.misses = 0;
+        t.confirmed = m_config.confirmHits <= 1;
+        t.cells = c.cells;
+        m_tracks.push_back(t);
+        updates.push_back(makeUpdate(t, t.confirmed ? TRACK_CONFIRMED : TRACK_TENTATIVE, revolution, ns));
+    }
+}
+
+} // namespace halo_radar
@@ -0,0 +1,428 @@
+#include "xdp_socket.h"
+
+#include <cerrno>
+
+#if __has_include(<linux/if_xdp.h>) && __has_include(<linux/bpf.h>)
+#define HALO_RADAR_HAVE_XDP 1
+#endif
+
+#ifdef HALO_RADAR_HAVE_XDP
+
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <linux/if_xdp.h>
+#include <linux/if_link.h>
+#include <linux/bpf.h>
+#include <unistd.h>
+#include <poll.h>
+#include <cstring>
+
+#include "thread_utils.h"
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+namespace halo_radar
+{
+
+namespace
+{
+
+const uint32_t map_entries = 64;    // queues a program can redirect from
+
+int bpf(int cmd, bpf_attr &attr)
+{
+    return syscall(__NR_bpf, cmd, &attr, sizeof(attr));
+}
+
+bpf_insn insn(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm)
+{
+    bpf_insn ret;
+    ret.code = code;
+    ret.dst_reg = dst;
+    ret.src_reg = src;
+    ret.off = off;
+    ret.imm = imm;
+    return ret;
+}
+
+// Redirects frames for group:port to the socket in map at the receiving
+// queue, and passes everything else. Packet loads are in host order, the
+// same bytes as the network order values they are compared with.
+std::vector<bpf_insn> redirectProgram(int map, uint32_t group, uint16_t port)
+{
+    std::vector<bpf_insn> p;
+    std::vector<size_t> to_pass, to_redirect;
+    auto jump_unless = [&](uint8_t reg, int32_t value)
+    {
+        to_pass.push_back(p.size());
+        p.push_back(insn(BPF_JMP32 | BPF_JNE | BPF_K, reg, 0, 0, value));
+    };
+    auto check_length = [&](int32_t bytes)
+    {
+        p.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0));
+        p.push_back(insn(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, bytes));
+        to_pass.push_back(p.size());
+        p.push_back(insn(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 0, 0));
+    };
+
+    p.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0));
+    p.push_back(insn(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_2, BPF_REG_6, offsetof(xdp_md, data), 0));
+    p.push_back(insn(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_3, BPF_REG_6, offsetof(xdp_md, data_end), 0));
+    check_length(34);                                                         // ethernet + ip
+    p.push_back(insn(BPF_LDX | BPF_H | BPF_MEM, BPF_REG_4, BPF_REG_2, 12, 0)); // ether type
+    jump_unless(BPF_REG_4, htons(ETHERTYPE_IP));
+    p.push_back(insn(BPF_LDX | BPF_B | BPF_MEM, BPF_REG_4, BPF_REG_2, 14, 0)); // version, no options
+    jump_unless(BPF_REG_4, 0x45);
+    p.push_back(insn(BPF_LDX | BPF_B | BPF_MEM, BPF_REG_4, BPF_REG_2, 23, 0)); // protocol
+    jump_unless(BPF_REG_4, IPPROTO_UDP);
+    p.push_back(insn(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_4, BPF_REG_2, 30, 0)); // destination
+    jump_unless(BPF_REG_4, int32_t(group));
+    // later fragments carry no UDP header, the group alone decides
+    p.push_back(insn(BPF_LDX | BPF_H | BPF_MEM, BPF_REG_4, BPF_REG_2, 20, 0));
+    p.push_back(insn(BPF_ALU | BPF_END | BPF_TO_BE, BPF_REG_4, 0, 0, 16));
+    p.push_back(insn(BPF_ALU | BPF_AND | BPF_K, BPF_REG_4, 0, 0, 0x1fff));
+    to_redirect.push_back(p.size());
+    p.push_back(insn(BPF_JMP32 | BPF_JNE | BPF_K, BPF_REG_4, 0, 0, 0));
+    check_length(38);                                                         // + udp ports
+    p.push_back(insn(BPF_LDX | BPF_H | BPF_MEM, BPF_REG_4, BPF_REG_2, 36, 0)); // destination port
+    jump_unless(BPF_REG_4, port);
+
+    size_t redirect = p.size();
+    p.push_back(insn(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_2, BPF_REG_6, offsetof(xdp_md, rx_queue_index), 0));
+    p.push_back(insn(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, map));
+    p.push_back(insn(0, 0, 0, 0, 0));
+    p.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS));  // without a socket on the queue
+    p.push_back(insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map));
+    p.push_back(insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+    size_t pass = p.size();
+    p.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS));
+    p.push_back(insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+
+    for(auto i: to_pass)
+        p[i].off = pass - (i + 1);
+    for(auto i: to_redirect)
+        p[i].off = redirect - (i + 1);
+    return p;
+}
+
+int loadProgram(std::vector<bpf_insn> const &program, std::string &verifierLog)
+{
+    static const char license[] = "GPL";
+    bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = reinterpret_cast<uint64_t>(program.data());
+    attr.insn_cnt = program.size();
+    attr.license = reinterpret_cast<uint64_t>(license);
+    int ret = bpf(BPF_PROG_LOAD, attr);
+    if(ret < 0 && errno != EPERM)
+    {
+        // again with the verifier log, for whoever has to work out why
+        int e = errno;
+        std::vector<char> log(1 << 16);
+        attr.log_buf = reinterpret_cast<uint64_t>(log.data());
+        attr.log_size = log.size();
+        attr.log_level = 1;
+        if(bpf(BPF_PROG_LOAD, attr) < 0)
+            verifierLog = log.data();
+        errno = e;
+    }
+    return ret;
+}
+
+} // namespace
+
+XdpSocket::XdpSocket(XdpConfig const &config):m_config(config)
+{
+}
+
+XdpSocket::~XdpSocket()
+{
+    close();
+}
+
+bool XdpSocket::open(uint32_t interface, uint32_t group, uint16_t port)
+{
+    close();
+    m_verifierLog.clear();
+    m_reassembler.setPort(port);
+    int index = interfaceIndex(interface);
+    if(index <= 0 || m_config.queue >= map_entries)
+    {
+        errno = index <= 0 ? ENODEV : EINVAL;
+        return false;
+    }
+    auto fail = [this]()
+    {
+        int e = errno;
+        close();
+        errno = e;
+        return false;
+    };
+
+    m_socket = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+    if(m_socket < 0)
+        return false;
+
+    m_umemSize = size_t(m_config.frameSize)*m_config.frameCount;
+    void *umem = mmap(nullptr, m_umemSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if(umem == MAP_FAILED)
+    {
+        m_umemSize = 0;
+        return fail();
+    }
+    m_umem = reinterpret_cast<uint8_t*>(umem);
+
+    xdp_umem_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.addr = reinterpret_cast<uint64_t>(m_umem);
+    reg.len = m_umemSize;
+    reg.chunk_size = m_config.frameSize;
+    int entries = m_config.frameCount;
+    int completion_entries = 64;    // receive only, but the kernel wants one
+    if(setsockopt(m_socket, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0 ||
+       setsockopt(m_socket, SOL_XDP, XDP_UMEM_FILL_RING, &entries, sizeof(entries)) < 0 ||
+       setsockopt(m_socket, SOL_XDP, XDP_UMEM_COMPLETION_RING, &completion_entries, sizeof(completion_entries)) < 0 ||
+       setsockopt(m_socket, SOL_XDP, XDP_RX_RING, &entries, sizeof(entries)) < 0)
+        return fail();
+
+    xdp_mmap_offsets offsets;
+    socklen_t len = sizeof(offsets);
+    if(getsockopt(m_socket, SOL_XDP, XDP_MMAP_OFFSETS, &offsets, &len) < 0)
+        return fail();
+    auto map_ring = [this](Ring &ring, xdp_ring_offset const &offset, uint32_t count, size_t descriptor, off_t page)
+    {
+        ring.mapSize = offset.desc + count*descriptor;
+        ring.map = mmap(nullptr, ring.mapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_socket, page);
+        if(ring.map == MAP_FAILED)
+        {
+            ring.map = nullptr;
+            return false;
+        }
+        uint8_t *base = reinterpret_cast<uint8_t*>(ring.map);
+        ring.producer = reinterpret_cast<uint32_t*>(base + offset.producer);
+        ring.consumer = reinterpret_cast<uint32_t*>(base + offset.consumer);
+        ring.descriptors = base + offset.desc;
+        ring.mask = count - 1;
+        return true;
+    };
+    if(!map_ring(m_rx, offsets.rx, entries, sizeof(xdp_desc), XDP_PGOFF_RX_RING) ||
+       !map_ring(m_fill, offsets.fr, entries, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) ||
+       !map_ring(m_completion, offsets.cr, completion_entries, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING))
+        return fail();
+
+    // every frame starts out with the kernel
+    m_rxConsumer = __atomic_load_n(m_rx.consumer, __ATOMIC_ACQUIRE);
+    m_fillProducer = __atomic_load_n(m_fill.producer, __ATOMIC_ACQUIRE);
+    for(uint32_t i = 0; i < m_config.frameCount; i++)
+        reinterpret_cast<uint64_t*>(m_fill.descriptors)[m_fillProducer++ & m_fill.mask] = uint64_t(i)*m_config.frameSize;
+    __atomic_store_n(m_fill.producer, m_fillProducer, __ATOMIC_RELEASE);
+
+    sockaddr_xdp address;
+    memset(&address, 0, sizeof(address));
+    address.sxdp_family = AF_XDP;
+    address.sxdp_flags = m_config.nativeMode ? XDP_ZEROCOPY : XDP_COPY;
+    address.sxdp_ifindex = index;
+    address.sxdp_queue_id = m_config.queue;
+    if(bind(m_socket, (sockaddr*)&address, sizeof(address)) < 0)
+        return fail();
+
+    bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint32_t);
+    attr.max_entries = map_entries;
+    m_map = bpf(BPF_MAP_CREATE, attr);
+    if(m_map < 0)
+        return fail();
+    uint32_t key = m_config.queue;
+    uint32_t value = m_socket;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = m_map;
+    attr.key = reinterpret_cast<uint64_t>(&key);
+    attr.value = reinterpret_cast<uint64_t>(&value);
+    if(bpf(BPF_MAP_UPDATE_ELEM, attr) < 0)
+        return fail();
+
+    m_program = loadProgram(redirectProgram(m_map, group, port), m_verifierLog);
+    if(m_program < 0)
+        return fail();
+    // a link fails with EBUSY rather than replacing another program, and
+    // detaches when closed, also when the process dies
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = m_program;
+    attr.link_create.target_ifindex = index;
+    attr.link_create.attach_type = BPF_XDP;
+    attr.link_create.flags = m_config.nativeMode ? XDP_FLAGS_DRV_MODE : XDP_FLAGS_SKB_MODE;
+    m_link = bpf(BPF_LINK_CREATE, attr);
+    if(m_link < 0)
+        return fail();
+
+    // an unbound UDP socket joins the group for IGMP but receives nothing
+    m_joinSocket = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+    ip_mreq mreq;
+    mreq.imr_interface.s_addr = interface;
+    mreq.imr_multiaddr.s_addr = group;
+    if(m_joinSocket < 0 || setsockopt(m_joinSocket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+        return fail();
+
+    m_holding = false;
+    m_lastDrops = 0;
+    return true;
+}
+
+void XdpSocket::close()
+{
+    // the link first, so frames go back to the stack
+    for(int *fd: {&m_link, &m_program, &m_map, &m_joinSocket})
+    {
+        if(*fd >= 0)
+            ::close(*fd);
+        *fd = -1;
+    }
+    for(Ring *ring: {&m_rx, &m_fill, &m_completion})
+    {
+        if(ring->map)
+            munmap(ring->map, ring->mapSize);
+        *ring = Ring();
+    }
+    if(m_socket >= 0)
+        ::close(m_socket);
+    m_socket = -1;
+    if(m_umem)
+        munmap(m_umem, m_umemSize);
+    m_umem = nullptr;
+    m_umemSize = 0;
+    m_holding = false;
+}
+
+void XdpSocket::recycle(uint64_t address)
+{
+    // the fill ring has room for every frame, so it can not be full
+    reinterpret_cast<uint64_t*>(m_fill.descriptors)[m_fillProducer++ & m_fill.mask] = address & ~uint64_t(m_config.frameSize - 1);
+    __atomic_store_n(m_fill.producer, m_fillProducer, __ATOMIC_RELEASE);
+}
+
+bool XdpSocket::next(const uint8_t *&payload, int &size, int timeoutMilliseconds)
+{
+    if(m_socket < 0)
+        return false;
+    if(m_holding)
+    {
+        recycle(m_held);
+        m_holding = false;
+    }
+    while(true)
+    {
+        uint32_t producer = __atomic_load_n(m_rx.producer, __ATOMIC_ACQUIRE);
+        if(producer == m_rxConsumer)
+        {
+            pollfd p;
+            p.fd = m_socket;
+            p.events = POLLIN;
+            p.revents = 0;
+            if(poll(&p, 1, timeoutMilliseconds) <= 0)
+                return false;
+            producer = __atomic_load_n(m_rx.producer, __ATOMIC_ACQUIRE);
+            if(producer == m_rxConsumer)
+                return false;
+        }
+        while(m_rxConsumer != producer)
+        {
+            xdp_desc const &d = reinterpret_cast<xdp_desc const*>(m_rx.descriptors)[m_rxConsumer & m_rx.mask];
+            uint64_t address = d.addr;
+            uint32_t length = d.len;
+            __atomic_store_n(m_rx.consumer, ++m_rxConsumer, __ATOMIC_RELEASE);
+            if(m_reassembler.addFrame(m_umem + address, length, payload, size))
+            {
+                // a whole datagram is read in place, keep its frame until the next call
+                m_held = address;
+                m_holding = true;
+                return true;
+            }
+            recycle(address);
+        }
+    }
+}
+
+double XdpSocket::backlog() const
+{
+    if(m_socket < 0)
+        return 0.0;
+    uint32_t producer = __atomic_load_n(m_rx.producer, __ATOMIC_ACQUIRE);
+    return double(producer - m_rxConsumer)/(m_rx.mask + 1);
+}
+
+uint64_t XdpSocket::takeDrops()
+{
+    xdp_statistics stats;
+    memset(&stats, 0, sizeof(stats));
+    socklen_t len = sizeof(stats);
+    if(m_socket < 0 || getsockopt(m_socket, SOL_XDP, XDP_STATISTICS, &stats, &len) < 0)
+        return 0;
+    // cumulative, unlike PACKET_STATISTICS
+    uint64_t drops = stats.rx_dropped + stats.rx_ring_full;
+    uint64_t ret = drops - m_lastDrops;
+    m_lastDrops = drops;
+    return ret;
+}
+
+} // namespace halo_radar
+
+#else
+
+// Built without AF_XDP headers, every open fails and the radar falls back
+// to another backend.
+
+namespace halo_radar
+{
+
+XdpSocket::XdpSocket(XdpConfig const &config):m_config(config)
+{
+}
+
+XdpSocket::~XdpSocket()
+{
+}
+
+bool XdpSocket::open(uint32_t, uint32_t, uint16_t)
+{
+    errno = ENOTSUP;
+    return false;
+}
+
+void XdpSocket::close()
+{
+}
+
+bool XdpSocket::next(const uint8_t *&, int &, int)
+{
+    return false;
+}
+
+uint64_t XdpSocket::takeDrops()
+{
+    return 0;
+}
+
+double XdpSocket::backlog() const
+{
+    return 0.0;
+}
+
+void XdpSocket::recycle(uint64_t)
+{
+}
+
+} // namespace halo_radar
+
+#endif